@@ -0,0 +1,30 @@
+#!/bin/sh
+# Runs a script that puts a batch of sleeps in the background and waits for
+# them all. Jobs that really run concurrently take about one sleep in total,
+# where a shell that waits for each `&` job in turn takes the sum.
+#
+# usage: bench/async_jobs.sh [path/to/cash] [jobs] [seconds per job]
+
+CASH=${1:-./cash}
+JOBS=${2:-20}
+SECONDS_PER_JOB=${3:-0.2}
+
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+awk -v n="$JOBS" -v s="$SECONDS_PER_JOB" 'BEGIN {
+    for (i = 0; i < n; i++)
+        print "/bin/sleep " s " &"
+    print "wait"
+}' > "$script"
+
+now_ns() {
+    date +%s%N
+}
+
+start=$(now_ns)
+"$CASH" "$script" 2> /dev/null
+end=$(now_ns)
+
+echo "jobs: $JOBS, $SECONDS_PER_JOB s each"
+echo "total: $(((end - start) / 1000000)) ms"
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Times an interactive cash that starts many background jobs at once and then
+# reaps them all before the next prompt.
+#
+# The jobs are started by a sourced file, so none of them is reaped until it
+# is done, and every one of them gets a "Completed" notice. The REPL needs a
+# terminal, which script(1) provides.
+#
+# usage: bench/job_table.sh [path/to/cash] [jobs]
+
+CASH=${1:-./cash}
+JOBS=${2:-8000}
+
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+awk -v n="$JOBS" 'BEGIN { for (i = 0; i < n; i++) print "/bin/true &"; }' \
+    > "$script"
+
+now_ns() {
+    date +%s%N
+}
+
+# cash must not be the session leader, or it can't put itself in a process
+# group of its own
+start=$(now_ns)
+printf 'source %s\nexit\n' "$script" |
+    script -qec "$CASH; true" /dev/null > /dev/null 2>&1
+end=$(now_ns)
+
+echo "jobs: $JOBS"
+echo "total: $(((end - start) / 1000000)) ms"
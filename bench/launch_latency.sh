@@ -0,0 +1,38 @@
+#!/bin/sh
+# Compares the per-command launch latency of the posix_spawn and fork engines.
+#
+# The generated script first parses (but never runs) one very long command, so
+# the shell has a large heap while it launches the commands being measured.
+# With fork() every launch copies the page tables for that heap, while
+# posix_spawn() does not, so the gap grows with the size of the padding.
+#
+# usage: bench/launch_latency.sh [path/to/cash] [commands] [padding words]
+
+CASH=${1:-./cash}
+COMMANDS=${2:-2000}
+PADDING=${3:-200000}
+
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+{
+    printf '/bin/false && /bin/true'
+    awk -v n="$PADDING" 'BEGIN { for (i = 0; i < n; i++) printf " padding"; }'
+    printf '\n'
+    awk -v n="$COMMANDS" 'BEGIN { for (i = 0; i < n; i++) print "/bin/true"; }'
+} > "$script"
+
+now_ns() {
+    date +%s%N
+}
+
+run() {
+    start=$(now_ns)
+    CASH_SPAWN=$1 "$CASH" "$script"
+    end=$(now_ns)
+    echo $(((end - start) / COMMANDS / 1000))
+}
+
+echo "commands: $COMMANDS, padding words: $PADDING"
+echo "fork:        $(run 0) us/command"
+echo "posix_spawn: $(run 1) us/command"
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compares how fast two cash binaries get through operator-heavy scripts, e.g.
+# the current build against one from before the lexer became table-driven.
+#
+# Every generated line is a chain of redirections and AND/OR operators whose
+# right side is never reached, so only builtins run. Lexing is only part of the
+# time even so: parsing and compiling the chains take most of it, and the two
+# lexers came out on par.
+#
+# usage: bench/lex_operators.sh path/to/cash path/to/reference/cash [lines]
+
+CASH=${1:-./cash}
+REFERENCE=${2:?usage: $0 cash reference-cash [lines]}
+LINES=${3:-20000}
+
+# the script runs from a scratch directory
+CASH=$(realpath "$CASH")
+REFERENCE=$(realpath "$REFERENCE")
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+awk -v lines="$LINES" 'BEGIN {
+    chain = ""
+    for (i = 0; i < 8; i++)
+        chain = chain " && : 2>&1 >>out <in 3<>rw &>all 2>>err >&2 | cat"
+    for (i = 0; i < lines; i++)
+        printf "false%s || ! true || :\n", chain
+}' > "$dir/script"
+
+now_ns() {
+    date +%s%N
+}
+
+run() {
+    start=$(now_ns)
+    (cd "$dir" && "$1" script)
+    end=$(now_ns)
+    echo $(((end - start) / 1000000))
+}
+
+echo "lines: $LINES, bytes: $(wc -c < "$dir/script")"
+echo "reference: $(run "$REFERENCE") ms"
+echo "current:   $(run "$CASH") ms"
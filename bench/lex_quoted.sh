@@ -0,0 +1,39 @@
+#!/bin/sh
+# Compares the lexer's SIMD and scalar scanners on long quoted words.
+#
+# The generated script is made of `:` commands whose only argument is a long
+# single-quoted JSON payload, like the ones our generated scripts embed. `:`
+# runs in-process, so nearly all of the time goes to reading and lexing.
+#
+# usage: bench/lex_quoted.sh [path/to/cash] [lines] [payload bytes]
+
+CASH=${1:-./cash}
+LINES=${2:-2000}
+PAYLOAD=${3:-16384}
+
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+
+awk -v lines="$LINES" -v size="$PAYLOAD" 'BEGIN {
+    item = "{\"id\": 12345, \"name\": \"payload\", \"tags\": [\"a\", \"b\"]}, "
+    payload = ""
+    while (length(payload) < size)
+        payload = payload item
+    for (i = 0; i < lines; i++)
+        printf ": '\''[%s]'\''\n", payload
+}' > "$script"
+
+now_ns() {
+    date +%s%N
+}
+
+run() {
+    start=$(now_ns)
+    CASH_SIMD=$1 "$CASH" "$script"
+    end=$(now_ns)
+    echo $(((end - start) / 1000000))
+}
+
+echo "lines: $LINES, payload bytes: $PAYLOAD"
+echo "scalar: $(run 0) ms"
+echo "simd:   $(run 1) ms"
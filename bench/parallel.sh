@@ -0,0 +1,73 @@
+#!/bin/sh
+# Runs a batch of sleeps through `parallel -j SLOTS` and a batch of short
+# commands with -k. With the slots kept full, the sleeps take about
+# jobs / slots sleeps in total, and the short commands show what starting,
+# reaping and writing out each run costs. Last, hundreds of short runs are
+# made several times over, with and without -k, and every run has to leave its
+# line: a run that is reaped while a sibling is being forked must not be
+# reported again once its job is gone. A backgrounded `parallel` has to give
+# the shell back at once, while its runs go on in a fork of the shell.
+#
+# usage: bench/parallel.sh [path/to/cash] [jobs] [slots] [seconds per job]
+
+CASH=${1:-./cash}
+JOBS=${2:-40}
+SLOTS=${3:-8}
+SECONDS_PER_JOB=${4:-0.1}
+
+now_ns() {
+    date +%s%N
+}
+
+inputs=$(awk -v n="$JOBS" -v s="$SECONDS_PER_JOB" 'BEGIN {
+    for (i = 0; i < n; i++)
+        printf "%s ", s
+}')
+
+start=$(now_ns)
+"$CASH" -c "parallel -j $SLOTS /bin/sleep ::: $inputs" \
+    > /dev/null
+end=$(now_ns)
+echo "sleeps: $JOBS, $SLOTS at a time, $SECONDS_PER_JOB s each"
+echo "total: $(((end - start) / 1000000)) ms"
+
+start=$(now_ns)
+seq 2000 | "$CASH" -c "parallel -k -j $SLOTS /bin/echo" > /dev/null
+end=$(now_ns)
+echo "ordered echos: 2000, $SLOTS at a time"
+echo "total: $(((end - start) / 1000000)) ms"
+
+STRESS_INPUTS=300
+STRESS_ROUNDS=10
+failures=0
+output=$(mktemp)
+for round in $(seq "$STRESS_ROUNDS"); do
+    for keep in "" "-k"; do
+        seq "$STRESS_INPUTS" |
+            "$CASH" -c "parallel -j $SLOTS $keep /bin/echo" > "$output"
+        status=$?
+        lines=$(wc -l < "$output")
+        if [ "$status" -ne 0 ] || [ "$lines" -ne "$STRESS_INPUTS" ]; then
+            echo "stress round $round $keep: $lines of $STRESS_INPUTS lines, status $status"
+            failures=$((failures + 1))
+        fi
+    done
+done
+rm -f "$output"
+echo "stress: $STRESS_ROUNDS rounds of $STRESS_INPUTS inputs, $SLOTS at a time"
+echo "failed rounds: $failures"
+
+# the runs take 2 * SECONDS_PER_JOB one after the other, the shell has to be
+# done well before the first one is
+start=$(now_ns)
+"$CASH" -c "parallel -j 1 /bin/sleep ::: $SECONDS_PER_JOB $SECONDS_PER_JOB &
+echo launched" > /dev/null
+end=$(now_ns)
+background_ms=$(((end - start) / 1000000))
+limit_ms=$(awk -v s="$SECONDS_PER_JOB" 'BEGIN { printf "%d", s * 1000 / 2 }')
+echo "backgrounded parallel: back after $background_ms ms"
+if [ "$background_ms" -ge "$limit_ms" ]; then
+    echo "backgrounded parallel blocked the shell"
+    failures=$((failures + 1))
+fi
+[ "$failures" -eq 0 ]
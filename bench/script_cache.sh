@@ -0,0 +1,42 @@
+#!/bin/sh
+# Compares running a large script parsed from scratch with running its image
+# from the script cache (`cash --compile`).
+#
+# The generated script only runs builtins, so nearly all of the uncached time
+# goes to lexing and parsing. The cache lives in a scratch directory.
+#
+# usage: bench/script_cache.sh [path/to/cash] [lines]
+
+CASH=${1:-./cash}
+LINES=${2:-100000}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export CASH_CACHE_DIR="$dir/cache"
+
+awk -v lines="$LINES" 'BEGIN {
+    for (i = 0; i < lines; i++) {
+        if (i % 3 == 0)
+            printf ": \"item %d\" --flag=value path/to/file >>/dev/null\n", i
+        else if (i % 3 == 1)
+            printf "true && : '\''quoted %d'\'' $HOME || false\n", i
+        else
+            printf "! false && : 2>&1 <>/dev/null; : done\n"
+    }
+}' > "$dir/script.sh"
+
+now_ns() {
+    date +%s%N
+}
+
+run() {
+    start=$(now_ns)
+    "$CASH" "$dir/script.sh"
+    end=$(now_ns)
+    echo $(((end - start) / 1000000))
+}
+
+echo "lines: $LINES, bytes: $(wc -c < "$dir/script.sh")"
+echo "parsed: $(run) ms"
+"$CASH" --compile "$dir/script.sh" || exit 1
+echo "cached: $(run) ms"
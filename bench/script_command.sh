@@ -0,0 +1,41 @@
+#!/bin/sh
+# Times a cash script that runs a small cash script as a command over and over.
+# A helper whose `#!` line names cash runs in a fork of the shell from its
+# cached parse (see find_cash_script). The same helper behind a link that isn't
+# called cash is exec'd by the kernel, which starts a new cash that parses it
+# again on every call.
+#
+# usage: bench/script_command.sh [path/to/cash] [calls]
+
+CASH=$(realpath "${1:-./cash}")
+CALLS=${2:-1000}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+ln -s "$CASH" "$dir/exec-cash"
+
+now_ns() {
+    date +%s%N
+}
+
+run() {
+    {
+        printf '#!%s\n' "$1"
+        printf ': "$1" --flag path/to/file && true || false\n'
+        printf 'echo done $1 >/dev/null\n'
+    } > "$dir/helper"
+    chmod +x "$dir/helper"
+    awk -v calls="$CALLS" -v helper="$dir/helper" 'BEGIN {
+        for (i = 0; i < calls; i++)
+            printf "%s %d\n", helper, i
+    }' > "$dir/main"
+
+    start=$(now_ns)
+    "$CASH" "$dir/main"
+    end=$(now_ns)
+    echo $(((end - start) / 1000000))
+}
+
+echo "calls: $CALLS"
+echo "exec'd: $(run "$dir/exec-cash") ms"
+echo "in the shell: $(run "$CASH") ms"
@@ -0,0 +1,46 @@
+#ifndef CASH_ARENA_H
+#define CASH_ARENA_H
+
+#include <cash/memory.h>
+#include <stddef.h>
+
+// bump allocator for everything a parse produces. Nothing in it is freed on its
+// own, the whole arena is reset or freed at once
+struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    // followed by `size` bytes
+};
+
+struct Arena {
+    // the block allocations come from, older ones follow through `next`
+    struct ArenaBlock* blocks;
+    // the last allocation, which arena_grow can extend in place
+    void* last;
+};
+
+struct Arena make_arena(void);
+void* arena_alloc(struct Arena* arena, size_t size);
+void* arena_grow(struct Arena* arena, void* ptr, size_t old_size,
+                 size_t new_size);
+char* arena_strndup(struct Arena* arena, const char* source, int length);
+// drops everything allocated, but keeps the largest block for reuse
+void reset_arena(struct Arena* arena);
+void free_arena(const struct Arena* arena);
+
+// ADD_LIST for lists that live in an arena
+#define ARENA_ADD_LIST(arena, list, count, cap, items, item)                 \
+    do {                                                                     \
+        if ((list)->count >= (list)->cap) {                                  \
+            const int new_cap = (list)->cap == 0 ? 4 : (list)->cap * 2;      \
+            (list)->items = arena_grow(                                      \
+                (arena), (list)->items, (list)->cap * sizeof(*(list)->items), \
+                new_cap * sizeof(*(list)->items));                           \
+            (list)->cap = new_cap;                                           \
+        }                                                                    \
+        (list)->items[(list)->count] = (item);                               \
+        (list)->count++;                                                     \
+    } while (0)
+
+#endif  // CASH_ARENA_H
@@ -27,12 +27,15 @@ struct ArgumentList {
     int argument_capacity;
 };
 struct ArgumentList make_arg_list(void);
-void add_argument(struct ArgumentList* list, struct ShellString arg);
-void free_arg_list(const struct ArgumentList* list);
+void add_argument(struct Arena* arena, struct ArgumentList* list,
+                  struct ShellString arg);
 
 struct Command {
     struct ShellString command_name;
     struct ArgumentList arguments;
+    // index into BUILTIN_NAMES of a static command name, resolved when it is
+    // parsed. -1 if the name is not a builtin or not static
+    int builtin;
 
     struct Redirection* redirections;
     int redirection_count;
@@ -43,40 +46,78 @@ enum ExprType {
     EXPR_SUBSHELL,
     EXPR_PIPELINE,
     EXPR_NOT,
-    EXPR_AND,
-    EXPR_OR,
+    EXPR_AND_OR,
+    EXPR_TIME,
 
     EXPR_COMMAND,
 };
 
+// `a | b | c`, at least two stages, each a command or a subshell
+struct Pipeline {
+    struct Expr* stages;
+    int stage_count;
+    int stage_capacity;
+};
+
+enum ListJoin {
+    LIST_AND,  // `&&`
+    LIST_OR,   // `||`
+};
+
+// `a && b || c`, at least two items. Like in sh the operators have equal
+// precedence and group to the left, so each item runs depending on the status
+// of everything before it
+struct AndOrList {
+    struct ListItem* items;
+    int item_count;
+    int item_capacity;
+};
+
+// `time [-p] pipeline`
+struct Timed {
+    struct Expr* expr;
+    bool posix;  // -p: the POSIX format instead of $TIMEFORMAT
+};
+
 struct Expr {
     enum ExprType type;
     struct StringView expr_text;
     bool background;
     union {
-        struct Program* subshell;  // EXPR_SUBSHELL
-        struct Command command;    // EXPR_COMMAND
-        struct {
-            struct Expr* left;
-            struct Expr* right;
-        } binary;
+        struct Program* subshell;   // EXPR_SUBSHELL
+        struct Command command;     // EXPR_COMMAND
+        struct Pipeline pipeline;   // EXPR_PIPELINE
+        struct Expr* negated;       // EXPR_NOT
+        struct AndOrList and_or;    // EXPR_AND_OR
+        struct Timed timed;         // EXPR_TIME
     };
 };
-void free_expr(const struct Expr* expr);
+
+struct ListItem {
+    // how the item is joined to the one before it, unused for the first
+    enum ListJoin join;
+    struct Expr expr;
+};
+
+void add_stage(struct Arena* arena, struct Pipeline* pipeline,
+               struct Expr stage);
+void add_list_item(struct Arena* arena, struct AndOrList* list,
+                   struct ListItem item);
 
 struct Stmt {
     struct Expr expr;
 };
-void free_stmt(const struct Stmt* stmt);
 
+// a Program and everything it points to live in the arena of the parser that
+// produced it, and go away with it
 struct Program {
     struct Stmt* statements;
     int statement_count;
     int statement_capacity;
 };
 struct Program make_program(void);
-void add_statement(struct Program* program, struct Stmt stmt);
-void free_program(const struct Program* program);
+void add_statement(struct Arena* arena, struct Program* program,
+                   struct Stmt stmt);
 
 #ifndef NDEBUG
 void print_program(const struct Program* program, int indent);
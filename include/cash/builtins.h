@@ -0,0 +1,16 @@
+#ifndef CASH_BUILTINS_H
+#define CASH_BUILTINS_H
+
+struct RawCommand;
+struct Vm;
+
+// builtins that only produce output (and an exit status) and never touch the
+// state of the shell, so they can run in-process instead of fork + exec
+int echo_builtin(struct Vm* vm, const struct RawCommand* raw_command);
+int printf_builtin(struct Vm* vm, const struct RawCommand* raw_command);
+int test_builtin(struct Vm* vm, const struct RawCommand* raw_command);
+int true_builtin(struct Vm* vm, const struct RawCommand* raw_command);
+int false_builtin(struct Vm* vm, const struct RawCommand* raw_command);
+int pwd_builtin(struct Vm* vm, const struct RawCommand* raw_command);
+
+#endif  // CASH_BUILTINS_H
@@ -0,0 +1,67 @@
+#ifndef CASH_COMPILER_H
+#define CASH_COMPILER_H
+
+#include <cash/ast.h>
+#include <stdio.h>
+
+enum OpCode {
+    OP_EXPAND_WORD,      // push the expansion of `word`
+    OP_BUILD_ARGV,       // pop the words of `command` into the pending command
+    OP_RUN_COMMAND,      // run the pending command on its own
+    OP_BEGIN_JOB,        // start a job for the pipeline `expr`
+    OP_PIPE,             // open a pipe from the next stage to the one after it
+    OP_SPAWN,            // start the pending command as the next stage
+    OP_SPAWN_SUBSHELL,   // start subchunk `chunk` as the next stage
+    OP_WAIT,             // wait for the job (unless in background), set $?
+    OP_SUBSHELL,         // run subchunk `chunk` as a subshell
+    OP_NOT,              // negate $?
+    OP_JUMP_IF_ZERO,     // jump to `target` if $? is 0
+    OP_JUMP_IF_NONZERO,  // jump to `target` if $? is not 0
+    OP_BEGIN_TIME,       // start timing the `time` of `expr`
+    OP_END_TIME,         // report what its pipeline used
+};
+
+// the instruction finishes the program, so it may replace the shell
+#define OP_FLAG_TAIL 1
+#define OP_FLAG_BACKGROUND 2
+
+struct Instruction {
+    enum OpCode op;
+    int flags;
+    union {
+        const struct ShellString* word;  // OP_EXPAND_WORD
+        const struct Command* command;   // OP_BUILD_ARGV
+        // OP_RUN_COMMAND, OP_BEGIN_JOB, OP_WAIT, OP_BEGIN_TIME, OP_END_TIME
+        const struct Expr* expr;
+        int target;               // jumps
+        int chunk;                // OP_SUBSHELL, OP_SPAWN_SUBSHELL
+    };
+};
+
+// flat code for a Program. Instructions point into the AST, so the Program has
+// to outlive the chunk
+struct Chunk {
+    struct Instruction* code;
+    int count;
+    int capacity;
+
+    // bodies of the subshells in the program, and of the AND/OR lists, `!`s
+    // and `time`s that run in the background
+    struct Chunk* subchunks;
+    int subchunk_count;
+    int subchunk_capacity;
+
+    // NULL when the chunk is the body of one background expression
+    const struct Program* program;
+};
+
+struct Chunk compile_program(const struct Program* program);
+void free_chunk(const struct Chunk* chunk);
+
+// number of words OP_BUILD_ARGV pops for `command`: its name, arguments and
+// redirection targets, in that order
+int command_word_count(const struct Command* command);
+
+void disassemble_chunk(const struct Chunk* chunk, FILE* stream, int indent);
+
+#endif  // CASH_COMPILER_H
@@ -21,6 +21,14 @@
             exit(status);                                                    \
     } while (0)
 
+// like CASH_ERROR, but never exits, for errors that only fail the current
+// command and not the whole script
+#define CASH_NONFATAL_ERROR(fmt, ...)                                       \
+    do {                                                                    \
+        fprintf(stderr,                                                     \
+                RED "cash:  Error: " fmt RESET __VA_OPT__(, ) __VA_ARGS__); \
+    } while (0)
+
 #define CASH_WARNING(fmt, ...)                                                 \
     do {                                                                       \
         fprintf(stderr, YELLOW "cash: " fmt RESET __VA_OPT__(, ) __VA_ARGS__); \
@@ -0,0 +1,44 @@
+#ifndef CASH_EVENT_LOOP_H
+#define CASH_EVENT_LOOP_H
+
+#include <stdbool.h>
+
+struct Process;
+struct Vm;
+
+// what the shell waits on for its children, all in one epoll instance: a pidfd
+// per process, readable once it exits, and a signalfd for SIGCHLD, through
+// which stops arrive. SIGCHLD stays blocked in the shell while the loop is
+// open, and is unblocked in every child before it execs.
+//
+// A process without a pidfd (pidfd_open is missing, the shell ran out of fds
+// or already has a few hundred pidfds open) is caught by SIGCHLD too, and
+// while there is one every SIGCHLD drains waitpid(WAIT_ANY) as the shell used
+// to. CASH_PIDFD=0 in the environment does without pidfds entirely
+struct EventLoop {
+    int epoll_fd;  // -1 while the loop is not open
+    int signal_fd;
+    bool use_pidfd;
+
+    // started processes not reaped yet, with and without a pidfd
+    int watched;
+    int unwatched;
+};
+
+struct EventLoop make_event_loop(bool use_pidfd);
+// opens the loop if it isn't, before the first child is started, so that no
+// SIGCHLD is missed
+void open_event_loop(struct EventLoop* loop);
+void close_event_loop(struct EventLoop* loop);
+
+// `process` was just started and has a pid
+void watch_process(struct EventLoop* loop, struct Process* process);
+// `process` was reaped
+void unwatch_process(struct EventLoop* loop, struct Process* process);
+
+// waits up to `timeout` ms (-1 for as long as it takes, 0 to only take what
+// is ready) for children of the shell to change state, and marks each change
+// on its process. Returns -1 when there is no child left to wait for
+int wait_for_children(struct Vm* vm, int timeout);
+
+#endif  // CASH_EVENT_LOOP_H
@@ -1,12 +1,15 @@
 #ifndef CASH_JOB_CONTROL_H
 #define CASH_JOB_CONTROL_H
 
+#include <cash/arena.h>
 #include <cash/ast.h>
 #include <cash/string.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
 
 struct RawRedirection {
     int flags;
@@ -16,30 +19,54 @@ struct RawRedirection {
     char *file_name;
 };
 
+// everything a command points to is either in the AST (see
+// ShellString.static_value) or in the arena of its job, none of it is freed on
+// its own
 struct RawCommand {
     char *name;
+    // index into BUILTIN_NAMES, -1 for an external command
+    int builtin;
     char **args;
     int args_count;
     struct RawRedirection *redirs;
     int redirs_count;
 };
-void free_raw_command(const struct RawCommand *raw_command);
 
 struct Process {
     struct Process *next_process;
+    struct Job *job;
     struct RawCommand raw_command;
+    // set for a `( ... )` pipeline stage, whose body runs in the forked child
+    // instead of `raw_command`
+    const struct Chunk *subshell;
+    // set when `raw_command` is a cash script, which the forked child runs
+    // itself instead of exec'ing a new cash for it
+    struct SourceCacheEntry *script;
     pid_t pid;
+    // watched by the event loop of the shell, -1 without one
+    int pidfd;
     int status;
+    // CLOCK_MONOTONIC when it was started and reaped, and what wait4 said it
+    // used, for `time` and `jobs -l`
+    struct timespec started;
+    struct timespec ended;
+    struct rusage usage;
     bool completed;
     bool stopped;
     bool terminated;
 };
-void free_process(struct Process *process);
 
+struct Chunk;
+struct SourceCacheEntry;
+struct Timer;
 struct Vm;
 
+// the jobs of the shell are in a JobTable (see job_table.h), which the links
+// and `changed` belong to
 struct Job {
     struct Job *next_job;
+    struct Job *prev_job;
+    struct Job *next_changed;
     struct Process *first_process;
     char *command;
 
@@ -48,28 +75,70 @@ struct Job {
 
     bool background;
     bool notified;
+    // `wait` returned its status, so it isn't reported or saved again
+    bool waited;
+    bool changed;
     struct termios term_state;
 
     int stdout, stdin, stderr;
+
+    // the innermost `time` it was started under, NULL if none
+    struct Timer *timer;
+
+    // holds the Job itself, its processes and their commands, so that launching
+    // a pipeline costs a few allocations whatever the number of arguments
+    struct Arena arena;
 };
+// a job for `command` that lives in `arena` with everything else of it, and
+// takes it over: `arena` is left empty
+struct Job *make_job(const struct Vm *vm, const char *command, int length,
+                     struct Arena *arena);
+// takes over `raw_command`, which must be in the arena of `job`, or runs
+// `subshell` if it isn't NULL
+struct Process *make_process(struct Job *job,
+                             const struct RawCommand *raw_command,
+                             const struct Chunk *subshell);
+// frees the job and everything in it at once
 void free_job(struct Job *job);
 
 void add_job(struct Vm *vm, struct Job *job);
 struct Job *get_job_by_id(struct Vm *vm, int job_id);
+// takes `job`, which must be off the changed queue, out of the table and frees
+// it
+void delete_job(struct Vm *vm, struct Job *job);
 
 bool job_is_stopped(const struct Job *job);
 bool job_is_completed(const struct Job *job);
 bool job_was_terminated(const struct Job *job);
 
 void remove_completed_jobs(struct Vm *vm);
+// records the wait status of `pid` on its process, and what it used if it
+// exited (`usage` is NULL for a stop). A pid of no job is passed over. Returns
+// -1 when there was nothing to record: wait4 failed or had nothing to report
+int mark_process_status(struct Vm *vm, pid_t pid, int status,
+                        const struct rusage *usage);
 void update_status(struct Vm *vm);
+void leave_parent_jobs(struct Vm *vm);
 void do_job_notification(struct Vm *vm);
 int list_jobs(struct Vm *vm, const struct RawCommand *raw_command);
 int fg(struct Vm *vm, const struct RawCommand *raw_command);
+int wait_jobs(struct Vm *vm, const struct RawCommand *raw_command);
+
+struct SavedFd {
+    int fd;
+    int copy;  // -1 if `fd` was not open before the redirection
+};
+int redirect_in_shell(const struct RawCommand *raw_command,
+                      struct SavedFd *saved);
+void restore_fds(const struct SavedFd *saved, int count);
 
 void launch_process(struct Vm *vm, struct Process *process, pid_t pgid,
                     pid_t pid, int in, int out, int err, bool foreground);
 void launch_job(struct Vm *vm, struct Job *job, bool foreground);
+void start_process(struct Vm *vm, struct Job *job, struct Process *process,
+                   int in, int out, bool foreground);
+void finish_job(struct Vm *vm, struct Job *job, bool foreground);
+void exec_in_place(struct Vm *vm, struct RawCommand *raw_command);
 
 void format_job_info(struct Job *job, const char *state, FILE *stream);
 
@@ -0,0 +1,87 @@
+#ifndef CASH_JOB_TABLE_H
+#define CASH_JOB_TABLE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct Job;
+struct Process;
+
+// the wait status of a background job that was removed before `wait` asked
+// for it, under the pid of its last process, which is what `$!` was
+struct SavedStatus {
+    pid_t pid;
+    // 0 once the id went to another job
+    int job_id;
+    int status;
+};
+
+struct JobSlot {
+    struct Job* job;  // NULL when the id is free
+    int next_free;    // index of the next free slot, -1 at the end
+};
+
+// the jobs of the shell. Reaping a process, `fg %N` and the notifications
+// before each prompt cost the same however many jobs are running
+struct JobTable {
+    // most recent first, for `jobs`; the head is the current job
+    struct Job* list;
+
+    // the id of a job is its index here plus one. The ids of removed jobs are
+    // reused, the last one freed first, before any id past `used_count`
+    struct JobSlot* slots;
+    int slot_count;
+    int used_count;
+    int first_free;
+
+    // processes by pid: open addressing over a power of two slots, kept at
+    // most half full. A process leaves as soon as it is reaped, before the
+    // kernel can hand its pid to another one
+    struct Process** pids;
+    int pid_count;
+    int pid_capacity;
+    int pid_bits;  // log2 of pid_capacity
+
+    // jobs that were started or had a process change state since they were
+    // last looked at, in that order. Only these can have something to report
+    // or be done
+    struct Job* first_changed;
+    struct Job* last_changed;
+
+    // oldest first, at most a thousand or so: a script that never waits
+    // forgets the oldest ones
+    struct SavedStatus* saved;
+    int saved_count;
+    int saved_capacity;
+};
+
+struct JobTable make_job_table(void);
+// frees the tables but not the jobs in them: a fork of the shell drops the
+// table while it runs a process of one of them
+void free_job_table(const struct JobTable* table);
+
+// gives `job` an id and makes it the current job
+void insert_job(struct JobTable* table, struct Job* job);
+// takes `job`, which must not be waiting in the changed queue, out of every
+// table. Its id is free again, the job itself is left to the caller
+void remove_job(struct JobTable* table, struct Job* job);
+struct Job* find_job(const struct JobTable* table, int job_id);
+
+// `process` has a pid and belongs to a job of the table
+void index_process(struct JobTable* table, struct Process* process);
+void unindex_process(struct JobTable* table, const struct Process* process);
+struct Process* find_process(const struct JobTable* table, pid_t pid);
+
+void save_status(struct JobTable* table, pid_t pid, int job_id, int status);
+// takes the status saved for `pid` out of the table, or the oldest one if `pid`
+// is 0. False if there is none
+bool take_saved_status(struct JobTable* table, pid_t pid, int* status);
+// the same for the job that had the id `job_id`, as long as no other job got it
+bool take_saved_job_status(struct JobTable* table, int job_id, int* status);
+void clear_saved_statuses(struct JobTable* table);
+
+void mark_job_changed(struct JobTable* table, struct Job* job);
+// the job that changed first, taken off the queue, or NULL
+struct Job* next_changed_job(struct JobTable* table);
+
+#endif  // CASH_JOB_TABLE_H
@@ -3,6 +3,14 @@
 
 #include <cash/error.h>
 
+#define CHECK_ALLOC(ptr)                                                  \
+    do {                                                                  \
+        if (!(ptr)) {                                                     \
+            CASH_ERROR(EXIT_FAILURE, "Memory allocation failed%s\n", ""); \
+            exit(EXIT_FAILURE);                                           \
+        }                                                                 \
+    } while (0)
+
 #define ADD_LIST(list, count, cap, items, item, item_type)                    \
     do {                                                                      \
         if ((list)->count >= (list)->cap) {                                   \
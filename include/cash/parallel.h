@@ -0,0 +1,19 @@
+#ifndef CASH_PARALLEL_H
+#define CASH_PARALLEL_H
+
+struct RawCommand;
+struct Vm;
+
+// parallel [-j N] [-k] command [args...] [::: inputs...]: runs `command` once
+// per input, with the input in place of every `{}` in its arguments (or after
+// them if there is none), and at most N of them at once, N being the number
+// of CPUs by default. Without `:::`, the inputs are the lines of stdin. Every
+// run gets /dev/null for its stdin.
+//
+// With -k the output of each run is held back until the runs before it have
+// written theirs, so it comes out in the order of the inputs rather than
+// interleaved. The status is the number of runs that failed, 101 for more than
+// a hundred, as with GNU parallel
+int parallel_jobs(struct Vm* vm, const struct RawCommand* raw_command);
+
+#endif  // CASH_PARALLEL_H
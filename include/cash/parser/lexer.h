@@ -2,16 +2,24 @@
 #define CASH_PARSER_LEXER_H
 
 #include <cash/ast.h>
+#include <cash/parser/symbols.h>
 #include <cash/parser/token.h>
 #include <stdbool.h>
 
 struct Lexer {
     bool repl_mode;
+    // where the strings of word tokens go, owned by the parser
+    struct Arena* arena;
+    // word components point into `input`, which has to outlive the program.
+    // Set this if it doesn't, and they are copied to the arena instead
+    bool copy_input;
+    // variable and command names of the parse, in `arena` as well
+    struct SymbolTable symbols;
     bool error;
     const char* input;
+    int length;
     int token_start;
     int position;
-    int backtrack_position;
 
     int first_line;
     int first_column;
@@ -29,7 +37,8 @@ struct Lexer {
     struct ShellString current_string;
 };
 
-struct Lexer* lexer_new(const char* input, bool repl_mode);
+struct Lexer* lexer_new(const char* input, bool repl_mode,
+                        struct Arena* arena);
 struct Token lexer_next_token(struct Lexer* lexer);
 void lexer_lex_full(struct Lexer* lexer);
 void reset_lexer(const char* input, struct Lexer* lexer);
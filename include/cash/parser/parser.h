@@ -1,12 +1,16 @@
 #ifndef CASH_PARSER_PARSER_H
 #define CASH_PARSER_PARSER_H
 
+#include <cash/arena.h>
 #include <cash/ast.h>
 #include <cash/parser/lexer.h>
 #include <cash/parser/token.h>
 
 struct Parser {
     struct Lexer* lexer;
+    // owns `program`, reset by reset_parser and freed by free_parser. The text
+    // of its words is borrowed from `input` though, see Lexer.copy_input
+    struct Arena* arena;
     struct Token current_token;
     struct Token next_token;
 
@@ -0,0 +1,17 @@
+#ifndef CASH_PARSER_SCAN_H
+#define CASH_PARSER_SCAN_H
+
+// bulk scanning for the lexer: finds where a run of ordinary characters in a
+// word ends, 16 or 32 bytes at a time where the CPU allows it
+
+enum ScanClass {
+    SCAN_UNQUOTED,  // ends at punctuation, `\` and NUL
+    SCAN_DQ,        // ends at `"`, `\`, `$` and NUL
+    SCAN_SQ,        // ends at `'` and NUL
+};
+
+// returns the length of the run of `class` at `begin`, which is `end - begin`
+// if it doesn't end before `end`. Nothing at or after `end` is read
+int scan_run(enum ScanClass class, const char* begin, const char* end);
+
+#endif  // CASH_PARSER_SCAN_H
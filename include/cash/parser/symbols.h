@@ -0,0 +1,34 @@
+#ifndef CASH_PARSER_SYMBOLS_H
+#define CASH_PARSER_SYMBOLS_H
+
+#include <stdint.h>
+
+struct Arena;
+
+// a command or variable name of a parse. Every occurrence of a name shares one
+// symbol, so what follows from the name (whether it is a builtin) is worked
+// out once per parse instead of once per command run
+struct Symbol {
+    char* name;  // NUL-terminated, in the arena of the parse
+    int length;
+    uint32_t hash;
+    // index into BUILTIN_NAMES, -1 if the name is not a builtin
+    int builtin;
+};
+
+// open addressing over a power of two slots. The symbols live in the arena of
+// the parse, so the table is cleared whenever that arena is reset
+struct SymbolTable {
+    struct Symbol** slots;
+    int count;
+    int capacity;
+};
+
+struct SymbolTable make_symbol_table(void);
+const struct Symbol* intern_symbol(struct SymbolTable* table,
+                                   struct Arena* arena, const char* name,
+                                   int length);
+void clear_symbol_table(struct SymbolTable* table);
+void free_symbol_table(const struct SymbolTable* table);
+
+#endif  // CASH_PARSER_SYMBOLS_H
@@ -0,0 +1,41 @@
+#ifndef CASH_PATH_CACHE_H
+#define CASH_PATH_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct RawCommand;
+struct Vm;
+
+struct PathCacheEntry {
+    struct PathCacheEntry* next;
+    char* name;
+    // NULL when the name was searched for and not found in $PATH (negative
+    // entry), so that missing commands don't walk $PATH every time
+    char* path;
+    uint32_t hash;
+    int hits;
+};
+
+struct PathCache {
+    struct PathCacheEntry** buckets;
+    int bucket_count;
+    int entry_count;
+
+    // value of $PATH the entries were resolved against; the whole table is
+    // dropped as soon as $PATH no longer matches it
+    char* path_env;
+};
+
+struct PathCache make_path_cache(void);
+void clear_path_cache(struct PathCache* cache);
+void free_path_cache(const struct PathCache* cache);
+
+const char* lookup_command_path(struct PathCache* cache, const char* name);
+void remember_command_path(struct PathCache* cache, const char* name,
+                           const char* path);
+void forget_command_path(struct PathCache* cache, const char* name);
+
+int hash_commands(struct Vm* vm, const struct RawCommand* raw_command);
+
+#endif  // CASH_PATH_CACHE_H
@@ -0,0 +1,35 @@
+#ifndef CASH_SCRIPT_CACHE_H
+#define CASH_SCRIPT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+struct Program;
+
+// compiled scripts live in $CASH_CACHE_DIR, or in cash/ under $XDG_CACHE_HOME
+// or ~/.cache. A compiled script is an image of its parsed Program in which
+// every pointer is an offset, listed in a relocation table, so loading one is
+// a private mapping of the file and a pass over that table
+
+// a Program loaded from the cache, valid until unload_cached_program
+struct CachedProgram {
+    void* image;
+    size_t size;
+    const struct Program* program;
+};
+
+// parses the script at `path` and writes its image to the cache, for
+// `cash --compile`
+int compile_script(const char* path);
+
+// looks up the image of the script at `path`, whose stat and mapped `contents`
+// the caller already has. Fails quietly when there is none, or when it was
+// compiled from another version of the script or is damaged, so that the
+// script is parsed instead
+bool load_cached_program(const char* path, const struct stat* st,
+                         const char* contents, size_t size,
+                         struct CachedProgram* cached);
+void unload_cached_program(const struct CachedProgram* cached);
+
+#endif  // CASH_SCRIPT_CACHE_H
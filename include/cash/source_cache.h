@@ -0,0 +1,81 @@
+#ifndef CASH_SOURCE_CACHE_H
+#define CASH_SOURCE_CACHE_H
+
+#include <cash/parser/parser.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+struct RawCommand;
+struct Vm;
+
+// a file read by `source` or run as a script (see find_cash_script), parsed
+// once and kept for as long as the file is not changed
+struct SourceCacheEntry {
+    struct SourceCacheEntry* next;
+    char* path;  // as it was first sourced, for `source -v`
+
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+
+    // owns the Program and the text it points into
+    struct Parser parser;
+    char* text;
+
+    int hits;
+    int misses;
+    // runs of the file not done yet, which keep a stale entry alive
+    int running;
+    bool stale;
+};
+
+// what the first line of an executable says about running it
+enum ScriptKind {
+    SCRIPT_NONE,   // a binary, or a `#!` line for another interpreter
+    SCRIPT_CASH,   // a `#!` line that names cash
+    SCRIPT_PLAIN,  // no `#!` line: a script for cash once it ran as one
+};
+
+// find_cash_script's verdict on the executable at `path`, so that the file is
+// read only the first time it runs, and again only once it changed
+struct ScriptProbe {
+    struct ScriptProbe* next;
+    char* path;
+    uint32_t hash;
+    enum ScriptKind kind;
+
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+};
+
+// few files are sourced by a session, a list is enough. Many more executables
+// are run, their probes are in a hash table keyed by path
+struct SourceCache {
+    struct SourceCacheEntry* entries;
+    int hits;
+    int misses;
+
+    struct ScriptProbe** probes;
+    int probe_bucket_count;
+    int probe_count;
+};
+
+struct SourceCache make_source_cache(void);
+void free_source_cache(const struct SourceCache* cache);
+
+// source [-v] [file [argument...]], also `.`
+int source_file(struct Vm* vm, const struct RawCommand* raw_command);
+
+// a command that resolves to a cash script runs it in a fork of the shell
+// from the cached parse, instead of exec'ing a new cash that parses it again
+bool find_cash_script(struct SourceCache* cache, const char* path,
+                      struct SourceCacheEntry** script);
+struct SourceCacheEntry* load_cash_script(struct SourceCache* cache,
+                                          const char* path);
+
+#endif  // CASH_SOURCE_CACHE_H
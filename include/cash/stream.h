@@ -0,0 +1,14 @@
+#ifndef CASH_STREAM_H
+#define CASH_STREAM_H
+
+// run a script as it is read: every complete statement runs as soon as its last
+// line is in, and its AST is dropped before the next one is parsed
+
+// reads `fd` in chunks, for stdin and other pipes
+int run_fd(int fd, int argc, char** argv);
+// maps the file if it is a regular one and reads it like run_fd otherwise. A
+// regular file with an up to date image in the script cache runs from that
+// instead of being parsed
+int run_file(const char* path, int argc, char** argv);
+
+#endif  // CASH_STREAM_H
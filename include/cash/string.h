@@ -1,6 +1,7 @@
 #ifndef CASH_STRING_H
 #define CASH_STRING_H
 
+struct Arena;
 struct Program;
 
 enum StringComponentType {
@@ -15,10 +16,12 @@ enum StringComponentType {
 struct StringComponent {
     enum StringComponentType type;
 
+    // `length` bytes of the source (or of a copy of it, see Lexer.copy_input),
+    // not NUL-terminated
     union {
-        char* literal;
-        char* var_substitution;
-        char* braced_substitution;
+        const char* literal;
+        const char* var_substitution;
+        const char* braced_substitution;
         struct Program* command_substitution;
     };
 
@@ -30,6 +33,11 @@ struct ShellString {
     struct StringComponent* components;
     int component_count;
     int component_capacity;
+
+    // the expansion of a word without substitutions or tilde prefixes, which is
+    // the same every time (set by resolve_static_string, NULL otherwise)
+    char* static_value;
+    int static_length;
 };
 
 struct String {
@@ -42,20 +50,24 @@ struct StringView {
     int length;
 };
 
+// components and their text live in the arena of the parse
 struct ShellString make_string(void);
-void add_string_literal(struct ShellString* str, enum StringComponentType type,
-                        const char* literal, int length, int escapes);
-void add_string_component(struct ShellString* str,
+void add_string_literal(struct Arena* arena, struct ShellString* str,
+                        enum StringComponentType type, const char* literal,
+                        int length, int escapes);
+void add_string_component(struct Arena* arena, struct ShellString* str,
                           enum StringComponentType type, const char* value,
                           int length);
 
+void resolve_static_string(struct Arena* arena, struct ShellString* str);
+int copy_unescaped(char* dest, const struct StringComponent* component,
+                   int start);
+
 char* grow_string(char* str, int new_size);
 void append(struct String* string, const char* value);
 void append_n(struct String* string, const char* value, int length);
 void append_n_terminate(struct String* string, const char* value, int length);
 
-void free_string_component(const struct StringComponent* component);
-void free_shell_string(const struct ShellString* str);
 void free_string(const struct String* string);
 
 #ifndef NDEBUG
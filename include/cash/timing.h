@@ -0,0 +1,58 @@
+#ifndef CASH_TIMING_H
+#define CASH_TIMING_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+struct Process;
+struct Vm;
+
+// a process that exited while a `time` was running
+struct TimedStage {
+    char* command;
+    struct timespec started;
+    double real;  // seconds from its start to its exit
+    struct rusage usage;
+};
+
+// a `time` that is running. The processes of the jobs started under it add
+// what they used as they are reaped, to it and to every `time` around it
+struct Timer {
+    struct Timer* outer;
+    struct timespec started;
+    // of the shell itself at the start, for the builtins it runs meanwhile
+    struct rusage self;
+    // of the processes reaped so far: the sums, but the largest maxrss
+    struct rusage children;
+
+    // the first few processes, each on its own
+    struct TimedStage* stages;
+    int stage_count;
+    int stage_capacity;
+    int dropped_stages;
+};
+
+// makes a new timer the innermost one of `vm`
+void start_timer(struct Vm* vm);
+// reports the innermost timer of `vm` on stderr and drops it. The format is
+// $TIMEFORMAT, or the POSIX one with `posix`
+void stop_timer(struct Vm* vm, bool posix);
+// `timer` and the ones around it
+void free_timers(struct Timer* timer);
+
+// `process`, of a job started under `timer`, was reaped
+void add_timed_process(struct Timer* timer, const struct Process* process);
+void add_timed_usage(struct Timer* timer, const char* command, int length,
+                     const struct timespec* started,
+                     const struct timespec* ended,
+                     const struct rusage* usage);
+
+// one line's worth of what a process used, for `jobs -l` and the stages of a
+// `time`
+void print_usage(double real, const struct rusage* usage, FILE* stream);
+double seconds_between(const struct timespec* from,
+                       const struct timespec* to);
+
+#endif  // CASH_TIMING_H
@@ -3,6 +3,7 @@
 
 #include <cash/string.h>
 #include <pwd.h>
+#include <stddef.h>
 
 #ifndef NDEBUG
 #define CASH_DEBUG(...) fprintf(stderr, __VA_ARGS__)
@@ -10,19 +11,20 @@
 #define CASH_DEBUG(...) ((void)0)
 #endif
 
-char* read_all_stdin(void);
-char* read_file(const char* path);
-
-void run_string(const char* text, int argc, char** argv);
-void run_file(const char* path, int argc, char** argv);
+// runs a whole script that is already in memory, like the argument of -c. See
+// stream.h for scripts that are read
+int run_string(const char* text, int argc, char** argv);
 
 const struct passwd* get_pw(void);
 char* make_new_prompt(const char* username);
 
 char* get_cwd(void);
 
+// the `size` bytes of the file `fd` (a regular file, so `size` comes from
+// fstat), NUL-terminated. NULL with errno set if they can't all be read
+char* read_whole_file(int fd, size_t size);
+
 char* strndup_null_terminated(const char* source, int len);
 int is_number(const char* str);
-struct String number_to_string(int number);
 
 #endif  // CASH_UTIL_H
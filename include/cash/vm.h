@@ -2,7 +2,12 @@
 #define CASH_VM_H
 
 #include <cash/ast.h>
+#include <cash/event_loop.h>
 #include <cash/job_control.h>
+#include <cash/job_table.h>
+#include <cash/path_cache.h>
+#include <cash/source_cache.h>
+#include <cash/timing.h>
 #include <pwd.h>
 #include <stdbool.h>
 #include <termios.h>
@@ -12,7 +17,8 @@ extern const char* BUILTIN_NAMES[];
 extern const BuiltinFunc BUILTIN_FUNCS[];
 extern const int BUILTIN_COUNT;
 
-int is_builtin(const char* name);
+// index into BUILTIN_NAMES of the builtin called `name`, -1 if there is none
+int find_builtin(const char* name, int length);
 
 struct Vm {
     char* current_prompt;
@@ -27,17 +33,37 @@ struct Vm {
     struct termios shell_term_state;
     bool repl_mode;
     bool notified_this_time;
+    // launch external commands with posix_spawn instead of fork + execve
+    // (CASH_SPAWN=0 in the environment switches back to fork)
+    bool use_spawn;
+    // the shell exits with the status of the program it is running, so a
+    // command in tail position can be exec'd in place instead of forked
+    bool exec_tail;
 
-    struct Job* job_list;
+    struct JobTable jobs;
+    struct EventLoop events;
     struct Process* current_processes;
 
+    struct PathCache path_cache;
+    struct SourceCache source_cache;
+
     int argc;
     char** argv;
+    // $!, 0 before the first background job
+    pid_t last_background_pid;
+    // the innermost `time` that is running, NULL if none is
+    struct Timer* timer;
 };
 
 struct Vm make_vm(int argc, char** argv);
 void free_vm(const struct Vm* vm);
 
 int run_program(struct Vm* vm, const struct Program* program);
+// $? for a wait status
+int decode_status(int status);
+_Noreturn void run_forked_subshell(struct Vm* vm, const struct Chunk* body);
+_Noreturn void run_script_in_place(struct Vm* vm,
+                                   struct SourceCacheEntry* script,
+                                   const struct RawCommand* raw_command);
 
 #endif  // CASH_VM_H
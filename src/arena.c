@@ -0,0 +1,106 @@
+#include <cash/arena.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE (64 * 1024)
+#define ALIGNMENT alignof(max_align_t)
+#define ALIGN_UP(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+#define HEADER_SIZE ALIGN_UP(sizeof(struct ArenaBlock))
+
+extern bool repl_mode;
+
+static struct ArenaBlock *add_block(struct Arena *arena, size_t min_size);
+static char *block_data(struct ArenaBlock *block);
+
+struct Arena make_arena(void) {
+    return (struct Arena){.blocks = NULL, .last = NULL};
+}
+
+void *arena_alloc(struct Arena *arena, size_t size) {
+    size = ALIGN_UP(size);
+
+    struct ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size)
+        block = add_block(arena, size);
+
+    void *ptr = block_data(block) + block->used;
+    block->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+void *arena_grow(struct Arena *arena, void *ptr, size_t old_size,
+                 size_t new_size) {
+    struct ArenaBlock *block = arena->blocks;
+    if (ptr != NULL && ptr == arena->last) {
+        const size_t offset = (char *)ptr - block_data(block);
+        if (offset + new_size <= block->size) {
+            block->used = offset + ALIGN_UP(new_size);
+            return ptr;
+        }
+    }
+
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (old_size != 0)
+        memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+char *arena_strndup(struct Arena *arena, const char *source, int length) {
+    char *copy = arena_alloc(arena, length + 1);
+    memcpy(copy, source, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void reset_arena(struct Arena *arena) {
+    struct ArenaBlock *largest = NULL;
+    struct ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        struct ArenaBlock *next = block->next;
+        if (largest == NULL || block->size > largest->size) {
+            free(largest);
+            largest = block;
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+
+    if (largest != NULL) {
+        largest->next = NULL;
+        largest->used = 0;
+    }
+    arena->blocks = largest;
+    arena->last = NULL;
+}
+
+void free_arena(const struct Arena *arena) {
+    struct ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        struct ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+static struct ArenaBlock *add_block(struct Arena *arena, size_t min_size) {
+    // blocks double, so a big script ends up in a handful of them
+    size_t size = arena->blocks ? arena->blocks->size * 2 : BLOCK_SIZE;
+    while (size < min_size)
+        size *= 2;
+
+    struct ArenaBlock *block = malloc(HEADER_SIZE + size);
+    CHECK_ALLOC(block);
+    *block =
+        (struct ArenaBlock){.next = arena->blocks, .size = size, .used = 0};
+    arena->blocks = block;
+    return block;
+}
+
+static char *block_data(struct ArenaBlock *block) {
+    return (char *)block + HEADER_SIZE;
+}
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <cash/arena.h>
 #include <cash/ast.h>
 #include <cash/colors.h>
 #include <cash/memory.h>
@@ -29,46 +30,10 @@ struct ArgumentList make_arg_list(void) {
         .argument_capacity = 0, .argument_count = 0, .arguments = NULL};
 }
 
-void add_argument(struct ArgumentList *list, struct ShellString arg) {
-    ADD_LIST(list, argument_count, argument_capacity, arguments, arg,
-             struct ShellString);
-}
-
-void free_arg_list(const struct ArgumentList *list) {
-    for (int i = 0; i < list->argument_count; ++i)
-        free_shell_string(&list->arguments[i]);
-    free(list->arguments);
-}
-
-void free_expr(const struct Expr *expr) {
-    switch (expr->type) {
-        case EXPR_COMMAND:
-            free_shell_string(&expr->command.command_name);
-            free_arg_list(&expr->command.arguments);
-            break;
-
-        case EXPR_SUBSHELL:
-            free_program(expr->subshell);
-            break;
-
-        case EXPR_PIPELINE:
-        case EXPR_AND:
-        case EXPR_OR:
-            free_expr(expr->binary.left);
-            free_expr(expr->binary.right);
-            free(expr->binary.left);
-            free(expr->binary.right);
-            break;
-
-        case EXPR_NOT:
-            free_expr(expr->binary.left);
-            free(expr->binary.left);
-            break;
-    }
-}
-
-void free_stmt(const struct Stmt *stmt) {
-    free_expr(&stmt->expr);
+void add_argument(struct Arena *arena, struct ArgumentList *list,
+                  struct ShellString arg) {
+    ARENA_ADD_LIST(arena, list, argument_count, argument_capacity, arguments,
+                   arg);
 }
 
 struct Program make_program(void) {
@@ -76,34 +41,45 @@ struct Program make_program(void) {
         .statement_capacity = 0, .statement_count = 0, .statements = NULL};
 }
 
-void add_statement(struct Program *program, struct Stmt stmt) {
-    ADD_LIST(program, statement_count, statement_capacity, statements, stmt,
-             struct Stmt);
+void add_statement(struct Arena *arena, struct Program *program,
+                   struct Stmt stmt) {
+    ARENA_ADD_LIST(arena, program, statement_count, statement_capacity,
+                   statements, stmt);
+}
+
+void add_stage(struct Arena *arena, struct Pipeline *pipeline,
+               struct Expr stage) {
+    ARENA_ADD_LIST(arena, pipeline, stage_count, stage_capacity, stages,
+                   stage);
 }
 
-void free_program(const struct Program *program) {
-    for (int i = 0; i < program->statement_count; ++i)
-        free_stmt(&program->statements[i]);
-    free(program->statements);
+void add_list_item(struct Arena *arena, struct AndOrList *list,
+                   struct ListItem item) {
+    ARENA_ADD_LIST(arena, list, item_count, item_capacity, items, item);
 }
 
 #ifndef NDEBUG
 void print_string_component(const struct StringComponent *component) {
     switch (component->type) {
         case STRING_COMPONENT_LITERAL:
-            fprintf(stderr, MAGENTA "%s" RESET, component->literal);
+            fprintf(stderr, MAGENTA "%.*s" RESET, component->length,
+                    component->literal);
             break;
         case STRING_COMPONENT_DQ:
-            fprintf(stderr, BOLD BLUE "\"%s\"" RESET, component->literal);
+            fprintf(stderr, BOLD BLUE "\"%.*s\"" RESET, component->length,
+                    component->literal);
             break;
         case STRING_COMPONENT_SQ:
-            fprintf(stderr, BOLD CYAN "'%s'" RESET, component->literal);
+            fprintf(stderr, BOLD CYAN "'%.*s'" RESET, component->length,
+                    component->literal);
             break;
         case STRING_COMPONENT_VAR_SUB:
-            fprintf(stderr, GREEN "$%s" RESET, component->var_substitution);
+            fprintf(stderr, GREEN "$%.*s" RESET, component->length,
+                    component->var_substitution);
             break;
         case STRING_COMPONENT_BRACED_SUB:
-            fprintf(stderr, GREEN "$%s" RESET, component->braced_substitution);
+            fprintf(stderr, GREEN "$%.*s" RESET, component->length,
+                    component->braced_substitution);
             break;
         case STRING_COMPONENT_COMMAND_SUBSTITUTION:
             fprintf(stderr, "command sub");
@@ -137,22 +113,38 @@ void print_expr(const struct Expr *expr, int indent) {
             break;
 
         case EXPR_PIPELINE:
-        case EXPR_AND:
-        case EXPR_OR:
-            fprintf(stderr, "Binary( %s\n%s",
-                    expr->type == EXPR_PIPELINE ? "|"
-                    : expr->type == EXPR_AND    ? "&&"
-                                                : "||",
-                    kIndents[indent + 1]);
-            print_expr(expr->binary.left, indent + 1);
-            fprintf(stderr, ",\n%s", kIndents[indent + 1]);
-            print_expr(expr->binary.right, indent + 1);
+            fprintf(stderr, "Pipeline(");
+            for (int i = 0; i < expr->pipeline.stage_count; ++i) {
+                fprintf(stderr, "%s\n%s", i == 0 ? "" : " |",
+                        kIndents[indent + 1]);
+                print_expr(&expr->pipeline.stages[i], indent + 1);
+            }
+            fprintf(stderr, " )");
+            break;
+
+        case EXPR_AND_OR:
+            fprintf(stderr, "AndOr(");
+            for (int i = 0; i < expr->and_or.item_count; ++i) {
+                const struct ListItem *item = &expr->and_or.items[i];
+                fprintf(stderr, "%s\n%s",
+                        i == 0                   ? ""
+                        : item->join == LIST_AND ? " &&"
+                                                 : " ||",
+                        kIndents[indent + 1]);
+                print_expr(&item->expr, indent + 1);
+            }
             fprintf(stderr, " )");
             break;
 
         case EXPR_NOT:
             fprintf(stderr, "Not( ");
-            print_expr(expr->binary.left, indent + 1);
+            print_expr(expr->negated, indent + 1);
+            fprintf(stderr, " )");
+            break;
+
+        case EXPR_TIME:
+            fprintf(stderr, "Time%s( ", expr->timed.posix ? "(-p)" : "");
+            print_expr(expr->timed.expr, indent + 1);
             fprintf(stderr, " )");
             break;
 
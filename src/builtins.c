@@ -0,0 +1,765 @@
+#include <cash/builtins.h>
+#include <cash/error.h>
+#include <cash/job_control.h>
+#include <cash/memory.h>
+#include <cash/vm.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern bool repl_mode;
+
+// output of a builtin is collected here and written with a single write(2)
+// when the builtin is done
+struct OutputBuffer {
+    char *data;
+    int length;
+    int capacity;
+};
+
+// state of the recursive descent parser for `test` expressions with more than
+// four arguments
+struct TestParser {
+    char **args;
+    int count;
+    int position;
+    bool error;
+};
+
+static void buffer_reserve(struct OutputBuffer *buffer, int extra);
+static void buffer_append_n(struct OutputBuffer *buffer, const char *value,
+                            int length);
+static void buffer_append(struct OutputBuffer *buffer, const char *value);
+static void buffer_append_char(struct OutputBuffer *buffer, char c);
+static void buffer_append_format(struct OutputBuffer *buffer, const char *fmt,
+                                 ...);
+static int flush_buffer(struct OutputBuffer *buffer, int fd);
+
+static bool append_escape(struct OutputBuffer *out, const char **p,
+                          bool zero_octal);
+static bool append_escaped_string(struct OutputBuffer *out, const char *str);
+
+static bool parse_printf_number(const char *arg, long long *value);
+static int format_once(struct OutputBuffer *out, const char *format,
+                       char **args, int count, int *consumed, bool *stop);
+
+static int test_args(char **args, int count);
+static bool test_unary(const char *op, const char *operand, bool *error);
+static bool parse_test_integer(const char *arg, long long *value);
+static bool test_binary(const char *left, const char *op, const char *right,
+                        bool *error);
+static bool is_unary_op(const char *op);
+static bool is_binary_op(const char *op);
+static bool test_or(struct TestParser *parser);
+static bool test_and(struct TestParser *parser);
+static bool test_not(struct TestParser *parser);
+static bool test_primary(struct TestParser *parser);
+
+int echo_builtin(struct Vm *vm, const struct RawCommand *raw_command) {
+    (void)vm;
+    bool newline = true;
+    bool escapes = false;
+
+    int i = 1;
+    for (; i < raw_command->args_count; ++i) {
+        const char *arg = raw_command->args[i];
+        if (arg[0] != '-' || arg[1] == '\0' ||
+            strspn(arg + 1, "neE") != strlen(arg + 1))
+            break;
+
+        for (const char *flag = arg + 1; *flag != '\0'; ++flag) {
+            if (*flag == 'n')
+                newline = false;
+            else
+                escapes = *flag == 'e';
+        }
+    }
+
+    struct OutputBuffer out = {NULL, 0, 0};
+    for (const int first = i; i < raw_command->args_count; ++i) {
+        if (i != first)
+            buffer_append_char(&out, ' ');
+        if (!escapes) {
+            buffer_append(&out, raw_command->args[i]);
+        } else if (!append_escaped_string(&out, raw_command->args[i])) {
+            newline = false;
+            break;
+        }
+    }
+    if (newline)
+        buffer_append_char(&out, '\n');
+
+    return flush_buffer(&out, STDOUT_FILENO);
+}
+
+int printf_builtin(struct Vm *vm, const struct RawCommand *raw_command) {
+    (void)vm;
+    if (raw_command->args_count < 2) {
+        CASH_NONFATAL_ERROR("printf: usage: printf format [arguments]%s\n", "");
+        return 2;
+    }
+
+    const char *format = raw_command->args[1];
+    char **args = &raw_command->args[2];
+    int count = raw_command->args_count - 2;
+
+    struct OutputBuffer out = {NULL, 0, 0};
+    int status = 0;
+    bool stop = false;
+
+    // the format is reused for as long as it keeps consuming arguments
+    do {
+        int consumed = 0;
+        const int res =
+            format_once(&out, format, args, count, &consumed, &stop);
+        if (res != 0)
+            status = res;
+        if (res > 1 || consumed == 0)
+            break;
+        args += consumed;
+        count -= consumed;
+    } while (count > 0 && !stop);
+
+    const int write_status = flush_buffer(&out, STDOUT_FILENO);
+    return status != 0 ? status : write_status;
+}
+
+int test_builtin(struct Vm *vm, const struct RawCommand *raw_command) {
+    (void)vm;
+    int count = raw_command->args_count - 1;
+
+    if (strcmp(raw_command->args[0], "[") == 0) {
+        if (count == 0 || strcmp(raw_command->args[count], "]") != 0) {
+            CASH_NONFATAL_ERROR("[: missing `]'%s\n", "");
+            return 2;
+        }
+        count--;
+    }
+
+    return test_args(&raw_command->args[1], count);
+}
+
+int true_builtin(struct Vm *vm, const struct RawCommand *raw_command) {
+    (void)vm;
+    (void)raw_command;
+    return 0;
+}
+
+int false_builtin(struct Vm *vm, const struct RawCommand *raw_command) {
+    (void)vm;
+    (void)raw_command;
+    return 1;
+}
+
+int pwd_builtin(struct Vm *vm, const struct RawCommand *raw_command) {
+    bool physical = false;
+    for (int i = 1; i < raw_command->args_count; ++i) {
+        if (strcmp(raw_command->args[i], "-P") == 0) {
+            physical = true;
+        } else if (strcmp(raw_command->args[i], "-L") == 0) {
+            physical = false;
+        } else {
+            CASH_NONFATAL_ERROR("pwd: invalid option `%s`\n",
+                                raw_command->args[i]);
+            return 2;
+        }
+    }
+
+    struct OutputBuffer out = {NULL, 0, 0};
+    if (physical) {
+        char path[PATH_MAX + 1];
+        if (realpath(vm->pwd, path) == NULL) {
+            CASH_NONFATAL_ERROR("pwd: %s\n", strerror(errno));
+            return 1;
+        }
+        buffer_append(&out, path);
+    } else {
+        buffer_append(&out, vm->pwd);
+    }
+    buffer_append_char(&out, '\n');
+    return flush_buffer(&out, STDOUT_FILENO);
+}
+
+static void buffer_reserve(struct OutputBuffer *buffer, int extra) {
+    if (buffer->length + extra <= buffer->capacity)
+        return;
+
+    int capacity = buffer->capacity == 0 ? 256 : buffer->capacity;
+    while (capacity < buffer->length + extra)
+        capacity *= 2;
+
+    char *data = realloc(buffer->data, capacity);
+    CHECK_ALLOC(data);
+    buffer->data = data;
+    buffer->capacity = capacity;
+}
+
+static void buffer_append_n(struct OutputBuffer *buffer, const char *value,
+                            int length) {
+    buffer_reserve(buffer, length);
+    memcpy(&buffer->data[buffer->length], value, length);
+    buffer->length += length;
+}
+
+static void buffer_append(struct OutputBuffer *buffer, const char *value) {
+    buffer_append_n(buffer, value, (int)strlen(value));
+}
+
+static void buffer_append_char(struct OutputBuffer *buffer, char c) {
+    buffer_reserve(buffer, 1);
+    buffer->data[buffer->length++] = c;
+}
+
+static void buffer_append_format(struct OutputBuffer *buffer, const char *fmt,
+                                 ...) {
+    va_list args;
+    va_start(args, fmt);
+    const int length = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (length <= 0)
+        return;
+
+    // vsnprintf always writes the terminator, so reserve room for it
+    buffer_reserve(buffer, length + 1);
+    va_start(args, fmt);
+    vsnprintf(&buffer->data[buffer->length], length + 1, fmt, args);
+    va_end(args);
+    buffer->length += length;
+}
+
+// writes out and frees the buffer, returning the exit status for the builtin
+static int flush_buffer(struct OutputBuffer *buffer, int fd) {
+    int status = 0;
+    int written = 0;
+
+    while (written < buffer->length) {
+        const ssize_t n =
+            write(fd, &buffer->data[written], buffer->length - written);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            CASH_NONFATAL_ERROR("write error: %s\n", strerror(errno));
+            status = 1;
+            break;
+        }
+        written += (int)n;
+    }
+
+    free(buffer->data);
+    *buffer = (struct OutputBuffer){NULL, 0, 0};
+    return status;
+}
+
+// handles the escape sequence after a backslash, `*p` pointing just past the
+// backslash. Octal escapes are written `\0nnn` for echo and %b, and `\nnn` in
+// printf formats. Returns false on `\c`, which ends all output
+static bool append_escape(struct OutputBuffer *out, const char **p,
+                          bool zero_octal) {
+    const char *s = *p;
+    char c;
+
+    switch (*s) {
+        case 'a':
+            c = '\a';
+            break;
+        case 'b':
+            c = '\b';
+            break;
+        case 'e':
+        case 'E':
+            c = '\033';
+            break;
+        case 'f':
+            c = '\f';
+            break;
+        case 'n':
+            c = '\n';
+            break;
+        case 'r':
+            c = '\r';
+            break;
+        case 't':
+            c = '\t';
+            break;
+        case 'v':
+            c = '\v';
+            break;
+        case '\\':
+            c = '\\';
+            break;
+        case 'c':
+            *p = s + 1;
+            return false;
+
+        case 'x': {
+            int value = 0, digits = 0;
+            for (++s; digits < 2 && isxdigit((unsigned char)*s); ++s) {
+                value = value * 16 + (isdigit((unsigned char)*s)
+                                          ? *s - '0'
+                                          : tolower((unsigned char)*s) - 'a' +
+                                                10);
+                ++digits;
+            }
+            if (digits == 0) {
+                buffer_append_n(out, "\\x", 2);
+            } else {
+                buffer_append_char(out, (char)value);
+            }
+            *p = s;
+            return true;
+        }
+
+        case '\0':
+            buffer_append_char(out, '\\');
+            return true;
+
+        default:
+            if (*s >= '0' && *s <= '7' && (!zero_octal || *s == '0')) {
+                if (zero_octal)
+                    ++s;
+                int value = 0;
+                for (int digits = 0; digits < 3 && *s >= '0' && *s <= '7';
+                     ++digits, ++s)
+                    value = value * 8 + (*s - '0');
+                buffer_append_char(out, (char)value);
+                *p = s;
+                return true;
+            }
+            buffer_append_char(out, '\\');
+            c = *s;
+            break;
+    }
+
+    buffer_append_char(out, c);
+    *p = s + 1;
+    return true;
+}
+
+static bool append_escaped_string(struct OutputBuffer *out, const char *str) {
+    while (*str != '\0') {
+        const char *backslash = strchr(str, '\\');
+        if (backslash == NULL) {
+            buffer_append(out, str);
+            break;
+        }
+
+        buffer_append_n(out, str, (int)(backslash - str));
+        str = backslash + 1;
+        if (!append_escape(out, &str, true))
+            return false;
+    }
+    return true;
+}
+
+static bool parse_printf_number(const char *arg, long long *value) {
+    // 'c and "c give the character code of c
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *value = (unsigned char)arg[1];
+        return true;
+    }
+
+    char *end;
+    errno = 0;
+    *value = strtoll(arg, &end, 0);
+    while (isspace((unsigned char)*end))
+        ++end;
+    return end != arg && *end == '\0' && errno == 0;
+}
+
+// formats `format` once, consuming arguments from `args` as conversions need
+// them. Returns 0, 1 if an argument was not a valid number, or 2 on an invalid
+// format
+static int format_once(struct OutputBuffer *out, const char *format,
+                       char **args, int count, int *consumed, bool *stop) {
+    int status = 0;
+    int next = 0;
+
+    for (const char *p = format; *p != '\0';) {
+        if (*p == '\\') {
+            ++p;
+            if (!append_escape(out, &p, false)) {
+                *stop = true;
+                break;
+            }
+            continue;
+        }
+        if (*p != '%') {
+            const char *end = strpbrk(p, "\\%");
+            const int length = end ? (int)(end - p) : (int)strlen(p);
+            buffer_append_n(out, p, length);
+            p += length;
+            continue;
+        }
+        if (p[1] == '%') {
+            buffer_append_char(out, '%');
+            p += 2;
+            continue;
+        }
+
+        // %[flags][width][.precision]conversion, with * taking the width or
+        // precision from the arguments
+        char spec[64] = "%";
+        int spec_length = 1;
+        int star_values[2];
+        int star_count = 0;
+
+        for (++p; *p != '\0' && strchr("-+ #0", *p) != NULL; ++p) {
+            if (spec_length < 8)
+                spec[spec_length++] = *p;
+        }
+        for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (*p != '.')
+                    break;
+                spec[spec_length++] = *p++;
+            }
+            if (*p == '*') {
+                long long value = 0;
+                if (next < count && !parse_printf_number(args[next++], &value))
+                    status = 1;
+                star_values[star_count++] = (int)value;
+                spec[spec_length++] = '*';
+                ++p;
+            } else {
+                for (; isdigit((unsigned char)*p) && spec_length < 40; ++p)
+                    spec[spec_length++] = *p;
+            }
+        }
+
+        const char conversion = *p;
+        if (conversion == '\0' || strchr("diouxXcsb", conversion) == NULL) {
+            CASH_NONFATAL_ERROR("printf: `%c`: invalid format character\n",
+                                conversion);
+            *consumed = next;
+            return 2;
+        }
+        ++p;
+
+        const char *arg = next < count ? args[next++] : NULL;
+        if (conversion == 'd' || conversion == 'i' || conversion == 'o' ||
+            conversion == 'u' || conversion == 'x' || conversion == 'X') {
+            long long value = 0;
+            if (arg != NULL && !parse_printf_number(arg, &value)) {
+                CASH_NONFATAL_ERROR("printf: `%s`: invalid number\n", arg);
+                status = 1;
+            }
+            spec[spec_length++] = 'l';
+            spec[spec_length++] = 'l';
+            spec[spec_length++] = conversion;
+            spec[spec_length] = '\0';
+
+            if (star_count == 2)
+                buffer_append_format(out, spec, star_values[0], star_values[1],
+                                     value);
+            else if (star_count == 1)
+                buffer_append_format(out, spec, star_values[0], value);
+            else
+                buffer_append_format(out, spec, value);
+            continue;
+        }
+
+        struct OutputBuffer expanded = {NULL, 0, 0};
+        const char *string = arg ? arg : "";
+        if (conversion == 'c') {
+            buffer_append_n(&expanded, string, *string != '\0');
+            buffer_append_char(&expanded, '\0');
+            string = expanded.data;
+        } else if (conversion == 'b') {
+            if (!append_escaped_string(&expanded, string))
+                *stop = true;
+            buffer_append_char(&expanded, '\0');
+            string = expanded.data;
+        }
+        spec[spec_length++] = 's';
+        spec[spec_length] = '\0';
+
+        if (star_count == 2)
+            buffer_append_format(out, spec, star_values[0], star_values[1],
+                                 string);
+        else if (star_count == 1)
+            buffer_append_format(out, spec, star_values[0], string);
+        else
+            buffer_append_format(out, spec, string);
+        free(expanded.data);
+
+        if (*stop)
+            break;
+    }
+
+    *consumed = next;
+    return status;
+}
+
+// POSIX decides how to parse `test` by the number of arguments when there are
+// at most four of them; longer expressions go through the full grammar
+static int test_args(char **args, int count) {
+    bool error = false;
+    bool result;
+
+    switch (count) {
+        case 0:
+            return 1;
+        case 1:
+            return args[0][0] != '\0' ? 0 : 1;
+        case 2:
+            if (strcmp(args[0], "!") == 0)
+                return args[1][0] == '\0' ? 0 : 1;
+            if (!is_unary_op(args[0])) {
+                CASH_NONFATAL_ERROR("test: %s: unary operator expected\n",
+                                    args[0]);
+                return 2;
+            }
+            result = test_unary(args[0], args[1], &error);
+            return error ? 2 : !result;
+        case 3:
+            if (is_binary_op(args[1])) {
+                result = test_binary(args[0], args[1], args[2], &error);
+                return error ? 2 : !result;
+            }
+            if (strcmp(args[0], "!") == 0) {
+                const int negated = test_args(args + 1, 2);
+                return negated == 2 ? 2 : !negated;
+            }
+            if (strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0)
+                return test_args(args + 1, 1);
+            break;
+        case 4:
+            if (strcmp(args[0], "!") == 0) {
+                const int negated = test_args(args + 1, 3);
+                return negated == 2 ? 2 : !negated;
+            }
+            if (strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0)
+                return test_args(args + 1, 2);
+            break;
+        default:
+            break;
+    }
+
+    struct TestParser parser = {
+        .args = args, .count = count, .position = 0, .error = false};
+    result = test_or(&parser);
+    if (!parser.error && parser.position != parser.count) {
+        CASH_NONFATAL_ERROR("test: %s: unexpected argument\n",
+                            args[parser.position]);
+        parser.error = true;
+    }
+    return parser.error ? 2 : !result;
+}
+
+static bool test_or(struct TestParser *parser) {
+    bool result = test_and(parser);
+    while (!parser->error && parser->position < parser->count &&
+           strcmp(parser->args[parser->position], "-o") == 0) {
+        parser->position++;
+        const bool right = test_and(parser);
+        result = result || right;
+    }
+    return result;
+}
+
+static bool test_and(struct TestParser *parser) {
+    bool result = test_not(parser);
+    while (!parser->error && parser->position < parser->count &&
+           strcmp(parser->args[parser->position], "-a") == 0) {
+        parser->position++;
+        const bool right = test_not(parser);
+        result = result && right;
+    }
+    return result;
+}
+
+static bool test_not(struct TestParser *parser) {
+    if (parser->position < parser->count &&
+        strcmp(parser->args[parser->position], "!") == 0) {
+        parser->position++;
+        return !test_not(parser);
+    }
+    return test_primary(parser);
+}
+
+static bool test_primary(struct TestParser *parser) {
+    const int remaining = parser->count - parser->position;
+    char **args = &parser->args[parser->position];
+
+    if (remaining <= 0) {
+        CASH_NONFATAL_ERROR("test: argument expected%s\n", "");
+        parser->error = true;
+        return false;
+    }
+
+    if (strcmp(args[0], "(") == 0) {
+        parser->position++;
+        const bool result = test_or(parser);
+        if (parser->position >= parser->count ||
+            strcmp(parser->args[parser->position], ")") != 0) {
+            CASH_NONFATAL_ERROR("test: `)' expected%s\n", "");
+            parser->error = true;
+            return false;
+        }
+        parser->position++;
+        return result;
+    }
+
+    if (remaining >= 3 && is_binary_op(args[1])) {
+        parser->position += 3;
+        return test_binary(args[0], args[1], args[2], &parser->error);
+    }
+
+    if (remaining >= 2 && is_unary_op(args[0])) {
+        parser->position += 2;
+        return test_unary(args[0], args[1], &parser->error);
+    }
+
+    parser->position++;
+    return args[0][0] != '\0';
+}
+
+static bool is_unary_op(const char *op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+           strchr("bcdefghknprsStuwxzLOG", op[1]) != NULL;
+}
+
+static bool is_binary_op(const char *op) {
+    static const char *kBinaryOps[] = {"=",   "==",  "!=",  "<",   ">",
+                                       "-eq", "-ne", "-lt", "-le", "-gt",
+                                       "-ge", "-nt", "-ot", "-ef"};
+    for (size_t i = 0; i < sizeof(kBinaryOps) / sizeof(kBinaryOps[0]); ++i) {
+        if (strcmp(op, kBinaryOps[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool test_unary(const char *op, const char *operand, bool *error) {
+    struct stat st;
+
+    switch (op[1]) {
+        case 'n':
+            return operand[0] != '\0';
+        case 'z':
+            return operand[0] == '\0';
+        case 't': {
+            char *end;
+            const long fd = strtol(operand, &end, 10);
+            if (end == operand || *end != '\0' || fd < 0 || fd > INT_MAX) {
+                CASH_NONFATAL_ERROR("test: %s: integer expression expected\n",
+                                    operand);
+                *error = true;
+                return false;
+            }
+            return isatty((int)fd);
+        }
+        case 'r':
+            return access(operand, R_OK) == 0;
+        case 'w':
+            return access(operand, W_OK) == 0;
+        case 'x':
+            return access(operand, X_OK) == 0;
+        case 'h':
+        case 'L':
+            return lstat(operand, &st) == 0 && S_ISLNK(st.st_mode);
+        default:
+            break;
+    }
+
+    if (stat(operand, &st) != 0)
+        return false;
+
+    switch (op[1]) {
+        case 'b':
+            return S_ISBLK(st.st_mode);
+        case 'c':
+            return S_ISCHR(st.st_mode);
+        case 'd':
+            return S_ISDIR(st.st_mode);
+        case 'e':
+            return true;
+        case 'f':
+            return S_ISREG(st.st_mode);
+        case 'g':
+            return (st.st_mode & S_ISGID) != 0;
+        case 'k':
+            return (st.st_mode & S_ISVTX) != 0;
+        case 'p':
+            return S_ISFIFO(st.st_mode);
+        case 's':
+            return st.st_size > 0;
+        case 'S':
+            return S_ISSOCK(st.st_mode);
+        case 'u':
+            return (st.st_mode & S_ISUID) != 0;
+        case 'O':
+            return st.st_uid == geteuid();
+        case 'G':
+            return st.st_gid == getegid();
+        default:
+            return false;
+    }
+}
+
+static bool parse_test_integer(const char *arg, long long *value) {
+    char *end;
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    while (isspace((unsigned char)*end))
+        ++end;
+    if (end == arg || *end != '\0' || errno != 0) {
+        CASH_NONFATAL_ERROR("test: %s: integer expression expected\n", arg);
+        return false;
+    }
+    return true;
+}
+
+static bool test_binary(const char *left, const char *op, const char *right,
+                        bool *error) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0;
+    if (strcmp(op, "<") == 0)
+        return strcmp(left, right) < 0;
+    if (strcmp(op, ">") == 0)
+        return strcmp(left, right) > 0;
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 ||
+        strcmp(op, "-ef") == 0) {
+        struct stat left_st, right_st;
+        const bool has_left = stat(left, &left_st) == 0;
+        const bool has_right = stat(right, &right_st) == 0;
+
+        if (op[1] == 'e')
+            return has_left && has_right && left_st.st_dev == right_st.st_dev &&
+                   left_st.st_ino == right_st.st_ino;
+        if (op[1] == 'n')
+            return has_left && (!has_right ||
+                                left_st.st_mtime > right_st.st_mtime);
+        return has_right &&
+               (!has_left || left_st.st_mtime < right_st.st_mtime);
+    }
+
+    long long a, b;
+    if (!parse_test_integer(left, &a) || !parse_test_integer(right, &b)) {
+        *error = true;
+        return false;
+    }
+
+    if (strcmp(op, "-eq") == 0)
+        return a == b;
+    if (strcmp(op, "-ne") == 0)
+        return a != b;
+    if (strcmp(op, "-lt") == 0)
+        return a < b;
+    if (strcmp(op, "-le") == 0)
+        return a <= b;
+    if (strcmp(op, "-gt") == 0)
+        return a > b;
+    return a >= b;
+}
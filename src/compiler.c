@@ -0,0 +1,343 @@
+#include <cash/ast.h>
+#include <cash/compiler.h>
+#include <cash/memory.h>
+#include <cash/string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern bool repl_mode;
+
+static void compile_expr(struct Chunk *chunk, const struct Expr *expr,
+                         bool tail);
+static void compile_expr_body(struct Chunk *chunk, const struct Expr *expr,
+                              bool tail);
+static void compile_background_job(struct Chunk *chunk,
+                                   const struct Expr *expr);
+static void compile_command_words(struct Chunk *chunk,
+                                  const struct Command *command);
+static void compile_stage(struct Chunk *chunk, const struct Expr *expr,
+                          bool piped);
+
+static int emit(struct Chunk *chunk, struct Instruction instruction);
+static void patch_jump(struct Chunk *chunk, int jump);
+static int add_subchunk(struct Chunk *chunk, const struct Program *program);
+static int add_expr_subchunk(struct Chunk *chunk, const struct Expr *expr);
+
+static void print_word(const struct ShellString *word, FILE *stream);
+static void print_text(const struct StringView *text, FILE *stream);
+
+static const char *kOpNames[] = {
+    [OP_EXPAND_WORD] = "EXPAND_WORD",
+    [OP_BUILD_ARGV] = "BUILD_ARGV",
+    [OP_RUN_COMMAND] = "RUN_COMMAND",
+    [OP_BEGIN_JOB] = "BEGIN_JOB",
+    [OP_PIPE] = "PIPE",
+    [OP_SPAWN] = "SPAWN",
+    [OP_SPAWN_SUBSHELL] = "SPAWN_SUBSHELL",
+    [OP_WAIT] = "WAIT",
+    [OP_SUBSHELL] = "SUBSHELL",
+    [OP_NOT] = "NOT",
+    [OP_JUMP_IF_ZERO] = "JUMP_IF_ZERO",
+    [OP_JUMP_IF_NONZERO] = "JUMP_IF_NONZERO",
+    [OP_BEGIN_TIME] = "BEGIN_TIME",
+    [OP_END_TIME] = "END_TIME",
+};
+
+struct Chunk compile_program(const struct Program *program) {
+    struct Chunk chunk = {
+        .code = NULL,
+        .count = 0,
+        .capacity = 0,
+        .subchunks = NULL,
+        .subchunk_count = 0,
+        .subchunk_capacity = 0,
+        .program = program,
+    };
+
+    for (int i = 0; i < program->statement_count; ++i) {
+        compile_expr(&chunk, &program->statements[i].expr,
+                     i + 1 == program->statement_count);
+    }
+    return chunk;
+}
+
+void free_chunk(const struct Chunk *chunk) {
+    for (int i = 0; i < chunk->subchunk_count; ++i)
+        free_chunk(&chunk->subchunks[i]);
+    free(chunk->subchunks);
+    free(chunk->code);
+}
+
+int command_word_count(const struct Command *command) {
+    int count = command->arguments.argument_count;
+    if (command->command_name.component_count != 0)
+        count++;
+    for (int i = 0; i < command->redirection_count; ++i) {
+        if (command->redirections[i].file_name.component_count != 0)
+            count++;
+    }
+    return count;
+}
+
+// `tail` is set when nothing is evaluated after `expr` and its status is the
+// status of the whole program
+static void compile_expr(struct Chunk *chunk, const struct Expr *expr,
+                         bool tail) {
+    if (expr->background && expr->type != EXPR_COMMAND &&
+        expr->type != EXPR_PIPELINE) {
+        compile_background_job(chunk, expr);
+        return;
+    }
+    compile_expr_body(chunk, expr, tail);
+}
+
+// commands and pipelines go to the background themselves, anything else that
+// gets here runs in the foreground
+static void compile_expr_body(struct Chunk *chunk, const struct Expr *expr,
+                              bool tail) {
+    const int background = expr->background ? OP_FLAG_BACKGROUND : 0;
+
+    switch (expr->type) {
+        case EXPR_COMMAND:
+            compile_command_words(chunk, &expr->command);
+            emit(chunk, (struct Instruction){.op = OP_BUILD_ARGV,
+                                             .command = &expr->command});
+            emit(chunk,
+                 (struct Instruction){
+                     .op = OP_RUN_COMMAND,
+                     .flags = background | (tail && !background ? OP_FLAG_TAIL
+                                                                : 0),
+                     .expr = expr});
+            break;
+
+        case EXPR_PIPELINE:
+            emit(chunk, (struct Instruction){.op = OP_BEGIN_JOB,
+                                             .flags = background,
+                                             .expr = expr});
+            for (int i = 0; i < expr->pipeline.stage_count; ++i) {
+                compile_stage(chunk, &expr->pipeline.stages[i],
+                              i + 1 < expr->pipeline.stage_count);
+            }
+            emit(chunk, (struct Instruction){
+                            .op = OP_WAIT, .flags = background, .expr = expr});
+            break;
+
+        case EXPR_SUBSHELL: {
+            const int subchunk = add_subchunk(chunk, expr->subshell);
+            emit(chunk, (struct Instruction){.op = OP_SUBSHELL,
+                                             .flags = tail ? OP_FLAG_TAIL : 0,
+                                             .chunk = subchunk});
+            break;
+        }
+
+        case EXPR_NOT:
+            compile_expr(chunk, expr->negated, false);
+            emit(chunk, (struct Instruction){.op = OP_NOT});
+            break;
+
+        case EXPR_TIME:
+            // never in tail position: the report comes after it
+            emit(chunk,
+                 (struct Instruction){.op = OP_BEGIN_TIME, .expr = expr});
+            compile_expr(chunk, expr->timed.expr, false);
+            emit(chunk, (struct Instruction){.op = OP_END_TIME, .expr = expr});
+            break;
+
+        case EXPR_AND_OR: {
+            const struct AndOrList *list = &expr->and_or;
+            compile_expr(chunk, &list->items[0].expr, false);
+            for (int i = 1; i < list->item_count; ++i) {
+                const struct ListItem *item = &list->items[i];
+                // skip the item when what came before already decided the
+                // status, the next item then tests that same status
+                const int jump = emit(
+                    chunk, (struct Instruction){.op = item->join == LIST_AND
+                                                          ? OP_JUMP_IF_NONZERO
+                                                          : OP_JUMP_IF_ZERO});
+                compile_expr(chunk, &item->expr,
+                             tail && i + 1 == list->item_count);
+                patch_jump(chunk, jump);
+            }
+            break;
+        }
+    }
+}
+
+// a subshell, AND/OR list, `!` or `time` in the background is forked as a
+// whole, as the only stage of a job of its own
+static void compile_background_job(struct Chunk *chunk,
+                                   const struct Expr *expr) {
+    const int subchunk = expr->type == EXPR_SUBSHELL
+                             ? add_subchunk(chunk, expr->subshell)
+                             : add_expr_subchunk(chunk, expr);
+    emit(chunk, (struct Instruction){.op = OP_BEGIN_JOB,
+                                     .flags = OP_FLAG_BACKGROUND,
+                                     .expr = expr});
+    emit(chunk,
+         (struct Instruction){.op = OP_SPAWN_SUBSHELL, .chunk = subchunk});
+    emit(chunk, (struct Instruction){.op = OP_WAIT,
+                                     .flags = OP_FLAG_BACKGROUND,
+                                     .expr = expr});
+}
+
+static void compile_command_words(struct Chunk *chunk,
+                                  const struct Command *command) {
+    if (command->command_name.component_count != 0) {
+        emit(chunk, (struct Instruction){.op = OP_EXPAND_WORD,
+                                         .word = &command->command_name});
+    }
+    for (int i = 0; i < command->arguments.argument_count; ++i) {
+        emit(chunk,
+             (struct Instruction){.op = OP_EXPAND_WORD,
+                                  .word = &command->arguments.arguments[i]});
+    }
+    for (int i = 0; i < command->redirection_count; ++i) {
+        const struct ShellString *file_name =
+            &command->redirections[i].file_name;
+        if (file_name->component_count != 0) {
+            emit(chunk, (struct Instruction){.op = OP_EXPAND_WORD,
+                                             .word = file_name});
+        }
+    }
+}
+
+// `piped` is set when the output of `expr` goes to a pipe
+static void compile_stage(struct Chunk *chunk, const struct Expr *expr,
+                          bool piped) {
+    if (expr->type == EXPR_SUBSHELL) {
+        const int subchunk = add_subchunk(chunk, expr->subshell);
+        if (piped)
+            emit(chunk, (struct Instruction){.op = OP_PIPE});
+        emit(chunk, (struct Instruction){.op = OP_SPAWN_SUBSHELL,
+                                         .chunk = subchunk});
+        return;
+    }
+
+    compile_command_words(chunk, &expr->command);
+    emit(chunk, (struct Instruction){.op = OP_BUILD_ARGV,
+                                     .command = &expr->command});
+    if (piped)
+        emit(chunk, (struct Instruction){.op = OP_PIPE});
+    emit(chunk, (struct Instruction){.op = OP_SPAWN});
+}
+
+static int emit(struct Chunk *chunk, struct Instruction instruction) {
+    ADD_LIST(chunk, count, capacity, code, instruction, struct Instruction);
+    return chunk->count - 1;
+}
+
+static void patch_jump(struct Chunk *chunk, int jump) {
+    chunk->code[jump].target = chunk->count;
+}
+
+static int add_subchunk(struct Chunk *chunk, const struct Program *program) {
+    const struct Chunk subchunk = compile_program(program);
+    ADD_LIST(chunk, subchunk_count, subchunk_capacity, subchunks, subchunk,
+             struct Chunk);
+    return chunk->subchunk_count - 1;
+}
+
+// `expr` alone as the body of a subshell, which is all the forked child runs
+static int add_expr_subchunk(struct Chunk *chunk, const struct Expr *expr) {
+    struct Chunk subchunk = {
+        .code = NULL,
+        .count = 0,
+        .capacity = 0,
+        .subchunks = NULL,
+        .subchunk_count = 0,
+        .subchunk_capacity = 0,
+        .program = NULL,
+    };
+    compile_expr_body(&subchunk, expr, true);
+    ADD_LIST(chunk, subchunk_count, subchunk_capacity, subchunks, subchunk,
+             struct Chunk);
+    return chunk->subchunk_count - 1;
+}
+
+void disassemble_chunk(const struct Chunk *chunk, FILE *stream, int indent) {
+    for (int i = 0; i < chunk->count; ++i) {
+        const struct Instruction *instruction = &chunk->code[i];
+        fprintf(stream, "%*s%04d  %-16s", indent, "", i,
+                kOpNames[instruction->op]);
+
+        switch (instruction->op) {
+            case OP_EXPAND_WORD:
+                print_word(instruction->word, stream);
+                break;
+
+            case OP_BUILD_ARGV:
+                fprintf(stream, "%d words",
+                        command_word_count(instruction->command));
+                break;
+
+            case OP_RUN_COMMAND:
+            case OP_BEGIN_JOB:
+            case OP_WAIT:
+            case OP_BEGIN_TIME:
+            case OP_END_TIME:
+                print_text(&instruction->expr->expr_text, stream);
+                break;
+
+            case OP_SUBSHELL:
+            case OP_SPAWN_SUBSHELL:
+                fprintf(stream, "subchunk %d", instruction->chunk);
+                break;
+
+            case OP_JUMP_IF_ZERO:
+            case OP_JUMP_IF_NONZERO:
+                fprintf(stream, "-> %04d", instruction->target);
+                break;
+
+            case OP_PIPE:
+            case OP_SPAWN:
+            case OP_NOT:
+                break;
+        }
+
+        if (instruction->flags & OP_FLAG_TAIL)
+            fprintf(stream, "  (tail)");
+        if (instruction->flags & OP_FLAG_BACKGROUND)
+            fprintf(stream, "  (background)");
+        fprintf(stream, "\n");
+    }
+
+    for (int i = 0; i < chunk->subchunk_count; ++i) {
+        fprintf(stream, "%*ssubchunk %d:\n", indent, "", i);
+        disassemble_chunk(&chunk->subchunks[i], stream, indent + 4);
+    }
+}
+
+static void print_word(const struct ShellString *word, FILE *stream) {
+    for (int i = 0; i < word->component_count; ++i) {
+        const struct StringComponent *component = &word->components[i];
+        switch (component->type) {
+            case STRING_COMPONENT_LITERAL:
+                fprintf(stream, "%.*s", component->length, component->literal);
+                break;
+            case STRING_COMPONENT_DQ:
+                fprintf(stream, "\"%.*s\"", component->length,
+                        component->literal);
+                break;
+            case STRING_COMPONENT_SQ:
+                fprintf(stream, "'%.*s'", component->length,
+                        component->literal);
+                break;
+            case STRING_COMPONENT_VAR_SUB:
+                fprintf(stream, "$%.*s", component->length,
+                        component->var_substitution);
+                break;
+            case STRING_COMPONENT_BRACED_SUB:
+                fprintf(stream, "${%.*s}", component->length,
+                        component->braced_substitution);
+                break;
+            case STRING_COMPONENT_COMMAND_SUBSTITUTION:
+                fprintf(stream, "$(...)");
+                break;
+        }
+    }
+}
+
+static void print_text(const struct StringView *text, FILE *stream) {
+    fprintf(stream, "%.*s", text->length, text->string);
+}
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE  // W_STOPCODE
+
+#include <cash/error.h>
+#include <cash/event_loop.h>
+#include <cash/job_control.h>
+#include <cash/vm.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifndef WAIT_ANY
+#define WAIT_ANY ((pid_t) - 1)
+#endif
+
+#define MAX_EVENTS 64
+// every open fd is one more for each later exec to close, so with thousands of
+// background jobs pidfds would cost more than they save
+#define MAX_PIDFDS 256
+
+extern bool repl_mode;
+
+static int open_pidfd(pid_t pid);
+static void drain_signal_fd(const struct EventLoop *loop);
+static void reap_exited(struct Vm *vm, struct Process *process);
+static void reap_any(struct Vm *vm);
+static void collect_stops(struct Vm *vm);
+
+struct EventLoop make_event_loop(bool use_pidfd) {
+    return (struct EventLoop){
+        .epoll_fd = -1,
+        .signal_fd = -1,
+        .use_pidfd = use_pidfd,
+        .watched = 0,
+        .unwatched = 0,
+    };
+}
+
+void open_event_loop(struct EventLoop *loop) {
+    if (loop->epoll_fd != -1)
+        return;
+
+    sigset_t child;
+    sigemptyset(&child);
+    sigaddset(&child, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &child, NULL);
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->signal_fd = signalfd(-1, &child, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (loop->epoll_fd == -1 || loop->signal_fd == -1) {
+        CASH_PERROR(EXIT_FAILURE, "epoll", "could not wait for children%s",
+                    "");
+        exit(EXIT_FAILURE);
+    }
+
+    // the signalfd is told apart from the pidfds by a NULL process
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->signal_fd, &event);
+}
+
+// the children the loop was watching are still there, but the process that
+// closes it doesn't wait for them: it is a fork of the shell, or is about to
+// exec something that expects SIGCHLD as usual
+void close_event_loop(struct EventLoop *loop) {
+    if (loop->epoll_fd == -1)
+        return;
+
+    close(loop->epoll_fd);
+    close(loop->signal_fd);
+    loop->epoll_fd = -1;
+    loop->signal_fd = -1;
+    loop->watched = 0;
+    loop->unwatched = 0;
+
+    sigset_t child;
+    sigemptyset(&child);
+    sigaddset(&child, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &child, NULL);
+}
+
+void watch_process(struct EventLoop *loop, struct Process *process) {
+    process->pidfd = -1;
+    if (loop->use_pidfd && loop->watched < MAX_PIDFDS) {
+        process->pidfd = open_pidfd(process->pid);
+        if (process->pidfd == -1 && errno == ENOSYS)
+            loop->use_pidfd = false;
+    }
+    if (process->pidfd == -1) {
+        loop->unwatched++;
+        return;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = process};
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, process->pidfd, &event);
+    loop->watched++;
+}
+
+void unwatch_process(struct EventLoop *loop, struct Process *process) {
+    if (process->pidfd == -1) {
+        loop->unwatched--;
+        return;
+    }
+    // closing the pidfd alone takes it out of the epoll set only once every
+    // copy of it is closed, and a child forked just now still holds one until
+    // leave_parent_jobs. until then epoll would keep reporting the exit, with
+    // a process that may be freed along with its job
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, process->pidfd, NULL);
+    close(process->pidfd);
+    process->pidfd = -1;
+    loop->watched--;
+}
+
+int wait_for_children(struct Vm *vm, int timeout) {
+    struct EventLoop *loop = &vm->events;
+    if (loop->watched + loop->unwatched == 0)
+        return -1;
+
+    struct epoll_event events[MAX_EVENTS];
+    int count;
+    do {
+        count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout);
+    } while (count == -1 && errno == EINTR);
+    if (count == -1) {
+        CASH_PERROR(EXIT_FAILURE, "epoll_wait", "could not wait for children%s",
+                    "");
+        return -1;
+    }
+
+    // every process an event points to is in a job, and no job is freed
+    // before the loop returns
+    for (int i = 0; i < count; ++i) {
+        struct Process *process = events[i].data.ptr;
+        if (process != NULL) {
+            reap_exited(vm, process);
+            continue;
+        }
+
+        drain_signal_fd(loop);
+        if (loop->unwatched > 0)
+            reap_any(vm);
+        else
+            collect_stops(vm);
+    }
+    return count;
+}
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    // pidfds are always close-on-exec
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// SIGCHLDs that arrive together are merged, so the siginfo they carry is of no
+// use: what they mean is collected from wait4 and waitid instead
+static void drain_signal_fd(const struct EventLoop *loop) {
+    struct signalfd_siginfo info[8];
+    while (read(loop->signal_fd, info, sizeof(info)) > 0) {
+    }
+}
+
+// the pidfd of `process` is readable: it exited, and waiting for it by pid
+// takes no other child with it
+static void reap_exited(struct Vm *vm, struct Process *process) {
+    // reaped already by reap_any for a SIGCHLD of the same round
+    if (process->completed)
+        return;
+
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    do {
+        pid = wait4(process->pid, &status, WNOHANG, &usage);
+    } while (pid == -1 && errno == EINTR);
+    if (pid > 0)
+        mark_process_status(vm, pid, status, &usage);
+}
+
+// with a child that has no pidfd, any SIGCHLD could be its exit
+static void reap_any(struct Vm *vm) {
+    pid_t pid;
+    int status = 0;
+    struct rusage usage;
+    do {
+        pid = wait4(WAIT_ANY, &status, WUNTRACED | WNOHANG, &usage);
+    } while (mark_process_status(vm, pid, status,
+                                 WIFSTOPPED(status) ? NULL : &usage) == 0);
+}
+
+// a pidfd says nothing about stops. waitid without WEXITED reports the stopped
+// children and leaves the exited ones to their pidfds
+static void collect_stops(struct Vm *vm) {
+    for (;;) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WNOHANG) == -1 ||
+            info.si_pid == 0)
+            return;
+        mark_process_status(vm, info.si_pid, W_STOPCODE(info.si_status),
+                            NULL);
+    }
+}
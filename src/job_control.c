@@ -1,13 +1,21 @@
+#define _GNU_SOURCE  // pipe2, posix_spawn_file_actions_addtcsetpgrp_np
+
 #include <assert.h>
+#include <cash/arena.h>
 #include <cash/ast.h>
 #include <cash/error.h>
+#include <cash/event_loop.h>
 #include <cash/job_control.h>
+#include <cash/job_table.h>
 #include <cash/string.h>
+#include <cash/timing.h>
+#include <cash/util.h>
 #include <cash/vm.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,16 +24,24 @@
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
-#ifndef WAIT_ANY
-#define WAIT_ANY ((pid_t) - 1)
-#endif
 
 extern bool repl_mode;
 extern char **environ;
 
+static int process_builtin(const struct Process *process);
 static void setup_redirections(struct RawCommand *raw_command);
-
-static int mark_process_status(struct Vm *vm, pid_t pid, int status);
+static void copy_args(struct Arena *arena, struct RawCommand *raw_command);
+static void reset_job_signals(void);
+static _Noreturn void exec_or_exit(struct Vm *vm,
+                                   const struct RawCommand *raw_command,
+                                   struct SourceCacheEntry *script);
+static int save_fd(int fd, struct SavedFd *saved, int count);
+static void fork_process(struct Vm *vm, struct Job *job,
+                         struct Process *process, int in, int out,
+                         bool foreground);
+static void spawn_process(struct Vm *vm, struct Job *job,
+                          struct Process *process, int in, int out, int err,
+                          bool foreground);
 
 static void wait_for_job(struct Vm *vm, struct Job *job);
 static void put_job_in_foreground(struct Vm *vm, struct Job *job, bool cont);
@@ -35,49 +51,109 @@ static void mark_job_as_running(struct Job *job);
 static void continue_job(struct Vm *vm, struct Job *job, bool foreground);
 
 static void format_job_info_if_bkg(struct Job *job, const char *state);
-
-void free_raw_command(const struct RawCommand *raw_command) {
-    free(raw_command->name);
-    for (int i = 0; i < raw_command->args_count; ++i) {
-        free(raw_command->args[i]);
-    }
-    free(raw_command->args);
-    for (int i = 0; i < raw_command->redirs_count; ++i) {
-        free(raw_command->redirs[i].file_name);
-    }
-    free(raw_command->redirs);
+static void format_process_info(const struct Process *process, FILE *stream);
+static const struct Process *last_process(const struct Job *job);
+
+static int wait_for_id(struct Vm *vm, const char *id);
+static int wait_for_next_job(struct Vm *vm);
+static void wait_for_all_jobs(struct Vm *vm);
+static struct Process *find_child(struct Vm *vm, pid_t pid);
+
+struct Job *make_job(const struct Vm *vm, const char *command, int length,
+                     struct Arena *arena) {
+    struct Job *job = arena_alloc(arena, sizeof(struct Job));
+    *job = (struct Job){
+        .next_job = NULL,
+        .prev_job = NULL,
+        .next_changed = NULL,
+        .first_process = NULL,
+        .command = arena_strndup(arena, command, length),
+        .pgid = 0,
+        .notified = false,
+        .waited = false,
+        .changed = false,
+        .term_state = vm->shell_term_state,
+        .stdout = STDOUT_FILENO,
+        .stdin = STDIN_FILENO,
+        .stderr = STDERR_FILENO,
+        .timer = vm->timer,
+    };
+    job->arena = *arena;
+    *arena = make_arena();
+    return job;
 }
 
-void free_process(struct Process *process) {
-    free_raw_command(&process->raw_command);
+struct Process *make_process(struct Job *job,
+                             const struct RawCommand *raw_command,
+                             const struct Chunk *subshell) {
+    struct Process *process = arena_alloc(&job->arena, sizeof(struct Process));
+    *process = (struct Process){
+        .next_process = NULL,
+        .job = job,
+        .raw_command =
+            raw_command ? *raw_command : (struct RawCommand){.builtin = -1},
+        .subshell = subshell,
+        .script = NULL,
+        .pid = 0,
+        .pidfd = -1,
+        .status = 0,
+        .completed = false,
+        .stopped = false,
+    };
+    // the words can point into the AST, which the REPL reuses for the next
+    // line while the job may still be around for `jobs -l`
+    if (repl_mode && process->raw_command.args != NULL)
+        copy_args(&job->arena, &process->raw_command);
+    return process;
 }
 
 void free_job(struct Job *job) {
-    struct Process *process = job->first_process;
-    while (process != NULL) {
-        struct Process *next_process = process->next_process;
-        free_process(process);
-        free(process);
-        process = next_process;
-    }
-    free(job->command);
+    // the job itself is in the arena
+    const struct Arena arena = job->arena;
+    free_arena(&arena);
 }
 
 void add_job(struct Vm *vm, struct Job *job) {
-    job->next_job = vm->job_list;
-    vm->job_list = job;
-    job->job_id = job->next_job ? job->next_job->job_id + 1 : 1;
+    insert_job(&vm->jobs, job);
 }
 
 struct Job *get_job_by_id(struct Vm *vm, int job_id) {
-    struct Job *job = vm->job_list;
-    while (job != NULL) {
-        if (job->job_id == job_id) {
-            return job;
+    return find_job(&vm->jobs, job_id);
+}
+
+// `wait` can still ask for a background job once it is gone
+void delete_job(struct Vm *vm, struct Job *job) {
+    const struct Process *last = last_process(job);
+    if (job->background && !job->waited && last != NULL && last->pid != 0)
+        save_status(&vm->jobs, last->pid, job->job_id, last->status);
+    remove_job(&vm->jobs, job);
+    free_job(job);
+}
+
+static const struct Process *last_process(const struct Job *job) {
+    const struct Process *process = job->first_process;
+    while (process != NULL && process->next_process != NULL)
+        process = process->next_process;
+    return process;
+}
+
+// in a fork of the shell that goes on as a shell: the children of the jobs it
+// was copied with are not its own, and neither is the epoll instance or any
+// `time` that is running
+void leave_parent_jobs(struct Vm *vm) {
+    for (const struct Job *job = vm->jobs.list; job != NULL;
+         job = job->next_job) {
+        for (const struct Process *process = job->first_process;
+             process != NULL; process = process->next_process) {
+            if (process->pidfd != -1)
+                close(process->pidfd);
         }
-        job = job->next_job;
     }
-    return NULL;
+    free_job_table(&vm->jobs);
+    vm->jobs = make_job_table();
+    close_event_loop(&vm->events);
+    free_timers(vm->timer);
+    vm->timer = NULL;
 }
 
 bool job_is_stopped(const struct Job *job) {
@@ -124,6 +200,39 @@ static void format_job_info_if_bkg(struct Job *job, const char *state) {
     }
 }
 
+// a line of `jobs -l`: the pid, state and command of `process`, and once it
+// was reaped what it used
+static void format_process_info(const struct Process *process, FILE *stream) {
+    const char *state = process->terminated ? "Terminated"
+                        : process->completed ? "Done"
+                        : process->stopped   ? "Stopped"
+                                             : "Running";
+    fprintf(stream, "\t%d\t%s\t", (int)process->pid, state);
+    const struct RawCommand *raw_command = &process->raw_command;
+    if (raw_command->args == NULL)
+        fputs("(...)", stream);
+    for (int i = 0; i < raw_command->args_count; ++i)
+        fprintf(stream, "%s%s", i == 0 ? "" : " ", raw_command->args[i]);
+
+    if (process->completed && process->pid != 0) {
+        fputc('\t', stream);
+        print_usage(seconds_between(&process->started, &process->ended),
+                    &process->usage, stream);
+    }
+    fputc('\n', stream);
+}
+
+static void copy_args(struct Arena *arena, struct RawCommand *raw_command) {
+    char **args =
+        arena_alloc(arena, (raw_command->args_count + 1) * sizeof(char *));
+    for (int i = 0; i < raw_command->args_count; ++i) {
+        const char *arg = raw_command->args[i];
+        args[i] = arena_strndup(arena, arg, (int)strlen(arg));
+    }
+    args[raw_command->args_count] = NULL;
+    raw_command->args = args;
+}
+
 static void setup_redirections(struct RawCommand *raw_command) {
     for (int i = 0; i < raw_command->redirs_count; ++i) {
         const struct RawRedirection *redir = &raw_command->redirs[i];
@@ -167,10 +276,84 @@ static void setup_redirections(struct RawCommand *raw_command) {
     }
 }
 
+// applies the redirections of a builtin that runs in the shell itself. The fds
+// it replaces are saved in `saved` (room for 2 * redirs_count entries) so that
+// restore_fds can put them back afterwards. Returns the number of saved fds, or
+// -1 if a redirection failed, in which case nothing is left to restore
+int redirect_in_shell(const struct RawCommand *raw_command,
+                      struct SavedFd *saved) {
+    int count = 0;
+
+    for (int i = 0; i < raw_command->redirs_count; ++i) {
+        const struct RawRedirection *redir = &raw_command->redirs[i];
+        assert(redir->left != -1);
+
+        if ((count = save_fd(redir->left, saved, count)) == -1)
+            return -1;
+
+        if (redir->file_name == NULL) {
+            assert(redir->right != -1);
+            if (dup2(redir->right, redir->left) == -1) {
+                CASH_NONFATAL_ERROR("could not duplicate fd %d to %d: %s\n",
+                                    redir->right, redir->left, strerror(errno));
+                restore_fds(saved, count);
+                return -1;
+            }
+        } else {
+            const int fd = open(redir->file_name, redir->flags, 0644);
+            if (fd == -1) {
+                CASH_NONFATAL_ERROR("could not open %s: %s\n", redir->file_name,
+                                    strerror(errno));
+                restore_fds(saved, count);
+                return -1;
+            }
+            if (fd != redir->left) {
+                dup2(fd, redir->left);
+                close(fd);
+            }
+        }
+
+        if (redir->err_to_out) {
+            if ((count = save_fd(STDERR_FILENO, saved, count)) == -1)
+                return -1;
+            dup2(STDOUT_FILENO, STDERR_FILENO);
+        }
+    }
+    return count;
+}
+
+void restore_fds(const struct SavedFd *saved, int count) {
+    for (int i = count - 1; i >= 0; --i) {
+        if (saved[i].copy == -1) {
+            close(saved[i].fd);
+        } else {
+            dup2(saved[i].copy, saved[i].fd);
+            close(saved[i].copy);
+        }
+    }
+}
+
+// keeps a copy of `fd` (above the fds scripts use) unless it was already saved
+static int save_fd(int fd, struct SavedFd *saved, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (saved[i].fd == fd)
+            return count;
+    }
+
+    const int copy = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    if (copy == -1 && errno != EBADF) {
+        CASH_NONFATAL_ERROR("could not save fd %d: %s\n", fd, strerror(errno));
+        restore_fds(saved, count);
+        return -1;
+    }
+    saved[count] = (struct SavedFd){.fd = fd, .copy = copy};
+    return count + 1;
+}
+
 void launch_process(struct Vm *vm, struct Process *process, pid_t pgid,
                     pid_t pid, int in, int out, int err, bool foreground) {
-    int builtin = is_builtin(process->raw_command.name);
-    if (vm->repl_mode && builtin == -1) {
+    const int builtin = process_builtin(process);
+    if (vm->repl_mode) {
         if (pgid == 0) {
             pgid = pid;
         }
@@ -179,12 +362,7 @@ void launch_process(struct Vm *vm, struct Process *process, pid_t pgid,
             tcsetpgrp(STDIN_FILENO, pgid);
         }
 
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGCHLD, SIG_DFL);
+        reset_job_signals();
     }
 
     if (in != STDIN_FILENO) {
@@ -202,30 +380,234 @@ void launch_process(struct Vm *vm, struct Process *process, pid_t pgid,
 
     setup_redirections(&process->raw_command);
 
+    if (process->subshell != NULL) {
+        // the stage is a fork of the shell already, so the body runs right
+        // here. Its commands stay in the process group of the stage, without
+        // job control of their own
+        repl_mode = false;
+        vm->repl_mode = false;
+        run_forked_subshell(vm, process->subshell);
+    }
+
     if (builtin != -1) {
+        // like a subshell, a builtin that starts children of its own keeps
+        // them in the process group of the stage
+        repl_mode = false;
+        vm->repl_mode = false;
         int res = BUILTIN_FUNCS[builtin](vm, &process->raw_command);
         exit(res);
     }
 
-    execve(process->raw_command.name, process->raw_command.args, environ);
-    CASH_PERROR(EXIT_FAILURE, "execve",
-                "could not execute %s: ", process->raw_command.name);
-    exit(EXIT_FAILURE);
+    exec_or_exit(vm, &process->raw_command, process->script);
+}
+
+// index of the builtin a pipeline stage runs in its forked child, or -1 if it
+// is external or a subshell. A stage made only of redirections runs `:`
+static int process_builtin(const struct Process *process) {
+    if (process->subshell != NULL)
+        return -1;
+    return process->raw_command.builtin;
+}
+
+// replaces the shell itself with `raw_command`, for the last command of a shell
+// that would exit with its status anyway. There is no job to set up: the
+// process keeps the shell's pid, process group and fds
+void exec_in_place(struct Vm *vm, struct RawCommand *raw_command) {
+    if (vm->repl_mode)
+        reset_job_signals();
+
+    struct SourceCacheEntry *script;
+    if (find_cash_script(&vm->source_cache, raw_command->name, &script) &&
+        script == NULL)
+        exit(EXIT_FAILURE);
+    fflush(stdout);
+    fflush(stderr);
+    setup_redirections(raw_command);
+    exec_or_exit(vm, raw_command, script);
+}
+
+static void reset_job_signals(void) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+}
+
+// runs `raw_command` in this process, which is about to go away: a cash script
+// runs right here from its parse, anything else is exec'd
+static void exec_or_exit(struct Vm *vm, const struct RawCommand *raw_command,
+                         struct SourceCacheEntry *script) {
+    if (script != NULL)
+        run_script_in_place(vm, script, raw_command);
+
+    close_event_loop(&vm->events);
+    execve(raw_command->name, raw_command->args, environ);
+    if (errno == ENOEXEC) {
+        script = load_cash_script(&vm->source_cache, raw_command->name);
+        if (script == NULL)
+            exit(EXIT_FAILURE);
+        run_script_in_place(vm, script, raw_command);
+    }
+    // 127 tells the parent that the path it resolved no longer exists
+    const int status = errno == ENOENT ? 127 : 126;
+    CASH_PERROR(status, "execve", "could not execute %s: ", raw_command->name);
+    exit(status);
+}
+
+// launches `process` with posix_spawn instead of fork + execve. glibc
+// implements it with clone(CLONE_VM | CLONE_VFORK), so the cost doesn't grow
+// with the size of the shell's heap the way copying page tables for fork()
+// does. Everything launch_process does in the child is expressed as spawn
+// attributes and file actions instead
+static void spawn_process(struct Vm *vm, struct Job *job,
+                          struct Process *process, int in, int out, int err,
+                          bool foreground) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+
+    // SIGCHLD is blocked in the shell for its event loop
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    if (vm->repl_mode) {
+        flags |= POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+        posix_spawnattr_setpgroup(&attr, job->pgid);
+
+        sigset_t default_signals;
+        sigemptyset(&default_signals);
+        sigaddset(&default_signals, SIGINT);
+        sigaddset(&default_signals, SIGQUIT);
+        sigaddset(&default_signals, SIGTTIN);
+        sigaddset(&default_signals, SIGTTOU);
+        sigaddset(&default_signals, SIGTSTP);
+        sigaddset(&default_signals, SIGCHLD);
+        posix_spawnattr_setsigdefault(&attr, &default_signals);
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+        if (foreground)
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#else
+        (void)foreground;
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    // the pipe ends are created with O_CLOEXEC, so only the dup2s are needed
+    if (in != STDIN_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    if (out != STDOUT_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    if (err != STDERR_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, err, STDERR_FILENO);
+
+    const struct RawCommand *raw_command = &process->raw_command;
+    for (int i = 0; i < raw_command->redirs_count; ++i) {
+        const struct RawRedirection *redir = &raw_command->redirs[i];
+        assert(redir->left != -1);
+
+        if (redir->file_name == NULL) {
+            assert(redir->right != -1);
+            posix_spawn_file_actions_adddup2(&actions, redir->right,
+                                             redir->left);
+        } else {
+            posix_spawn_file_actions_addopen(&actions, redir->left,
+                                             redir->file_name, redir->flags,
+                                             0644);
+        }
+
+        if (redir->err_to_out)
+            posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO,
+                                             STDERR_FILENO);
+    }
+
+    pid_t pid;
+    const int res = posix_spawn(&pid, raw_command->name, &actions, &attr,
+                                raw_command->args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (res == 0) {
+        process->pid = pid;
+        index_process(&vm->jobs, process);
+        watch_process(&vm->events, process);
+        if (vm->repl_mode && job->pgid == 0)
+            job->pgid = pid;
+        return;
+    }
+
+    // a file without `#!` is a script for the shell, which the child can run
+    // from a parse kept for the next time
+    if (res == ENOEXEC) {
+        process->script =
+            load_cash_script(&vm->source_cache, raw_command->name);
+        if (process->script != NULL) {
+            fork_process(vm, job, process, in, out, foreground);
+            return;
+        }
+    }
+
+    // report the failure the way a forked child would have, and mark the
+    // process as already finished so waiting for the job doesn't block on it
+    int status;
+    if (res == ENOEXEC) {
+        // the script didn't parse, which load_cash_script reported
+        status = EXIT_FAILURE;
+    } else if (access(raw_command->name, X_OK) != 0) {
+        errno = res;
+        status = res == ENOENT ? 127 : 126;
+        CASH_NONFATAL_ERROR("could not execute %s: " RESET RED "execve: %s\n",
+                            raw_command->name, strerror(res));
+    } else {
+        status = EXIT_FAILURE;
+        CASH_NONFATAL_ERROR("could not set up redirections for %s: %s\n",
+                            raw_command->name, strerror(res));
+    }
+    process->pid = 0;
+    process->status = status << 8;
+    process->completed = true;
+}
+
+static void fork_process(struct Vm *vm, struct Job *job,
+                         struct Process *process, int in, int out,
+                         bool foreground) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        CASH_PERROR(EXIT_FAILURE, "fork", "could not fork process for job%s",
+                    "");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        leave_parent_jobs(vm);
+        launch_process(vm, process, job->pgid, pid, in, out, job->stderr,
+                       foreground);
+    } else {
+        process->pid = pid;
+        index_process(&vm->jobs, process);
+        watch_process(&vm->events, process);
+        if (repl_mode) {
+            if (job->pgid == 0)
+                job->pgid = pid;
+            setpgid(pid, job->pgid);
+        }
+    }
 }
 
 void launch_job(struct Vm *vm, struct Job *job, bool foreground) {
     struct Process *process;
-    pid_t pid;
     int pipefd[2];
     int in = job->stdin;
-    int out = job->stdout;
+    int out;
 
     add_job(vm, job);
 
     for (process = job->first_process; process != NULL;
          process = process->next_process) {
         if (process->next_process != NULL) {
-            if (pipe(pipefd) == -1) {
+            if (pipe2(pipefd, O_CLOEXEC) == -1) {
                 CASH_PERROR(EXIT_FAILURE, "pipe",
                             "could not create pipe for job%s", "");
                 exit(EXIT_FAILURE);
@@ -235,22 +617,7 @@ void launch_job(struct Vm *vm, struct Job *job, bool foreground) {
             out = job->stdout;
         }
 
-        pid = fork();
-        if (pid < 0) {
-            CASH_PERROR(EXIT_FAILURE, "fork",
-                        "could not fork process for job%s", "");
-            exit(EXIT_FAILURE);
-        } else if (pid == 0) {
-            launch_process(vm, process, job->pgid, pid, in, out, job->stderr,
-                           foreground);
-        } else {
-            process->pid = pid;
-            if (repl_mode) {
-                if (job->pgid == 0)
-                    job->pgid = pid;
-                setpgid(pid, job->pgid);
-            }
-        }
+        start_process(vm, job, process, in, out, foreground);
 
         if (in != job->stdin)
             close(in);
@@ -260,17 +627,60 @@ void launch_job(struct Vm *vm, struct Job *job, bool foreground) {
         in = pipefd[0];
     }
 
+    finish_job(vm, job, foreground);
+}
+
+// starts one process of a job that is already in the job list, reading from
+// `in` and writing to `out`. The caller keeps ownership of both fds
+void start_process(struct Vm *vm, struct Job *job, struct Process *process,
+                   int in, int out, bool foreground) {
+    const bool external =
+        process->subshell == NULL && process_builtin(process) == -1;
+    if (external && find_cash_script(&vm->source_cache,
+                                     process->raw_command.name,
+                                     &process->script) &&
+        process->script == NULL) {
+        // a new cash would have failed on the syntax error just the same
+        process->pid = 0;
+        process->status = EXIT_FAILURE << 8;
+        process->completed = true;
+        return;
+    }
+
+    open_event_loop(&vm->events);
+    clock_gettime(CLOCK_MONOTONIC, &process->started);
+    // builtins, subshells and cash scripts have to run in a forked copy of
+    // the shell
+    if (vm->use_spawn && external && process->script == NULL)
+        spawn_process(vm, job, process, in, out, job->stderr, foreground);
+    else
+        fork_process(vm, job, process, in, out, foreground);
+}
+
+// once all processes of the job are started: waits for it in the foreground, or
+// leaves it running in the background
+void finish_job(struct Vm *vm, struct Job *job, bool foreground) {
     format_job_info_if_bkg(job, "launched");
+    // processes that could not start completed without a waitpid, the next
+    // notification has to look at the job once to find out
+    mark_job_changed(&vm->jobs, job);
+
+    if (!foreground) {
+        const struct Process *last = last_process(job);
+        vm->last_background_pid = last != NULL ? last->pid : 0;
+        // it got /dev/null for its stdin from make_expr_job
+        if (job->stdin != STDIN_FILENO) {
+            close(job->stdin);
+            job->stdin = STDIN_FILENO;
+        }
+    }
 
     if (!repl_mode) {
-        if (!foreground) {
-            fprintf(stderr,
-                    YELLOW
-                    "trying to run job %d in background in non-interactive "
-                    "mode%s\n" RESET,
-                    job->job_id, "");
-        }
-        wait_for_job(vm, job);
+        // without job control, a background job only runs concurrently: it
+        // stays in the process group of the shell
+        job->background = !foreground;
+        if (foreground)
+            wait_for_job(vm, job);
     } else if (foreground) {
         put_job_in_foreground(vm, job, false);
     } else {
@@ -279,13 +689,11 @@ void launch_job(struct Vm *vm, struct Job *job, bool foreground) {
 }
 
 static void wait_for_job(struct Vm *vm, struct Job *job) {
-    int status;
-    pid_t pid;
-
-    do {
-        pid = waitpid(WAIT_ANY, &status, WUNTRACED);
-    } while (!mark_process_status(vm, pid, status) && !job_is_stopped(job) &&
-             !job_is_completed(job));
+    // processes that failed to spawn are already marked as completed
+    while (!job_is_stopped(job) && !job_is_completed(job)) {
+        if (wait_for_children(vm, -1) == -1)
+            break;
+    }
 }
 
 static void put_job_in_foreground(struct Vm *vm, struct Job *job, bool cont) {
@@ -317,55 +725,64 @@ static void put_job_in_background(struct Job *job, bool cont) {
     }
 }
 
-static int mark_process_status(struct Vm *vm, pid_t pid, int status) {
-    struct Job *job;
-    struct Process *process;
-
-    if (pid == 0 || errno == ECHILD) {
+int mark_process_status(struct Vm *vm, pid_t pid, int status,
+                        const struct rusage *usage) {
+    // errno is only meaningful when wait4 failed, a stale ECHILD from an
+    // earlier call must not hide a process that did change state
+    if (pid == 0 || (pid < 0 && errno == ECHILD)) {
         return -1;  // No more processes to wait for
     } else if (pid < 0) {
-        CASH_PERROR(EXIT_FAILURE, "waitpid", "could not wait for process %ld\n",
+        CASH_PERROR(EXIT_FAILURE, "wait4", "could not wait for process %ld\n",
                     (long)pid);
         return -1;
     }
 
-    for (job = vm->job_list; job != NULL; job = job->next_job) {
-        for (process = job->first_process; process != NULL;
-             process = process->next_process) {
-            if (process->pid == pid) {
-                process->status = status;
-
-                if (WIFSTOPPED(status)) {
-                    process->stopped = true;
-                } else {
-                    process->completed = true;
-                    if (WIFSIGNALED(status)) {
-                        process->terminated = true;
-                        fprintf(stderr, "Process %ld terminated by signal %d\n",
-                                (long)pid, WTERMSIG(status));
-                    }
-                }
-
-                return 0;
-            }
-        }
+    // waiting for any child can reap one the shell doesn't keep a job for,
+    // like one that parallel's stop_running took already. That is no error,
+    // and the children after it still have to be collected
+    struct Process *process = find_process(&vm->jobs, pid);
+    if (process == NULL) {
+        CASH_DEBUG("No process with PID %d\n", (int)pid);
+        return 0;
     }
 
-    CASH_ERROR(EXIT_FAILURE, "No process with PID %d\n", (int)pid);
-    return -1;
+    process->status = status;
+    if (WIFSTOPPED(status)) {
+        process->stopped = true;
+    } else {
+        process->completed = true;
+        clock_gettime(CLOCK_MONOTONIC, &process->ended);
+        if (usage != NULL)
+            process->usage = *usage;
+        if (process->job->timer != NULL)
+            add_timed_process(process->job->timer, process);
+        // reaped, the pid can go to another process from now on
+        unindex_process(&vm->jobs, process);
+        unwatch_process(&vm->events, process);
+        if (WIFSIGNALED(status)) {
+            process->terminated = true;
+            fprintf(stderr, "Process %ld terminated by signal %d\n",
+                    (long)pid, WTERMSIG(status));
+        }
+    }
+    mark_job_changed(&vm->jobs, process->job);
+    return 0;
 }
 
+// jobs [-l]: with -l, every process of each job on a line of its own too.
+// Other arguments are ignored for now
 int list_jobs(struct Vm *vm, const struct RawCommand *raw_command) {
-    (void)raw_command;  // for now, does nothing; can be extended to handle the
-                        // normal options that can be passed
-    struct Job *job = vm->job_list;
-
-    if (job == NULL) {
+    bool long_format = false;
+    for (int i = 1; i < raw_command->args_count; ++i) {
+        if (strcmp(raw_command->args[i], "-l") == 0)
+            long_format = true;
+    }
+    if (vm->jobs.list == NULL) {
         return 0;
     }
 
     update_status(vm);
-    for (; job != NULL; job = job->next_job) {
+    for (struct Job *job = vm->jobs.list; job != NULL; job = job->next_job) {
         if (job_was_terminated(job)) {
             job->notified = true;
             format_job_info(job, "Terminated", stdout);
@@ -377,6 +794,11 @@ int list_jobs(struct Vm *vm, const struct RawCommand *raw_command) {
         } else {
             format_job_info(job, "Running", stdout);
         }
+        if (long_format) {
+            for (const struct Process *process = job->first_process;
+                 process != NULL; process = process->next_process)
+                format_process_info(process, stdout);
+        }
     }
     remove_completed_jobs(vm);
     vm->notified_this_time = true;
@@ -389,7 +811,7 @@ int fg(struct Vm *vm, const struct RawCommand *raw_command) {
                    "fg: no job control in non-interactive mode%s\n", "");
         return 1;
     }
-    if (vm->job_list == NULL) {
+    if (vm->jobs.list == NULL) {
         CASH_ERROR(EXIT_FAILURE, "fg: no current job%s\n", "");
         return 1;
     }
@@ -412,7 +834,8 @@ int fg(struct Vm *vm, const struct RawCommand *raw_command) {
         job_id = (int)n;
     }
 
-    struct Job *job = job_id == -1 ? vm->job_list : get_job_by_id(vm, job_id);
+    struct Job *job =
+        job_id == -1 ? vm->jobs.list : get_job_by_id(vm, job_id);
     if (job == NULL) {
         CASH_ERROR(EXIT_FAILURE, "fg: no such job `%s`\n",
                    raw_command->args_count > 1 ? raw_command->args[1] : "");
@@ -425,75 +848,174 @@ int fg(struct Vm *vm, const struct RawCommand *raw_command) {
     return 0;
 }
 
-void update_status(struct Vm *vm) {
-    pid_t pid;
+// wait [-n] [pid | %job ...]: with no ids, for every background job, and
+// with -n for whichever finishes first. The status is that of the last id
+int wait_jobs(struct Vm *vm, const struct RawCommand *raw_command) {
+    int first = 1;
+    bool next = false;
+    if (first < raw_command->args_count &&
+        strcmp(raw_command->args[first], "-n") == 0) {
+        next = true;
+        first++;
+    }
+
+    if (next) {
+        if (first < raw_command->args_count) {
+            CASH_NONFATAL_ERROR("wait: -n takes no ids%s\n", "");
+            return 2;
+        }
+        return wait_for_next_job(vm);
+    }
+    if (first == raw_command->args_count) {
+        wait_for_all_jobs(vm);
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = first; i < raw_command->args_count; ++i)
+        status = wait_for_id(vm, raw_command->args[i]);
+    return status;
+}
+
+static int wait_for_id(struct Vm *vm, const char *id) {
+    char *end;
+    const long n = strtol(id[0] == '%' ? id + 1 : id, &end, 10);
+    if (end == id || *end != '\0' || n < 1 || n > INT_MAX) {
+        CASH_NONFATAL_ERROR("wait: `%s`: not a pid or job id\n", id);
+        return 2;
+    }
+
+    if (id[0] == '%') {
+        struct Job *job = get_job_by_id(vm, (int)n);
+        int status;
+        if (job == NULL && take_saved_job_status(&vm->jobs, (int)n, &status))
+            return decode_status(status);
+        if (job == NULL || job->first_process == NULL) {
+            CASH_NONFATAL_ERROR("wait: %s: no such job\n", id);
+            return 127;
+        }
+        wait_for_job(vm, job);
+        job->waited = job_is_completed(job);
+        return decode_status(last_process(job)->status);
+    }
+
+    struct Process *process = find_child(vm, (pid_t)n);
+    if (process != NULL) {
+        while (!process->completed && !process->stopped) {
+            if (wait_for_children(vm, -1) == -1)
+                break;
+        }
+        process->job->waited = job_is_completed(process->job);
+        return decode_status(process->status);
+    }
+
     int status;
+    if (take_saved_status(&vm->jobs, (pid_t)n, &status))
+        return decode_status(status);
+    CASH_NONFATAL_ERROR("wait: pid %ld is not a child of this shell\n", n);
+    return 127;
+}
 
-    do {
-        pid = waitpid(WAIT_ANY, &status, WUNTRACED | WNOHANG);
-    } while (mark_process_status(vm, pid, status) == 0);
+// the process of a job still in the table. Once it is reaped it is no longer
+// indexed by pid, but its job may not have been removed yet
+static struct Process *find_child(struct Vm *vm, pid_t pid) {
+    struct Process *process = find_process(&vm->jobs, pid);
+    if (process != NULL)
+        return process;
+    for (struct Job *job = vm->jobs.list; job != NULL; job = job->next_job) {
+        for (process = job->first_process; process != NULL;
+             process = process->next_process) {
+            if (process->pid == pid)
+                return process;
+        }
+    }
+    return NULL;
 }
 
+// looks over every background job each time a child changes state, which is
+// fine for the handful a script keeps running at once
+static int wait_for_next_job(struct Vm *vm) {
+    for (;;) {
+        int status;
+        if (take_saved_status(&vm->jobs, 0, &status))
+            return decode_status(status);
+
+        bool running = false;
+        for (struct Job *job = vm->jobs.list; job != NULL;
+             job = job->next_job) {
+            if (!job->background || job->waited ||
+                job->first_process == NULL)
+                continue;
+            if (job_is_completed(job)) {
+                job->waited = true;
+                return decode_status(last_process(job)->status);
+            }
+            if (!job_is_stopped(job))
+                running = true;
+        }
+
+        if (!running || wait_for_children(vm, -1) == -1)
+            return 127;
+    }
+}
+
+// a stopped job would never finish, it is not waited for
+static void wait_for_all_jobs(struct Vm *vm) {
+    for (struct Job *job = vm->jobs.list; job != NULL; job = job->next_job) {
+        wait_for_job(vm, job);
+        if (job_is_completed(job))
+            job->waited = true;
+    }
+    clear_saved_statuses(&vm->jobs);
+}
+
+// takes the state changes that are ready without blocking. Costs nothing when
+// no child is running, and a single epoll_wait however many there are
+void update_status(struct Vm *vm) {
+    while (wait_for_children(vm, 0) > 0) {
+    }
+}
+
+// only the jobs that changed since the last time can have finished or stopped
 void do_job_notification(struct Vm *vm) {
-    struct Job *job = vm->job_list;
-    struct Job *jlast = NULL, *jnext;
+    struct Job *job;
 
     update_status(vm);
 
-    for (; job != NULL; job = jnext) {
-        jnext = job->next_job;
-
+    while ((job = next_changed_job(&vm->jobs)) != NULL) {
         if (job_was_terminated(job)) {
-            if (!job->notified)
+            if (!job->notified && !job->waited)
                 format_job_info_if_bkg(job, "Terminated");
-            if (jlast != NULL) {
-                // delete from list
-                jlast->next_job = jnext;
-            } else {
-                vm->job_list = jnext;
-            }
-            free_job(job);
-            free(job);
+            delete_job(vm, job);
         } else if (job_is_completed(job)) {
-            format_job_info_if_bkg(job, "Completed");
-            if (jlast != NULL) {
-                // delete form list
-                jlast->next_job = jnext;
-            } else {
-                vm->job_list = jnext;
-            }
-            free_job(job);
-            free(job);
+            // `wait` reported it already
+            if (!job->waited)
+                format_job_info_if_bkg(job, "Completed");
+            delete_job(vm, job);
         } else if (job_is_stopped(job) && !job->notified) {
             format_job_info_if_bkg(job, "Stopped");
             job->notified = true;
-            jlast = job;
-        } else {
-            jlast = job;
         }
     }
 }
 
 void remove_completed_jobs(struct Vm *vm) {
-    struct Job *job = vm->job_list;
-    struct Job *jlast = NULL, *jnext;
-
-    for (; job != NULL; job = jnext) {
-        jnext = job->next_job;
+    struct Job *job;
+    struct Job *keep = NULL;
 
+    while ((job = next_changed_job(&vm->jobs)) != NULL) {
         if (job_is_completed(job)) {
-            if (jlast != NULL) {
-                // delete from list
-                jlast->next_job = jnext;
-            } else {
-                vm->job_list = jnext;
-            }
-            free_job(job);
-            free(job);
-        } else {
-            jlast = job;
+            delete_job(vm, job);
+        } else if (job_is_stopped(job) && !job->notified) {
+            // still to be reported by do_job_notification
+            job->next_changed = keep;
+            keep = job;
         }
     }
+    for (; keep != NULL; keep = job) {
+        job = keep->next_changed;
+        mark_job_changed(&vm->jobs, keep);
+    }
 }
 
 static void mark_job_as_running(struct Job *job) {
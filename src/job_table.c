@@ -0,0 +1,253 @@
+#include <assert.h>
+#include <cash/job_control.h>
+#include <cash/job_table.h>
+#include <cash/memory.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SLOT_COUNT 16
+#define INITIAL_PID_BITS 6
+#define MAX_SAVED_STATUSES 1024
+
+extern bool repl_mode;
+
+static void grow_slots(struct JobTable *table);
+static uint32_t hash_pid(pid_t pid, int bits);
+static struct Process **find_pid_slot(const struct JobTable *table, pid_t pid);
+static void grow_pids(struct JobTable *table);
+static bool take_saved_at(struct JobTable *table, int i, int *status);
+
+struct JobTable make_job_table(void) {
+    return (struct JobTable){
+        .list = NULL,
+        .slots = NULL,
+        .slot_count = 0,
+        .used_count = 0,
+        .first_free = -1,
+        .pids = NULL,
+        .pid_count = 0,
+        .pid_capacity = 0,
+        .pid_bits = 0,
+        .first_changed = NULL,
+        .last_changed = NULL,
+        .saved = NULL,
+        .saved_count = 0,
+        .saved_capacity = 0,
+    };
+}
+
+void free_job_table(const struct JobTable *table) {
+    free(table->slots);
+    free(table->pids);
+    free(table->saved);
+}
+
+void insert_job(struct JobTable *table, struct Job *job) {
+    int slot = table->first_free;
+    if (slot != -1) {
+        table->first_free = table->slots[slot].next_free;
+    } else {
+        if (table->used_count == table->slot_count)
+            grow_slots(table);
+        slot = table->used_count++;
+    }
+    table->slots[slot] = (struct JobSlot){.job = job, .next_free = -1};
+    job->job_id = slot + 1;
+
+    // `%N` means this job from now on, not one that had the id before
+    for (int i = 0; i < table->saved_count; ++i) {
+        if (table->saved[i].job_id == job->job_id)
+            table->saved[i].job_id = 0;
+    }
+
+    job->prev_job = NULL;
+    job->next_job = table->list;
+    if (table->list != NULL)
+        table->list->prev_job = job;
+    table->list = job;
+}
+
+void remove_job(struct JobTable *table, struct Job *job) {
+    const int slot = job->job_id - 1;
+    table->slots[slot] = (struct JobSlot){.job = NULL,
+                                          .next_free = table->first_free};
+    table->first_free = slot;
+
+    if (job->prev_job != NULL)
+        job->prev_job->next_job = job->next_job;
+    else
+        table->list = job->next_job;
+    if (job->next_job != NULL)
+        job->next_job->prev_job = job->prev_job;
+
+    // numbering starts over once there are no jobs left
+    if (table->list == NULL) {
+        table->used_count = 0;
+        table->first_free = -1;
+    }
+
+    // a stopped process is still in the index
+    for (const struct Process *process = job->first_process; process != NULL;
+         process = process->next_process) {
+        if (process->pid != 0 && !process->completed)
+            unindex_process(table, process);
+    }
+
+    assert(!job->changed);
+}
+
+struct Job *find_job(const struct JobTable *table, int job_id) {
+    if (job_id < 1 || job_id > table->used_count)
+        return NULL;
+    return table->slots[job_id - 1].job;
+}
+
+void index_process(struct JobTable *table, struct Process *process) {
+    if (2 * (table->pid_count + 1) > table->pid_capacity)
+        grow_pids(table);
+    struct Process **slot = find_pid_slot(table, process->pid);
+    if (*slot == NULL)
+        table->pid_count++;
+    *slot = process;
+}
+
+// backward shift deletion: the processes after the freed slot that probed
+// past it move up, so that lookups never have to skip over holes
+void unindex_process(struct JobTable *table, const struct Process *process) {
+    if (table->pid_count == 0)
+        return;
+    const uint32_t mask = (uint32_t)table->pid_capacity - 1;
+    uint32_t hole = (uint32_t)(find_pid_slot(table, process->pid) -
+                               table->pids);
+    if (table->pids[hole] != process)
+        return;
+    table->pid_count--;
+
+    for (uint32_t i = (hole + 1) & mask; table->pids[i] != NULL;
+         i = (i + 1) & mask) {
+        const uint32_t home = hash_pid(table->pids[i]->pid, table->pid_bits);
+        // whether `home` lies cyclically in (hole, i], where the process can
+        // stay
+        const bool stays = hole < i ? home > hole && home <= i
+                                    : home > hole || home <= i;
+        if (!stays) {
+            table->pids[hole] = table->pids[i];
+            hole = i;
+        }
+    }
+    table->pids[hole] = NULL;
+}
+
+struct Process *find_process(const struct JobTable *table, pid_t pid) {
+    if (table->pid_count == 0)
+        return NULL;
+    return *find_pid_slot(table, pid);
+}
+
+void save_status(struct JobTable *table, pid_t pid, int job_id, int status) {
+    if (table->saved_count == MAX_SAVED_STATUSES) {
+        // the older half goes at once, so that this stays rare
+        const int kept = MAX_SAVED_STATUSES / 2;
+        memmove(table->saved, &table->saved[table->saved_count - kept],
+                kept * sizeof(struct SavedStatus));
+        table->saved_count = kept;
+    }
+    const struct SavedStatus entry = {
+        .pid = pid, .job_id = job_id, .status = status};
+    ADD_LIST(table, saved_count, saved_capacity, saved, entry,
+             struct SavedStatus);
+}
+
+bool take_saved_status(struct JobTable *table, pid_t pid, int *status) {
+    for (int i = 0; i < table->saved_count; ++i) {
+        if (pid == 0 || table->saved[i].pid == pid)
+            return take_saved_at(table, i, status);
+    }
+    return false;
+}
+
+bool take_saved_job_status(struct JobTable *table, int job_id, int *status) {
+    for (int i = 0; i < table->saved_count; ++i) {
+        if (table->saved[i].job_id == job_id)
+            return take_saved_at(table, i, status);
+    }
+    return false;
+}
+
+static bool take_saved_at(struct JobTable *table, int i, int *status) {
+    *status = table->saved[i].status;
+    memmove(&table->saved[i], &table->saved[i + 1],
+            (table->saved_count - i - 1) * sizeof(struct SavedStatus));
+    table->saved_count--;
+    return true;
+}
+
+void clear_saved_statuses(struct JobTable *table) {
+    table->saved_count = 0;
+}
+
+void mark_job_changed(struct JobTable *table, struct Job *job) {
+    if (job->changed)
+        return;
+    job->changed = true;
+    job->next_changed = NULL;
+    if (table->last_changed != NULL)
+        table->last_changed->next_changed = job;
+    else
+        table->first_changed = job;
+    table->last_changed = job;
+}
+
+struct Job *next_changed_job(struct JobTable *table) {
+    struct Job *job = table->first_changed;
+    if (job == NULL)
+        return NULL;
+    table->first_changed = job->next_changed;
+    if (table->first_changed == NULL)
+        table->last_changed = NULL;
+    job->changed = false;
+    return job;
+}
+
+static void grow_slots(struct JobTable *table) {
+    table->slot_count = table->slot_count == 0 ? INITIAL_SLOT_COUNT
+                                               : table->slot_count * 2;
+    table->slots =
+        realloc(table->slots, table->slot_count * sizeof(struct JobSlot));
+    CHECK_ALLOC(table->slots);
+}
+
+// pids are handed out in sequence, so a multiplicative hash spreads them well
+// enough. Its high bits are the ones that depend on all of the pid, the low
+// ones only on its own low bits
+static uint32_t hash_pid(pid_t pid, int bits) {
+    return ((uint32_t)pid * 2654435769u) >> (32 - bits);
+}
+
+// the slot of `pid`, or the empty slot it would go to
+static struct Process **find_pid_slot(const struct JobTable *table,
+                                      pid_t pid) {
+    const uint32_t mask = (uint32_t)table->pid_capacity - 1;
+    for (uint32_t i = hash_pid(pid, table->pid_bits);; i = (i + 1) & mask) {
+        struct Process **slot = &table->pids[i];
+        if (*slot == NULL || (*slot)->pid == pid)
+            return slot;
+    }
+}
+
+static void grow_pids(struct JobTable *table) {
+    const struct JobTable old = *table;
+    table->pid_bits = old.pid_bits == 0 ? INITIAL_PID_BITS : old.pid_bits + 1;
+    table->pid_capacity = 1 << table->pid_bits;
+    table->pids = calloc(table->pid_capacity, sizeof(struct Process *));
+    CHECK_ALLOC(table->pids);
+
+    for (int i = 0; i < old.pid_capacity; ++i) {
+        struct Process *process = old.pids[i];
+        if (process != NULL)
+            *find_pid_slot(table, process->pid) = process;
+    }
+    free(old.pids);
+}
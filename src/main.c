@@ -2,6 +2,8 @@
 #include <cash/error.h>
 #include <cash/parser/parser.h>
 #include <cash/repl.h>
+#include <cash/script_cache.h>
+#include <cash/stream.h>
 #include <cash/util.h>
 #include <cash/vm.h>
 #include <stdbool.h>
@@ -10,13 +12,28 @@
 #include <unistd.h>
 
 bool repl_mode = false;
+// print the bytecode of every program before running it
+bool dump_bytecode = false;
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--dump-bytecode") == 0) {
+        dump_bytecode = true;
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--compile") == 0) {
+        if (argc != 3) {
+            CASH_ERROR(EXIT_FAILURE, "--compile requires a script\n%s", "");
+            return EXIT_FAILURE;
+        }
+        return compile_script(argv[2]);
+    }
 
-int main(const int argc, char* argv[]) {
     if (argc == 1) {
         if (!isatty(STDIN_FILENO)) {
-            char* input = read_all_stdin();
-            run_string(input, 0, argv);
-            free(input);
+            return run_fd(STDIN_FILENO, 0, argv);
         } else {
             repl_mode = true;
             struct Repl repl = make_repl(0, argv);
@@ -31,9 +48,9 @@ int main(const int argc, char* argv[]) {
             }
 
             repl_mode = false;
-            run_string(argv[2], 0, argv);
-        } else {
-            run_file(argv[1], argc - 2, argv + 1);
+            return run_string(argv[2], 0, argv);
         }
+        return run_file(argv[1], argc - 2, argv + 1);
     }
+    return EXIT_SUCCESS;
 }
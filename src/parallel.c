@@ -0,0 +1,550 @@
+#define _GNU_SOURCE  // memfd_create
+
+#include <cash/arena.h>
+#include <cash/error.h>
+#include <cash/event_loop.h>
+#include <cash/job_control.h>
+#include <cash/job_table.h>
+#include <cash/memory.h>
+#include <cash/parallel.h>
+#include <cash/path_cache.h>
+#include <cash/vm.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// more failed runs than this all give the same status
+#define MAX_FAILED_STATUS 100
+#define READ_CHUNK_SIZE 4096
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+extern bool repl_mode;
+
+// a run that was started and, with -k, whose output is not written out yet
+struct Task {
+    struct Job *job;  // NULL once it finished
+    // with -k, the memfds its stdout and stderr go to until its turn comes.
+    // -1 when it writes to those of the shell
+    int out_fd;
+    int err_fd;
+    bool used;
+};
+
+struct ParallelRun {
+    int slots;
+    bool keep_order;
+
+    char **command;
+    int command_count;
+    // whether the command has a `{}` for the input to go in
+    bool has_placeholder;
+
+    // the arguments after `:::`, or the lines of `input_text`
+    char **inputs;
+    int input_count;
+    int input_capacity;
+    char *input_text;
+
+    // the runs from `finished` to `started` are in `tasks`, where a run of
+    // input i goes to i % `window` with -k. Up to as many finished runs as
+    // there are slots can wait there behind a slow one
+    struct Task *tasks;
+    int window;
+    int started;
+    int finished;
+    int running;
+    int failed;
+
+    // the stdin of every run
+    int null_fd;
+};
+
+static bool parse_arguments(const struct RawCommand *raw_command,
+                            struct ParallelRun *run);
+static bool parse_slots(const char *value, int *slots);
+static bool read_input_lines(struct ParallelRun *run);
+static int run_in_foreground_job(struct Vm *vm,
+                                 const struct RawCommand *raw_command);
+static char *join_words(struct Arena *arena, char **words, int count,
+                        int *length);
+
+static void run_all(struct Vm *vm, struct ParallelRun *run);
+static bool can_start(const struct ParallelRun *run);
+static struct Task *free_task(const struct ParallelRun *run);
+static struct Task *find_task(const struct ParallelRun *run,
+                              const struct Job *job);
+static void start_task(struct Vm *vm, struct ParallelRun *run,
+                       struct Task *task, const char *input);
+static struct RawCommand build_command(struct Vm *vm, struct Arena *arena,
+                                       const struct ParallelRun *run,
+                                       const char *input);
+static char *replace_placeholders(struct Arena *arena, const char *arg,
+                                  const char *input);
+static void collect_finished(struct Vm *vm, struct ParallelRun *run);
+static void stop_running(struct Vm *vm, struct ParallelRun *run);
+static void write_out_finished(struct ParallelRun *run);
+static void copy_output(int fd, int to);
+
+int parallel_jobs(struct Vm *vm, const struct RawCommand *raw_command) {
+    struct ParallelRun run;
+    if (!parse_arguments(raw_command, &run))
+        return 2;
+    if (vm->repl_mode)
+        return run_in_foreground_job(vm, raw_command);
+    if (run.inputs == NULL && !read_input_lines(&run))
+        return 1;
+
+    if (run.input_count != 0) {
+        if (run.slots > run.input_count)
+            run.slots = run.input_count;
+        run.window = run.keep_order ? 2 * run.slots : run.slots;
+        run.tasks = calloc(run.window, sizeof(struct Task));
+        CHECK_ALLOC(run.tasks);
+        run.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (run.null_fd == -1)
+            run.null_fd = STDIN_FILENO;
+
+        run_all(vm, &run);
+
+        if (run.null_fd != STDIN_FILENO)
+            close(run.null_fd);
+        free(run.tasks);
+    }
+
+    if (run.input_text != NULL) {
+        free(run.inputs);
+        free(run.input_text);
+    }
+    return run.failed > MAX_FAILED_STATUS ? MAX_FAILED_STATUS + 1
+                                          : run.failed;
+}
+
+static bool parse_arguments(const struct RawCommand *raw_command,
+                            struct ParallelRun *run) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    *run = (struct ParallelRun){
+        .slots = cpus > 0 && cpus <= INT_MAX ? (int)cpus : 1,
+        .keep_order = false,
+        .command = NULL,
+        .command_count = 0,
+        .has_placeholder = false,
+        .inputs = NULL,
+        .input_count = 0,
+        .input_capacity = 0,
+        .input_text = NULL,
+        .tasks = NULL,
+        .window = 0,
+        .started = 0,
+        .finished = 0,
+        .running = 0,
+        .failed = 0,
+        .null_fd = -1,
+    };
+
+    char **args = raw_command->args;
+    const int count = raw_command->args_count;
+    int i = 1;
+    for (; i < count && args[i][0] == '-'; ++i) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-k") == 0) {
+            run->keep_order = true;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            const char *value = args[i][2] != '\0' ? &args[i][2]
+                                : i + 1 < count  ? args[++i]
+                                                 : NULL;
+            if (!parse_slots(value, &run->slots)) {
+                CASH_NONFATAL_ERROR(
+                    "parallel: -j takes a positive number of jobs%s\n", "");
+                return false;
+            }
+        } else {
+            CASH_NONFATAL_ERROR("parallel: unknown option `%s`\n", args[i]);
+            return false;
+        }
+    }
+
+    int end = i;
+    while (end < count && strcmp(args[end], ":::") != 0)
+        end++;
+    if (end == i) {
+        CASH_NONFATAL_ERROR("parallel: usage: parallel [-j N] [-k] command "
+                            "[args...] [::: inputs...]%s\n",
+                            "");
+        return false;
+    }
+    run->command = &args[i];
+    run->command_count = end - i;
+    for (int j = 0; j < run->command_count; ++j) {
+        if (strstr(run->command[j], "{}") != NULL)
+            run->has_placeholder = true;
+    }
+
+    if (end < count) {
+        run->inputs = &args[end + 1];
+        run->input_count = count - end - 1;
+    }
+    return true;
+}
+
+static bool parse_slots(const char *value, int *slots) {
+    if (value == NULL)
+        return false;
+    char *end;
+    const long n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < 1 || n > INT_MAX / 2)
+        return false;
+    *slots = (int)n;
+    return true;
+}
+
+// one input per line, the last one with or without its newline
+static bool read_input_lines(struct ParallelRun *run) {
+    char *text = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    for (;;) {
+        if (capacity - length < READ_CHUNK_SIZE + 1) {
+            capacity = capacity == 0 ? 2 * READ_CHUNK_SIZE : capacity * 2;
+            text = realloc(text, capacity);
+            CHECK_ALLOC(text);
+        }
+        const ssize_t n = read(STDIN_FILENO, &text[length], READ_CHUNK_SIZE);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            CASH_NONFATAL_ERROR("parallel: could not read the inputs: %s\n",
+                                strerror(errno));
+            free(text);
+            return false;
+        }
+        if (n == 0)
+            break;
+        length += n;
+    }
+    text[length] = '\0';
+
+    run->input_text = text;
+    char *line = text;
+    while (line < &text[length]) {
+        char *newline = strchr(line, '\n');
+        if (newline != NULL)
+            *newline = '\0';
+        ADD_LIST(run, input_count, input_capacity, inputs, line, char *);
+        line = newline != NULL ? newline + 1 : &text[length];
+    }
+    return true;
+}
+
+// in the REPL, `parallel` goes on in a fork of the shell that is a foreground
+// job of its own. The runs stay in its process group, so Ctrl-C and Ctrl-Z
+// reach all of them, and `fg` brings them all back
+static int run_in_foreground_job(struct Vm *vm,
+                                 const struct RawCommand *raw_command) {
+    struct Arena arena = make_arena();
+    // the redirections were done in the shell already, the fork inherits them
+    struct RawCommand copy = {
+        .name = NULL,
+        .builtin = raw_command->builtin,
+        .args = arena_alloc(&arena,
+                            (raw_command->args_count + 1) * sizeof(char *)),
+        .args_count = raw_command->args_count,
+        .redirs = NULL,
+        .redirs_count = 0,
+    };
+    for (int i = 0; i < raw_command->args_count; ++i) {
+        copy.args[i] = arena_strndup(&arena, raw_command->args[i],
+                                     (int)strlen(raw_command->args[i]));
+    }
+    copy.args[copy.args_count] = NULL;
+    copy.name = copy.args[0];
+
+    int length;
+    const char *text = join_words(&arena, copy.args, copy.args_count, &length);
+    struct Job *job = make_job(vm, text, length, &arena);
+    struct Process *process = make_process(job, &copy, NULL);
+    job->first_process = process;
+
+    launch_job(vm, job, true);
+    return decode_status(process->status);
+}
+
+static char *join_words(struct Arena *arena, char **words, int count,
+                        int *length) {
+    *length = 0;
+    for (int i = 0; i < count; ++i)
+        *length += (int)strlen(words[i]) + (i > 0);
+    char *text = arena_alloc(arena, *length + 1);
+    char *end = text;
+    for (int i = 0; i < count; ++i) {
+        if (i > 0)
+            *end++ = ' ';
+        const size_t word_length = strlen(words[i]);
+        memcpy(end, words[i], word_length);
+        end += word_length;
+    }
+    *end = '\0';
+    return text;
+}
+
+// keeps the slots full until every input has run: a finished run makes room
+// for the next one as soon as it is reaped
+static void run_all(struct Vm *vm, struct ParallelRun *run) {
+    while (run->finished < run->input_count) {
+        while (can_start(run)) {
+            struct Task *task = free_task(run);
+            start_task(vm, run, task, run->inputs[run->started++]);
+        }
+
+        const int running = run->running;
+        collect_finished(vm, run);
+        if (run->keep_order)
+            write_out_finished(run);
+        if (run->running == running && run->running > 0 &&
+            wait_for_children(vm, -1) == -1) {
+            stop_running(vm, run);
+            return;
+        }
+    }
+}
+
+static bool can_start(const struct ParallelRun *run) {
+    return run->started < run->input_count && run->running < run->slots &&
+           run->started - run->finished < run->window;
+}
+
+static struct Task *free_task(const struct ParallelRun *run) {
+    if (run->keep_order)
+        return &run->tasks[run->started % run->window];
+    for (int i = 0; i < run->window; ++i) {
+        if (!run->tasks[i].used)
+            return &run->tasks[i];
+    }
+    return NULL;
+}
+
+static struct Task *find_task(const struct ParallelRun *run,
+                              const struct Job *job) {
+    for (int i = 0; i < run->window; ++i) {
+        if (run->tasks[i].job == job)
+            return &run->tasks[i];
+    }
+    return NULL;
+}
+
+static void start_task(struct Vm *vm, struct ParallelRun *run,
+                       struct Task *task, const char *input) {
+    struct Arena arena = make_arena();
+    struct RawCommand raw_command = build_command(vm, &arena, run, input);
+    int length;
+    const char *text =
+        join_words(&arena, raw_command.args, raw_command.args_count, &length);
+    struct Job *job = make_job(vm, text, length, &arena);
+    // the run is waited for right here, nothing else reports or saves it
+    job->waited = true;
+    job->stdin = run->null_fd;
+
+    *task = (struct Task){.job = job, .out_fd = -1, .err_fd = -1, .used = true};
+    if (run->keep_order) {
+        task->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+        task->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+        if (task->out_fd == -1 || task->err_fd == -1) {
+            CASH_NONFATAL_ERROR(
+                "parallel: could not hold back the output of `%s`: %s\n",
+                job->command, strerror(errno));
+        }
+    }
+    if (task->out_fd != -1)
+        job->stdout = task->out_fd;
+    if (task->err_fd != -1)
+        job->stderr = task->err_fd;
+
+    struct Process *process = make_process(job, &raw_command, NULL);
+    job->first_process = process;
+    add_job(vm, job);
+    if (raw_command.name != NULL) {
+        start_process(vm, job, process, job->stdin, job->stdout, false);
+    } else {
+        CASH_NONFATAL_ERROR("%s: command not found\n", raw_command.args[0]);
+        process->status = 127 << 8;
+        process->completed = true;
+    }
+    // a run that could not start is done without a waitpid, the changed queue
+    // is how collect_finished finds out
+    mark_job_changed(&vm->jobs, job);
+    run->running++;
+}
+
+// the command for one input, in `arena`. Its name is NULL if it is neither a
+// builtin, a path nor found in $PATH
+static struct RawCommand build_command(struct Vm *vm, struct Arena *arena,
+                                       const struct ParallelRun *run,
+                                       const char *input) {
+    const int count = run->command_count + (run->has_placeholder ? 0 : 1);
+    char **args = arena_alloc(arena, (count + 1) * sizeof(char *));
+    for (int i = 0; i < run->command_count; ++i)
+        args[i] = replace_placeholders(arena, run->command[i], input);
+    if (!run->has_placeholder)
+        args[count - 1] = arena_strndup(arena, input, (int)strlen(input));
+    args[count] = NULL;
+
+    char *name = args[0];
+    const int builtin = find_builtin(args[0], (int)strlen(args[0]));
+    if (builtin == -1 && strchr(args[0], '/') == NULL) {
+        const char *path = lookup_command_path(&vm->path_cache, args[0]);
+        // the path cache may drop its copy while the run goes on
+        name = path != NULL ? arena_strndup(arena, path, (int)strlen(path))
+                            : NULL;
+    }
+    return (struct RawCommand){.name = name,
+                               .builtin = builtin,
+                               .args = args,
+                               .args_count = count,
+                               .redirs = NULL,
+                               .redirs_count = 0};
+}
+
+static char *replace_placeholders(struct Arena *arena, const char *arg,
+                                  const char *input) {
+    const size_t input_length = strlen(input);
+    size_t length = strlen(arg);
+    for (const char *hole = strstr(arg, "{}"); hole != NULL;
+         hole = strstr(hole + 2, "{}"))
+        length += input_length - 2;
+
+    char *result = arena_alloc(arena, length + 1);
+    char *end = result;
+    for (;;) {
+        const char *hole = strstr(arg, "{}");
+        const size_t before = hole != NULL ? (size_t)(hole - arg) : strlen(arg);
+        memcpy(end, arg, before);
+        end += before;
+        if (hole == NULL)
+            break;
+        memcpy(end, input, input_length);
+        end += input_length;
+        arg = hole + 2;
+    }
+    *end = '\0';
+    return result;
+}
+
+// takes the runs that finished off the changed queue. The other jobs of the
+// shell that changed go back on it, in the same order, for its notifications
+static void collect_finished(struct Vm *vm, struct ParallelRun *run) {
+    struct Job *first_other = NULL;
+    struct Job *last_other = NULL;
+    struct Job *job;
+    while ((job = next_changed_job(&vm->jobs)) != NULL) {
+        struct Task *task = find_task(run, job);
+        if (task == NULL) {
+            job->next_changed = NULL;
+            if (last_other != NULL)
+                last_other->next_changed = job;
+            else
+                first_other = job;
+            last_other = job;
+            continue;
+        }
+        // a stopped run is queued again once it goes on and exits
+        if (!job_is_completed(job))
+            continue;
+
+        if (decode_status(job->first_process->status) != 0)
+            run->failed++;
+        delete_job(vm, job);
+        task->job = NULL;
+        run->running--;
+        if (!run->keep_order) {
+            task->used = false;
+            run->finished++;
+        }
+    }
+
+    while (first_other != NULL) {
+        job = first_other->next_changed;
+        mark_job_changed(&vm->jobs, first_other);
+        first_other = job;
+    }
+}
+
+// the shell can no longer wait for the runs: they are killed and reaped here,
+// so that no job or memfd of theirs is left behind
+static void stop_running(struct Vm *vm, struct ParallelRun *run) {
+    for (int i = 0; i < run->window; ++i) {
+        if (run->tasks[i].job == NULL)
+            continue;
+        for (struct Process *process = run->tasks[i].job->first_process;
+             process != NULL; process = process->next_process) {
+            if (process->pid == 0 || process->completed)
+                continue;
+            kill(process->pid, SIGKILL);
+            int status;
+            struct rusage usage;
+            pid_t pid;
+            do {
+                pid = wait4(process->pid, &status, 0, &usage);
+            } while (pid == -1 && errno == EINTR);
+            if (pid > 0)
+                mark_process_status(vm, pid, status, &usage);
+        }
+    }
+    collect_finished(vm, run);
+
+    for (int i = 0; i < run->window; ++i) {
+        if (!run->tasks[i].used)
+            continue;
+        if (run->tasks[i].out_fd != -1)
+            close(run->tasks[i].out_fd);
+        if (run->tasks[i].err_fd != -1)
+            close(run->tasks[i].err_fd);
+        run->tasks[i].used = false;
+    }
+}
+
+// with -k: the output of the finished runs that no earlier run is still
+// holding back, in the order of their inputs
+static void write_out_finished(struct ParallelRun *run) {
+    while (run->finished < run->started) {
+        struct Task *task = &run->tasks[run->finished % run->window];
+        if (task->job != NULL)
+            return;
+        copy_output(task->out_fd, STDOUT_FILENO);
+        copy_output(task->err_fd, STDERR_FILENO);
+        task->used = false;
+        run->finished++;
+    }
+}
+
+// writes out everything in the memfd `fd` and closes it
+static void copy_output(int fd, int to) {
+    if (fd == -1)
+        return;
+    static char buffer[COPY_BUFFER_SIZE];
+    lseek(fd, 0, SEEK_SET);
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t written = 0; written < n;) {
+            const ssize_t res = write(to, &buffer[written], n - written);
+            if (res == -1 && errno == EINTR)
+                continue;
+            if (res == -1) {
+                close(fd);
+                return;
+            }
+            written += res;
+        }
+    }
+    close(fd);
+}
@@ -1,23 +1,28 @@
 #include <assert.h>
 #include <cash/error.h>
 #include <cash/parser/lexer.h>
+#include <cash/parser/lexer_dfa.h>
+#include <cash/parser/scan.h>
 #include <cash/parser/token.h>
 #include <ctype.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "cash/arena.h"
 #include "cash/ast.h"
 #include "cash/memory.h"
 
 extern bool repl_mode;
 
 static char peek(const struct Lexer* lexer);
-static char peek_next(const struct Lexer* lexer);
 static char advance(struct Lexer* lexer);
-static bool match(struct Lexer* lexer, char c);
 static bool is_at_end(const struct Lexer* lexer);
+static void skip_run(struct Lexer* lexer, enum ScanClass class);
+static const char* source_text(const struct Lexer* lexer, int start,
+                               int length);
 
 static struct Token make_redirection_token(enum RedirectionType type, int left,
                                            int right, struct Lexer* lexer);
@@ -26,13 +31,14 @@ static struct Token make_error(struct Lexer* lexer);
 static struct Token make_eof(const struct Lexer* lexer);
 
 static void skip_ws(struct Lexer* lexer);
+static void skip_interpreter_line(struct Lexer* lexer);
 static struct Token consume_lines(struct Lexer* lexer);
 
-static bool try_consume_number(struct Lexer* lexer, bool eof_ok, int* number);
+static long long add_digit(long long number, char digit);
 static struct Token consume_string(struct Lexer* lexer);
 static void consume_sq_string(struct Lexer* lexer);
 static void consume_dq_string(struct Lexer* lexer);
-static void consume_unquoted_string(struct Lexer* lexer);
+static void consume_unquoted_string(struct Lexer* lexer, int string_start);
 static void consume_substitution(struct Lexer* lexer);
 
 static struct Token lexer_lex(struct Lexer* lexer);
@@ -47,15 +53,28 @@ static const bool kPunctuation[128] = {
     ['$'] = true,  ['\t'] = true, ['\n'] = true, [' '] = true, ['\r'] = true};
 // ">|<()'\";&`$\t\n\r"
 
-struct Lexer* lexer_new(const char* input, bool repl_mode) {
+static const enum RedirectionType kActionRedirections[LEX_ACTION_COUNT] = {
+    [LEX_ACTION_OUT] = REDIRECT_OUT,
+    [LEX_ACTION_APPEND_OUT] = REDIRECT_APPEND_OUT,
+    [LEX_ACTION_IN] = REDIRECT_IN,
+    [LEX_ACTION_INOUT] = REDIRECT_INOUT,
+    [LEX_ACTION_OUTERR] = REDIRECT_OUTERR,
+    [LEX_ACTION_APPEND_OUTERR] = REDIRECT_APPEND_OUTERR,
+};
+
+struct Lexer* lexer_new(const char* input, bool repl_mode,
+                        struct Arena* arena) {
     struct Lexer* lexer = malloc(sizeof(struct Lexer));
     *lexer = (struct Lexer){
         .repl_mode = repl_mode,
+        .arena = arena,
+        .copy_input = false,
+        .symbols = make_symbol_table(),
         .error = false,
         .input = input,
+        .length = (int)strlen(input),
         .token_start = 0,
         .position = 0,
-        .backtrack_position = 0,
 
         .first_line = 1,
         .first_column = 1,
@@ -70,12 +89,16 @@ struct Lexer* lexer_new(const char* input, bool repl_mode) {
         .substitution_in_quotes = false,
         .continue_string = false,
     };
+    skip_interpreter_line(lexer);
     return lexer;
 }
 
 void reset_lexer(const char* input, struct Lexer* lexer) {
     lexer->error = false;
+    // the symbols go with the arena of the previous parse
+    clear_symbol_table(&lexer->symbols);
     lexer->input = input;
+    lexer->length = (int)strlen(input);
     lexer->token_start = 0;
     lexer->position = 0;
     lexer->first_column = lexer->first_line = lexer->last_column =
@@ -83,11 +106,12 @@ void reset_lexer(const char* input, struct Lexer* lexer) {
     lexer_reset_queue(lexer);
     lexer->continue_string = false;
     lexer->substitution_in_quotes = false;
-    lexer->backtrack_position = 0;
+    skip_interpreter_line(lexer);
 }
 
 void free_lexer(const struct Lexer* lexer) {
     free(lexer->token_queue);
+    free_symbol_table(&lexer->symbols);
 }
 
 struct Token lexer_next_token(struct Lexer* lexer) {
@@ -113,127 +137,109 @@ void lexer_lex_full(struct Lexer* lexer) {
 }
 
 static struct Token lexer_lex(struct Lexer* lexer) {
-#define CHAR(c, ttype)                       \
-    case c:                                  \
-        do {                                 \
-            advance(lexer);                  \
-            return make_token(ttype, lexer); \
-        } while (0)
-
     skip_ws(lexer);
     lexer->first_column = lexer->last_column;
     lexer->first_line = lexer->first_line;
     lexer->token_start = lexer->position;
 
-    if (is_at_end(lexer))
-        return make_eof(lexer);
-
-    lexer->backtrack_position = lexer->position;
-    int left = -1, right = -1;
-
-    if (try_consume_number(lexer, false, &left)) {
-        if (peek(lexer) == '>' && peek_next(lexer) != '&') {
-            advance(lexer);
-            if (peek(lexer) == '>') {
-                advance(lexer);
-                return make_redirection_token(REDIRECT_APPEND_OUT, left, -1,
-                                              lexer);
-            }
-            return make_redirection_token(REDIRECT_OUT, left, -1, lexer);
-        }
-
-        if (peek(lexer) == '<') {
-            advance(lexer);
-
-            if (peek(lexer) == '>') {
-                advance(lexer);
-                return make_redirection_token(REDIRECT_INOUT, left, -1, lexer);
-            }
-            return make_redirection_token(REDIRECT_IN, left, -1, lexer);
-        }
-
-        if (peek(lexer) != '>' || peek_next(lexer) != '&') {
-            struct ShellString string = make_string();
-            add_string_literal(&string, STRING_COMPONENT_LITERAL,
-                               &lexer->input[lexer->backtrack_position],
-                               lexer->position - lexer->backtrack_position, 0);
-            struct Token token = make_token(TOKEN_WORD, lexer);
-            token.value.word = string;
-            return token;
+    // the fds of `2>&1`, -1 where a redirection has none
+    long long numbers[2] = {-1, -1};
+    int state = LEX_STATE_START;
+    while (state < LEX_STATE_COUNT) {
+        const unsigned char c = lexer->input[lexer->position];
+        const int next = kLexTransitions[state][kLexClasses[c]];
+        if (next < LEX_STATE_COUNT) {
+            const int slot = kLexNumberSlots[next];
+            if (slot != -1)
+                numbers[slot] = add_digit(numbers[slot], c);
+            lexer->position++;
         }
+        state = next;
     }
 
-    switch (peek(lexer)) {
-        CHAR('(', TOKEN_LPAREN);
-        CHAR(')', TOKEN_RPAREN);
-        CHAR(';', TOKEN_SEMICOLON);
-        CHAR('!', TOKEN_NOT);
-        case '&':
-            advance(lexer);
-            if (peek(lexer) == '>') {
-                advance(lexer);
-                if (peek(lexer) == '>') {
-                    advance(lexer);
-                    return make_redirection_token(REDIRECT_APPEND_OUTERR, -1,
-                                                  -1, lexer);
-                }
-                return make_redirection_token(REDIRECT_OUTERR, -1, -1, lexer);
-            }
-            return match(lexer, '&') ? make_token(TOKEN_AND, lexer)
-                                     : make_token(TOKEN_AMP, lexer);
-        case '>': {
-            advance(lexer);
-            if (peek(lexer) == '>') {
-                advance(lexer);
-                return make_redirection_token(REDIRECT_APPEND_OUT, left, -1,
-                                              lexer);
+    const int left = numbers[0] > INT_MAX ? -1 : (int)numbers[0];
+    switch ((enum LexAction)state) {
+        case LEX_ACTION_WORD:
+            return consume_string(lexer);
+        case LEX_ACTION_EOF:
+            return make_eof(lexer);
+        case LEX_ACTION_NEWLINE:
+            return consume_lines(lexer);
+
+        case LEX_ACTION_LPAREN:
+            return make_token(TOKEN_LPAREN, lexer);
+        case LEX_ACTION_RPAREN:
+            return make_token(TOKEN_RPAREN, lexer);
+        case LEX_ACTION_SEMI:
+            return make_token(TOKEN_SEMICOLON, lexer);
+        case LEX_ACTION_NOT:
+            return make_token(TOKEN_NOT, lexer);
+        case LEX_ACTION_AMP:
+            return make_token(TOKEN_AMP, lexer);
+        case LEX_ACTION_AND:
+            return make_token(TOKEN_AND, lexer);
+        case LEX_ACTION_PIPE:
+            return make_token(TOKEN_PIPE, lexer);
+        case LEX_ACTION_OR:
+            return make_token(TOKEN_OR, lexer);
+
+        case LEX_ACTION_OUT:
+        case LEX_ACTION_APPEND_OUT:
+        case LEX_ACTION_IN:
+        case LEX_ACTION_INOUT:
+            // a fd too large for an int is a word of its own, the redirection
+            // comes after it
+            if (numbers[0] > INT_MAX) {
+                lexer->position =
+                    lexer->token_start +
+                    (int)strspn(&lexer->input[lexer->token_start],
+                                "0123456789");
+                return consume_string(lexer);
             }
-            if (peek(lexer) == '&') {
-                advance(lexer);
-                lexer->backtrack_position = lexer->position;
-                if (!try_consume_number(lexer, true, &right)) {
-                    CASH_ERROR(EXIT_FAILURE,
-                               "expected file descriptor after '>&' in "
-                               "redirection, got '%.*s'\n",
-                               1,
-                               peek(lexer) == '\0'
-                                   ? "<eof>"
-                                   : &lexer->input[lexer->position]);
-                    lexer->error = true;
-                    return make_error(lexer);
-                }
+            return make_redirection_token(kActionRedirections[state], left, -1,
+                                          lexer);
+        case LEX_ACTION_OUTERR:
+        case LEX_ACTION_APPEND_OUTERR:
+            return make_redirection_token(kActionRedirections[state], -1, -1,
+                                          lexer);
+        case LEX_ACTION_OUT_DUPLICATE:
+            if (numbers[1] <= INT_MAX) {
                 return make_redirection_token(REDIRECT_OUT_DUPLICATE, left,
-                                              right, lexer);
+                                              (int)numbers[1], lexer);
             }
-            return make_redirection_token(REDIRECT_OUT, -1, -1, lexer);
-        }
-        case '<':
-            advance(lexer);
-            return match(lexer, '>')
-                       ? make_redirection_token(REDIRECT_INOUT, left, -1, lexer)
-                       : make_redirection_token(REDIRECT_IN, -1, -1, lexer);
-        case '|':
-            advance(lexer);
-            return match(lexer, '|') ? make_token(TOKEN_OR, lexer)
-                                     : make_token(TOKEN_PIPE, lexer);
-        case '\n':
-            return consume_lines(lexer);
-        default:
             break;
+        case LEX_ACTION_MISSING_FD:
+        case LEX_ACTION_COUNT:
+            break;
+    }
+
+    // the machine stopped at the byte that can't follow `>&` or its digits.
+    // A number too large for a fd is wrong as a whole, from its first digit
+    int length = 1;
+    if (state == LEX_ACTION_OUT_DUPLICATE) {
+        const int end = lexer->position;
+        lexer->position =
+            (int)(strstr(&lexer->input[lexer->token_start], ">&") + 2 -
+                  lexer->input);
+        length = end - lexer->position;
+    }
+    const char* got = &lexer->input[lexer->position];
+    if (is_at_end(lexer)) {
+        got = "<eof>";
+        length = (int)strlen(got);
     }
-    return consume_string(lexer);
+    CASH_ERROR(EXIT_FAILURE,
+               "expected file descriptor after '>&' in redirection, got "
+               "'%.*s'\n",
+               length, got);
+    lexer->error = true;
+    return make_error(lexer);
 }
 
 static char peek(const struct Lexer* lexer) {
     return lexer->input[lexer->position];
 }
 
-static char peek_next(const struct Lexer* lexer) {
-    if (is_at_end(lexer))
-        return '\0';
-    return lexer->input[lexer->position + 1];
-}
-
 static char advance(struct Lexer* lexer) {
     if (is_at_end(lexer))
         return '\0';
@@ -244,44 +250,50 @@ static bool is_at_end(const struct Lexer* lexer) {
     return peek(lexer) == '\0';
 }
 
-static void skip_ws(struct Lexer* lexer) {
-    while (peek(lexer) != '\n' && isspace(peek(lexer))) {
-        lexer->last_column++;
-        advance(lexer);
-    }
+// moves past the ordinary characters of a word at once, see scan.h
+static void skip_run(struct Lexer* lexer, enum ScanClass class) {
+    lexer->position += scan_run(class, &lexer->input[lexer->position],
+                                &lexer->input[lexer->length]);
 }
 
-static bool try_consume_number(struct Lexer* lexer, bool eof_ok, int* number) {
-    if (!isdigit(peek(lexer))) {
-        return false;
-    }
-
-    char* endptr;
-    const char* begin = &lexer->input[lexer->position];
-    const long n = strtol(begin, &endptr, 10);
-    if (endptr == begin) {
-        return false;
-    }
-
-    if (errno == ERANGE || n > INT_MAX) {
-        lexer->position = lexer->backtrack_position;
-        return false;
-    }
+// the text of a word component. Components point into the input unless it is
+// going away before the program
+static const char* source_text(const struct Lexer* lexer, int start,
+                               int length) {
+    if (lexer->copy_input)
+        return arena_strndup(lexer->arena, &lexer->input[start], length);
+    return &lexer->input[start];
+}
 
-    if (*endptr == '\0' && !eof_ok) {
-        lexer->position = lexer->backtrack_position;
-        return false;
+// a script run by the kernel starts with the `#!` line naming cash, which is
+// not a command. Scripts reach the lexer a statement at a time, and no other
+// statement can start with `#!`
+static void skip_interpreter_line(struct Lexer* lexer) {
+    if (lexer->repl_mode || strncmp(lexer->input, "#!", 2) != 0)
+        return;
+    const char* newline = strchr(lexer->input, '\n');
+    if (newline == NULL) {
+        lexer->position = lexer->length;
+    } else {
+        lexer->position = (int)(newline - lexer->input) + 1;
+        lexer->first_line = lexer->last_line = 2;
     }
+    lexer->token_start = lexer->position;
+}
 
-    if (*endptr != '\0' && !kPunctuation[(int)*endptr]) {
-        lexer->position = lexer->backtrack_position;
-        return false;
+static void skip_ws(struct Lexer* lexer) {
+    while (peek(lexer) != '\n' && isspace(peek(lexer))) {
+        lexer->last_column++;
+        advance(lexer);
     }
+}
 
-    *number = (int)n;
-    lexer->position += (int)(endptr - begin);
-    lexer->last_column += (int)(endptr - begin);
-    return true;
+// appends a digit to a fd number, which stops growing once it's too large for
+// an int
+static long long add_digit(long long number, char digit) {
+    if (number > INT_MAX)
+        return number;
+    return (number == -1 ? 0 : number * 10) + (digit - '0');
 }
 
 static struct Token consume_lines(struct Lexer* lexer) {
@@ -298,14 +310,6 @@ static struct Token consume_lines(struct Lexer* lexer) {
     return token;
 }
 
-static bool match(struct Lexer* lexer, char c) {
-    if (peek(lexer) == c) {
-        advance(lexer);
-        return true;
-    }
-    return false;
-}
-
 static struct Token make_redirection_token(enum RedirectionType type, int left,
                                            int right, struct Lexer* lexer) {
     struct Token tok = make_token(TOKEN_REDIRECT, lexer);
@@ -357,10 +361,15 @@ static struct Token make_eof(const struct Lexer* lexer) {
     return token;
 }
 
+// the word that starts at `token_start`. The digits or the `!` that lexer_lex
+// went over before it found out it was a word are its start, they are not
+// scanned again
 static struct Token consume_string(struct Lexer* lexer) {
     lexer->continue_string = true;
     lexer->current_string = make_string();
     lexer->string_was_number = true;
+    if (lexer->position > lexer->token_start)
+        consume_unquoted_string(lexer, lexer->token_start);
     while (true) {
         if (lexer->error)
             return make_error(lexer);
@@ -383,7 +392,7 @@ static struct Token consume_string(struct Lexer* lexer) {
             consume_substitution(lexer);
             lexer->string_was_number = false;
         } else if (!is_at_end(lexer) && !kPunctuation[(int)c])
-            consume_unquoted_string(lexer);
+            consume_unquoted_string(lexer, lexer->position);
         else
             break;
     }
@@ -394,35 +403,47 @@ static struct Token consume_string(struct Lexer* lexer) {
     return token;
 }
 
-static void consume_unquoted_string(struct Lexer* lexer) {
-    char c;
-    const int string_start = lexer->position;
+// the unquoted part of a word from `string_start`, where the bytes up to the
+// current position are known to be ordinary ones
+static void consume_unquoted_string(struct Lexer* lexer, int string_start) {
     int escapes = 0;
-    while (!is_at_end(lexer) && !kPunctuation[(int)(c = peek(lexer))]) {
-        if (!isdigit(c))
-            lexer->string_was_number = false;
-        if (c == '\\') {
-            escapes++;
-            advance(lexer);
-        }
+    while (true) {
+        skip_run(lexer, SCAN_UNQUOTED);
+        if (peek(lexer) != '\\')
+            break;
+        escapes++;
+        advance(lexer);
         advance(lexer);
     }
 
+    for (int i = string_start;
+         lexer->string_was_number && i < lexer->position; ++i) {
+        if (!isdigit(lexer->input[i]))
+            lexer->string_was_number = false;
+    }
+
     lexer->substitution_in_quotes = false;
-    if (lexer->position - string_start != 0)
-        add_string_literal(&lexer->current_string, STRING_COMPONENT_LITERAL,
-                           &lexer->input[string_start],
-                           lexer->position - string_start, escapes);
+    const int length = lexer->position - string_start;
+    if (length != 0)
+        add_string_literal(lexer->arena, &lexer->current_string,
+                           STRING_COMPONENT_LITERAL,
+                           source_text(lexer, string_start, length), length,
+                           escapes);
 }
 
 static void consume_dq_string(struct Lexer* lexer) {
     const int string_start = lexer->position;
     int escapes = 0;
-    while (!is_at_end(lexer) && peek(lexer) != '"') {
+    while (true) {
+        skip_run(lexer, SCAN_DQ);
+        if (is_at_end(lexer) || peek(lexer) == '"')
+            break;
         if (peek(lexer) == '$') {
-            add_string_literal(&lexer->current_string, STRING_COMPONENT_DQ,
-                               &lexer->input[string_start],
-                               lexer->position - string_start, escapes);
+            const int length = lexer->position - string_start;
+            add_string_literal(lexer->arena, &lexer->current_string,
+                               STRING_COMPONENT_DQ,
+                               source_text(lexer, string_start, length),
+                               length, escapes);
             lexer->substitution_in_quotes = true;
             consume_substitution(lexer);
             return;
@@ -441,18 +462,18 @@ static void consume_dq_string(struct Lexer* lexer) {
     }
     advance(lexer);
 
-    if (lexer->position - string_start - 1 != 0)
-        add_string_literal(&lexer->current_string, STRING_COMPONENT_DQ,
-                           &lexer->input[string_start],
-                           lexer->position - string_start - 1, escapes);
+    const int length = lexer->position - string_start - 1;
+    if (length != 0)
+        add_string_literal(lexer->arena, &lexer->current_string,
+                           STRING_COMPONENT_DQ,
+                           source_text(lexer, string_start, length), length,
+                           escapes);
 }
 
 static void consume_sq_string(struct Lexer* lexer) {
     advance(lexer);
     const int string_start = lexer->position;
-    while (!is_at_end(lexer) && peek(lexer) != '\'') {
-        advance(lexer);
-    }
+    skip_run(lexer, SCAN_SQ);
 
     if (is_at_end(lexer)) {
         CASH_ERROR(EXIT_FAILURE, "unexpected <eof> in string literal%s\n", "");
@@ -461,18 +482,23 @@ static void consume_sq_string(struct Lexer* lexer) {
     }
     advance(lexer);
 
-    if (lexer->position - string_start - 1 != 0)
-        add_string_literal(&lexer->current_string, STRING_COMPONENT_SQ,
-                           &lexer->input[string_start],
-                           lexer->position - string_start - 1, 0);
+    const int length = lexer->position - string_start - 1;
+    if (length != 0)
+        add_string_literal(lexer->arena, &lexer->current_string,
+                           STRING_COMPONENT_SQ,
+                           source_text(lexer, string_start, length), length,
+                           0);
 }
 
 static void consume_substitution(struct Lexer* lexer) {
     advance(lexer);  // '$'
 
-    if (peek(lexer) == '?' || peek(lexer) == '#') {
-        add_string_component(&lexer->current_string, STRING_COMPONENT_VAR_SUB,
-                             peek(lexer) == '?' ? "?" : "#", 1);
+    if (peek(lexer) == '?' || peek(lexer) == '#' || peek(lexer) == '!') {
+        const char* name = peek(lexer) == '?'   ? "?"
+                           : peek(lexer) == '#' ? "#"
+                                                : "!";
+        add_string_component(lexer->arena, &lexer->current_string,
+                             STRING_COMPONENT_VAR_SUB, name, 1);
         advance(lexer);
         return;
     }
@@ -486,10 +512,14 @@ static void consume_substitution(struct Lexer* lexer) {
         advance(lexer);
     }
 
-    if (lexer->position - name_start != 0)
-        add_string_component(&lexer->current_string, STRING_COMPONENT_VAR_SUB,
-                             &lexer->input[name_start],
-                             lexer->position - name_start);
+    const int length = lexer->position - name_start;
+    if (length != 0) {
+        const struct Symbol* symbol =
+            intern_symbol(&lexer->symbols, lexer->arena,
+                          &lexer->input[name_start], length);
+        add_string_component(lexer->arena, &lexer->current_string,
+                             STRING_COMPONENT_VAR_SUB, symbol->name, length);
+    }
 }
 
 static void lexer_push_token(struct Lexer* lexer, struct Token token) {
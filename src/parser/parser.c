@@ -6,20 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cash/arena.h"
 #include "cash/ast.h"
 #include "cash/error.h"
 #include "cash/memory.h"
 
-#define ALLOC_CHECKED(ptr, size)                                          \
-    do {                                                                  \
-        ptr = malloc(size);                                               \
-        if (!ptr) {                                                       \
-            CASH_ERROR(EXIT_FAILURE, "Memory allocation failed%s\n", ""); \
-            parser->error = true;                                         \
-            return false;                                                 \
-        }                                                                 \
-    } while (0)
-
 #define CHECK(expr)       \
     do {                  \
         if (!(expr)) {    \
@@ -41,18 +32,30 @@ static struct Token consume(enum TokenType type, struct Parser* parser);
 
 static bool parse_subshell(struct Parser* parser, struct Expr* expr);
 static bool parse_terminal(struct Parser* parser, struct Expr* expr);
+static bool parse_timed_expr(struct Parser* parser, struct Expr* expr);
+static bool is_word(struct Token token, const char* word);
 static bool parse_not_expr(struct Parser* parser, struct Expr* expr);
 static bool parse_pipeline(struct Parser* parser, struct Expr* expr);
 static bool handle_redirection(struct Parser* parser, struct Command* command,
                                struct Token redir, const char** endp);
 static bool parse_command(struct Parser* parser, struct Expr* expr);
+static void resolve_static_words(struct Arena* arena,
+                                 struct Command* command);
+static void resolve_command_name(struct Parser* parser,
+                                 struct Command* command);
 static bool parse_expr(struct Parser* parser, struct Expr* expr);
+static bool is_empty_command(const struct Expr* expr);
 
 static bool skip_line_terminator(struct Parser* parser);
 static bool parse_statement(struct Parser* parser, struct Stmt* stmt);
 
 struct Parser parser_new(const char* input, bool repl_mode) {
-    const struct Parser parser = {.lexer = lexer_new(input, repl_mode),
+    struct Arena* arena = malloc(sizeof(struct Arena));
+    CHECK_ALLOC(arena);
+    *arena = make_arena();
+
+    const struct Parser parser = {.lexer = lexer_new(input, repl_mode, arena),
+                                  .arena = arena,
                                   .input = input,
                                   .program = make_program(),
                                   .error = false,
@@ -62,6 +65,7 @@ struct Parser parser_new(const char* input, bool repl_mode) {
 
 void reset_parser(const char* input, struct Parser* parser) {
     reset_lexer(input, parser->lexer);
+    reset_arena(parser->arena);
     parser->error = false;
     parser->input = input;
     parser->program = make_program();
@@ -70,12 +74,17 @@ void reset_parser(const char* input, struct Parser* parser) {
 void free_parser(const struct Parser* parser) {
     free_lexer(parser->lexer);
     free(parser->lexer);
+    free_arena(parser->arena);
+    free(parser->arena);
 }
 
 bool parse_program(struct Parser* parser) {
     if (!parser->is_subparser) {
         parser->current_token = lexer_next_token(parser->lexer);
         parser->next_token = lexer_next_token(parser->lexer);
+        // blank lines before the first statement, after a `#!` line say
+        while (peek_tt(parser) == TOKEN_LINE_BREAK)
+            advance(parser);
     }
     while (peek_tt(parser) != TOKEN_EOF) {
         if (parser->error) {
@@ -83,7 +92,7 @@ bool parse_program(struct Parser* parser) {
         }
         struct Stmt stmt;
         parse_statement(parser, &stmt);
-        add_statement(&parser->program, stmt);
+        add_statement(parser->arena, &parser->program, stmt);
 
         if (peek_tt(parser) == TOKEN_RPAREN && parser->is_subparser)
             break;
@@ -111,59 +120,76 @@ static bool skip_line_terminator(struct Parser* parser) {
 }
 
 static bool parse_expr(struct Parser* parser, struct Expr* expr) {
-    struct Expr left_expr;
-    struct Expr *left, *right;
-    const char* begin = NULL;
-    const char* end;
-
-    CHECK(parse_not_expr(parser, &left_expr));
-    if (match(parser, TOKEN_AMP)) {
-        left_expr.background = true;
-        *expr = left_expr;
+    const char* begin = peek(parser).lexeme;
+    struct Expr first;
+
+    CHECK(parse_timed_expr(parser, &first));
+    if (peek_tt(parser) != TOKEN_AND && peek_tt(parser) != TOKEN_OR) {
+        first.background = match(parser, TOKEN_AMP);
+        *expr = first;
         return true;
     }
 
-    while (peek_tt(parser) == TOKEN_AND || peek_tt(parser) == TOKEN_OR) {
-        const struct Token tok = advance(parser);
-        if (left_expr.type == EXPR_COMMAND &&
-            left_expr.command.command_name.component_count == 0 &&
-            left_expr.command.redirection_count == 0) {
-            // error
+    // the whole chain goes into one list, however long it is
+    struct AndOrList list = {
+        .items = NULL, .item_count = 0, .item_capacity = 0};
+    struct ListItem item = {.join = LIST_AND, .expr = first};
+    while (true) {
+        if (is_empty_command(&item.expr)) {
             parser->error = true;
             CASH_ERROR(EXIT_FAILURE, "empty command in AND/OR list\n%s", "");
             return false;
         }
+        add_list_item(parser->arena, &list, item);
 
-        if (begin == NULL)
-            begin = tok.lexeme;
-        ALLOC_CHECKED(left, sizeof(struct Expr));
-        ALLOC_CHECKED(right, sizeof(struct Expr));
-
-        CHECK(parse_not_expr(parser, right));
-        end = right->expr_text.string + right->expr_text.length;
+        if (peek_tt(parser) != TOKEN_AND && peek_tt(parser) != TOKEN_OR)
+            break;
+        item.join = advance(parser).type == TOKEN_AND ? LIST_AND : LIST_OR;
+        CHECK(parse_timed_expr(parser, &item.expr));
+    }
 
-        if (right->type == EXPR_COMMAND &&
-            right->command.command_name.component_count == 0 &&
-            right->command.redirection_count == 0) {
-            // error
-            parser->error = true;
-            CASH_ERROR(EXIT_FAILURE, "empty command in AND/OR list\n%s", "");
-            return false;
-        }
+    const struct StringView* last =
+        &list.items[list.item_count - 1].expr.expr_text;
+    const char* end = last->string + last->length;
+    *expr = (struct Expr){.type = EXPR_AND_OR,
+                          .and_or = list,
+                          .expr_text = {begin, end - begin},
+                          .background = match(parser, TOKEN_AMP)};
+    return true;
+}
 
-        *left = left_expr;
-        left_expr =
-            (struct Expr){.type = tok.type == TOKEN_AND ? EXPR_AND : EXPR_OR,
-                          .binary = {.left = left, .right = right},
+// like `!`, `time` is a keyword only at the start of a pipeline, and only
+// unquoted
+static bool parse_timed_expr(struct Parser* parser, struct Expr* expr) {
+    if (!is_word(peek(parser), "time"))
+        return parse_not_expr(parser, expr);
+
+    struct Token last = advance(parser);
+    const char* begin = last.lexeme;
+    const bool posix = is_word(peek(parser), "-p");
+    if (posix)
+        last = advance(parser);
+
+    // a bare `time` times nothing, as in bash
+    struct Expr* timed = arena_alloc(parser->arena, sizeof(struct Expr));
+    CHECK(parse_not_expr(parser, timed));
+
+    const char* end = timed->expr_text.length != 0
+                          ? timed->expr_text.string + timed->expr_text.length
+                          : last.lexeme + last.lexeme_length;
+    *expr = (struct Expr){.type = EXPR_TIME,
+                          .timed = {.expr = timed, .posix = posix},
                           .expr_text = {begin, end - begin},
                           .background = false};
-    }
-
-    left_expr.background = match(parser, TOKEN_AMP);
-    *expr = left_expr;
     return true;
 }
 
+static bool is_word(struct Token token, const char* word) {
+    const int length = (int)strlen(word);
+    return token.type == TOKEN_WORD && token.lexeme_length == length &&
+           strncmp(token.lexeme, word, length) == 0;
+}
+
 static bool parse_not_expr(struct Parser* parser, struct Expr* expr) {
     const char* begin = peek(parser).lexeme;
     const bool is_not_expr = match(parser, TOKEN_NOT);
@@ -171,20 +197,17 @@ static bool parse_not_expr(struct Parser* parser, struct Expr* expr) {
 
     CHECK(parse_pipeline(parser, &sub_expr));
     if (is_not_expr) {
-        if (sub_expr.type == EXPR_COMMAND &&
-            sub_expr.command.command_name.component_count == 0 &&
-            sub_expr.command.redirection_count == 0) {
+        if (is_empty_command(&sub_expr)) {
             // error
             consume(TOKEN_WORD, parser);
         }
 
-        struct Expr* not_expr;
-        ALLOC_CHECKED(not_expr, sizeof(struct Expr));
+        struct Expr* not_expr = arena_alloc(parser->arena, sizeof(struct Expr));
         *not_expr = sub_expr;
 
         const char* end = sub_expr.expr_text.string + sub_expr.expr_text.length;
         *expr = (struct Expr){.type = EXPR_NOT,
-                              .binary = {.left = not_expr, .right = NULL},
+                              .negated = not_expr,
                               .expr_text = {begin, end - begin},
                               .background = false};
     } else {
@@ -194,45 +217,38 @@ static bool parse_not_expr(struct Parser* parser, struct Expr* expr) {
 }
 
 static bool parse_pipeline(struct Parser* parser, struct Expr* expr) {
-    struct Expr left_expr;
     const char* begin = peek(parser).lexeme;
-    const char* end;
-    CHECK(parse_terminal(parser, &left_expr));
+    struct Expr stage;
 
-    while (match(parser, TOKEN_PIPE)) {
-        if (left_expr.type == EXPR_COMMAND &&
-            left_expr.command.command_name.component_count == 0 &&
-            left_expr.command.redirection_count == 0) {
-            // error
-            parser->error = true;
-            CASH_ERROR(EXIT_FAILURE, "empty command in pipeline\n%s", "");
-            return false;
-        }
-
-        struct Expr *left, *right;
-        ALLOC_CHECKED(left, sizeof(struct Expr));
-        ALLOC_CHECKED(right, sizeof(struct Expr));
-
-        CHECK(parse_terminal(parser, right));
-        end = right->expr_text.string + right->expr_text.length;
+    CHECK(parse_terminal(parser, &stage));
+    if (peek_tt(parser) != TOKEN_PIPE) {
+        *expr = stage;
+        return true;
+    }
 
-        if (right->type == EXPR_COMMAND &&
-            right->command.command_name.component_count == 0 &&
-            right->command.redirection_count == 0) {
-            // error
+    // the stages are stored in order, however many there are
+    struct Pipeline pipeline = {
+        .stages = NULL, .stage_count = 0, .stage_capacity = 0};
+    while (true) {
+        if (is_empty_command(&stage)) {
             parser->error = true;
             CASH_ERROR(EXIT_FAILURE, "empty command in pipeline\n%s", "");
             return false;
         }
+        add_stage(parser->arena, &pipeline, stage);
 
-        *left = left_expr;
-        left_expr = (struct Expr){.type = EXPR_PIPELINE,
-                                  .binary = {.left = left, .right = right},
-                                  .expr_text = {begin, end - begin},
-                                  .background = false};
+        if (!match(parser, TOKEN_PIPE))
+            break;
+        CHECK(parse_terminal(parser, &stage));
     }
 
-    *expr = left_expr;
+    const struct StringView* last =
+        &pipeline.stages[pipeline.stage_count - 1].expr_text;
+    const char* end = last->string + last->length;
+    *expr = (struct Expr){.type = EXPR_PIPELINE,
+                          .pipeline = pipeline,
+                          .expr_text = {begin, end - begin},
+                          .background = false};
     return true;
 }
 
@@ -245,11 +261,10 @@ static bool parse_terminal(struct Parser* parser, struct Expr* expr) {
 
 static bool parse_subshell(struct Parser* parser, struct Expr* expr) {
     const char* begin = peek(parser).lexeme;
-    const char* end;
+    const char* end = begin;
 
     advance(parser);
     struct Parser subparser = make_subparser(parser);
-    struct Program* subshell;
 
     if (!parse_program(&subparser)) {
         parser->error = true;
@@ -264,7 +279,8 @@ static bool parse_subshell(struct Parser* parser, struct Expr* expr) {
     if (parser->error)
         return false;
 
-    ALLOC_CHECKED(subshell, sizeof(struct Program));
+    struct Program* subshell =
+        arena_alloc(parser->arena, sizeof(struct Program));
     *subshell = subparser.program;
     *expr = (struct Expr){.type = EXPR_SUBSHELL,
                           .subshell = subshell,
@@ -278,12 +294,13 @@ static bool parse_command(struct Parser* parser, struct Expr* expr) {
                                                .component_count = 0,
                                                .component_capacity = 0},
                               .arguments = make_arg_list(),
+                              .builtin = -1,
                               .redirection_capacity = 0,
                               .redirection_count = 0,
                               .redirections = NULL};
     bool break_out = false;
     const char* begin = peek(parser).lexeme;
-    const char* end;
+    const char* end = begin;
 
     while (!is_at_end(parser) && !break_out) {
         if (parser->error)
@@ -297,10 +314,25 @@ static bool parse_command(struct Parser* parser, struct Expr* expr) {
                     command.command_name = advance(parser).value.word;
                 } else {
                     const struct Token argument = advance(parser);
-                    add_argument(&command.arguments, argument.value.word);
+                    add_argument(parser->arena, &command.arguments,
+                                 argument.value.word);
                 }
                 break;
             }
+            case TOKEN_NOT: {
+                // `!` only negates at the start of a pipeline, anywhere else
+                // it is an ordinary word (`[ ! -e file ]`)
+                const struct Token bang = advance(parser);
+                end = bang.lexeme + bang.lexeme_length;
+                struct ShellString word = make_string();
+                add_string_literal(parser->arena, &word,
+                                   STRING_COMPONENT_LITERAL, "!", 1, 0);
+                if (command.command_name.component_count == 0)
+                    command.command_name = word;
+                else
+                    add_argument(parser->arena, &command.arguments, word);
+                break;
+            }
             case TOKEN_RPAREN:
                 if (parser->is_subparser)
                     break_out = true;
@@ -323,14 +355,20 @@ static bool parse_command(struct Parser* parser, struct Expr* expr) {
                 parser->error = true;
                 return false;
             default:
-                CASH_ERROR(EXIT_FAILURE, "IMPOSSIBLE%s", "");
-                exit(EXIT_FAILURE);
+                // a syntax error, not a reason to take down the shell that
+                // parses it (a script it runs, or the REPL)
+                parser->error = true;
+                CASH_ERROR(EXIT_FAILURE, "unexpected `%.*s`\n",
+                           next.lexeme_length, next.lexeme);
+                return false;
         }
     }
 
     if (parser->error)
         return false;
 
+    resolve_static_words(parser->arena, &command);
+    resolve_command_name(parser, &command);
     *expr = (struct Expr){.type = EXPR_COMMAND,
                           .command = command,
                           .background = false,
@@ -338,6 +376,43 @@ static bool parse_command(struct Parser* parser, struct Expr* expr) {
     return true;
 }
 
+// most words are plain flags and paths, expand those once here instead of on
+// every execution of the command
+static void resolve_static_words(struct Arena* arena,
+                                 struct Command* command) {
+    if (command->command_name.component_count != 0)
+        resolve_static_string(arena, &command->command_name);
+    for (int i = 0; i < command->arguments.argument_count; ++i)
+        resolve_static_string(arena, &command->arguments.arguments[i]);
+    for (int i = 0; i < command->redirection_count; ++i) {
+        if (command->redirections[i].file_name.component_count != 0)
+            resolve_static_string(arena, &command->redirections[i].file_name);
+    }
+}
+
+// a static command name is interned, which also tells once and for all
+// whether it is a builtin
+static void resolve_command_name(struct Parser* parser,
+                                 struct Command* command) {
+    struct ShellString* name = &command->command_name;
+    if (name->static_value == NULL)
+        return;
+
+    const struct Symbol* symbol =
+        intern_symbol(&parser->lexer->symbols, parser->arena,
+                      name->static_value, name->static_length);
+    name->static_value = symbol->name;
+    command->builtin = symbol->builtin;
+}
+
+// a command with neither a name nor redirections, which is what a missing
+// command parses to
+static bool is_empty_command(const struct Expr* expr) {
+    return expr->type == EXPR_COMMAND &&
+           expr->command.command_name.component_count == 0 &&
+           expr->command.redirection_count == 0;
+}
+
 static bool handle_redirection(struct Parser* parser, struct Command* command,
                                struct Token redir, const char** endp) {
     *endp = redir.lexeme + redir.lexeme_length;
@@ -356,8 +431,8 @@ static bool handle_redirection(struct Parser* parser, struct Command* command,
             return false;
     }
 
-    ADD_LIST(command, redirection_count, redirection_capacity, redirections,
-             redirection, struct Redirection);
+    ARENA_ADD_LIST(parser->arena, command, redirection_count,
+                   redirection_capacity, redirections, redirection);
     return true;
 }
 
@@ -366,9 +441,7 @@ static bool parse_statement(struct Parser* parser, struct Stmt* stmt) {
     CHECK(parse_expr(parser, &expr));
     *stmt = (struct Stmt){.expr = expr};
 
-    if (stmt->expr.type == EXPR_COMMAND &&
-        stmt->expr.command.command_name.component_count == 0 &&
-        stmt->expr.command.redirection_count == 0) {
+    if (is_empty_command(&stmt->expr)) {
         bool skipped = skip_line_terminator(parser);
         if (!is_at_end(parser)) {
             CASH_ERROR(EXIT_FAILURE, "empty command %s", "");
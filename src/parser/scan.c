@@ -0,0 +1,155 @@
+#include <cash/parser/scan.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+// the bytes that end a run of each class. sizeof includes the terminating NUL,
+// which ends every run as well
+static const char kUnquotedDelimiters[] = "><|()'\";&`$ \t\n\r\\";
+static const char kDQDelimiters[] = "\"\\$";
+static const char kSQDelimiters[] = "'";
+
+// the same sets as tables, for the scalar scanner and the tails of the SIMD
+// ones
+static const bool kIsUnquotedDelimiter[256] = {
+    ['\0'] = true, ['>'] = true,  ['<'] = true,  ['|'] = true, ['('] = true,
+    [')'] = true,  ['\''] = true, ['"'] = true,  [';'] = true, ['&'] = true,
+    ['`'] = true,  ['$'] = true,  [' '] = true,  ['\t'] = true, ['\n'] = true,
+    ['\r'] = true, ['\\'] = true,
+};
+static const bool kIsDQDelimiter[256] = {
+    ['\0'] = true,
+    ['"'] = true,
+    ['\\'] = true,
+    ['$'] = true,
+};
+static const bool kIsSQDelimiter[256] = {
+    ['\0'] = true,
+    ['\''] = true,
+};
+
+typedef int (*ScanFunc)(enum ScanClass class, const char* begin,
+                        const char* end);
+
+static ScanFunc pick_scanner(void);
+static int scan_scalar(enum ScanClass class, const char* begin,
+                       const char* end);
+static int scan_table(const bool* table, const char* begin, const char* end);
+#ifdef HAVE_X86_SIMD
+static int scan_sse2(enum ScanClass class, const char* begin, const char* end);
+static int scan_avx2(enum ScanClass class, const char* begin, const char* end);
+#endif
+
+static ScanFunc scanner = NULL;
+
+int scan_run(enum ScanClass class, const char* begin, const char* end) {
+    if (scanner == NULL)
+        scanner = pick_scanner();
+    return scanner(class, begin, end);
+}
+
+// CASH_SIMD=0 forces the scalar scanner, to compare against it
+static ScanFunc pick_scanner(void) {
+    const char* simd_env = getenv("CASH_SIMD");
+    if (simd_env != NULL && strcmp(simd_env, "0") == 0)
+        return scan_scalar;
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return scan_sse2;
+#endif
+    return scan_scalar;
+}
+
+static int scan_scalar(enum ScanClass class, const char* begin,
+                       const char* end) {
+    switch (class) {
+        case SCAN_UNQUOTED:
+            return scan_table(kIsUnquotedDelimiter, begin, end);
+        case SCAN_DQ:
+            return scan_table(kIsDQDelimiter, begin, end);
+        case SCAN_SQ:
+            return scan_table(kIsSQDelimiter, begin, end);
+    }
+    return 0;
+}
+
+static int scan_table(const bool* table, const char* begin, const char* end) {
+    const char* p = begin;
+    while (p < end && !table[(unsigned char)*p])
+        p++;
+    return (int)(p - begin);
+}
+
+#ifdef HAVE_X86_SIMD
+// compares every byte of a block against each delimiter. The delimiter sets
+// are constant at every call site, so the loop is unrolled once this is inlined
+#define DEFINE_SIMD_SCAN(name, isa, vector, width, load, set1, cmpeq, vor,     \
+                         movemask)                                             \
+    __attribute__((target(isa), always_inline)) static inline int name(        \
+        const char* delimiters, int delimiter_count, const bool* table,        \
+        const char* begin, const char* end) {                                  \
+        const char* p = begin;                                                 \
+        for (; end - p >= (width); p += (width)) {                             \
+            const vector block = load((const vector*)p);                       \
+            vector hits = cmpeq(block, set1(delimiters[0]));                   \
+            for (int i = 1; i < delimiter_count; ++i)                          \
+                hits = vor(hits, cmpeq(block, set1(delimiters[i])));           \
+            const unsigned mask = (unsigned)movemask(hits);                    \
+            if (mask != 0)                                                     \
+                return (int)(p - begin) + __builtin_ctz(mask);                 \
+        }                                                                      \
+        return (int)(p - begin) + scan_table(table, p, end);                   \
+    }
+
+DEFINE_SIMD_SCAN(scan_blocks_sse2, "sse2", __m128i, 16, _mm_loadu_si128,
+                 _mm_set1_epi8, _mm_cmpeq_epi8, _mm_or_si128,
+                 _mm_movemask_epi8)
+DEFINE_SIMD_SCAN(scan_blocks_avx2, "avx2", __m256i, 32, _mm256_loadu_si256,
+                 _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_or_si256,
+                 _mm256_movemask_epi8)
+
+__attribute__((target("sse2"))) static int scan_sse2(enum ScanClass class,
+                                                     const char* begin,
+                                                     const char* end) {
+    switch (class) {
+        case SCAN_UNQUOTED:
+            return scan_blocks_sse2(kUnquotedDelimiters,
+                                    sizeof(kUnquotedDelimiters),
+                                    kIsUnquotedDelimiter, begin, end);
+        case SCAN_DQ:
+            return scan_blocks_sse2(kDQDelimiters, sizeof(kDQDelimiters),
+                                    kIsDQDelimiter, begin, end);
+        case SCAN_SQ:
+            return scan_blocks_sse2(kSQDelimiters, sizeof(kSQDelimiters),
+                                    kIsSQDelimiter, begin, end);
+    }
+    return 0;
+}
+
+__attribute__((target("avx2"))) static int scan_avx2(enum ScanClass class,
+                                                     const char* begin,
+                                                     const char* end) {
+    switch (class) {
+        case SCAN_UNQUOTED:
+            return scan_blocks_avx2(kUnquotedDelimiters,
+                                    sizeof(kUnquotedDelimiters),
+                                    kIsUnquotedDelimiter, begin, end);
+        case SCAN_DQ:
+            return scan_blocks_avx2(kDQDelimiters, sizeof(kDQDelimiters),
+                                    kIsDQDelimiter, begin, end);
+        case SCAN_SQ:
+            return scan_blocks_avx2(kSQDelimiters, sizeof(kSQDelimiters),
+                                    kIsSQDelimiter, begin, end);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,90 @@
+#include <cash/arena.h>
+#include <cash/memory.h>
+#include <cash/parser/symbols.h>
+#include <cash/vm.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern bool repl_mode;
+
+static uint32_t hash_name(const char* name, int length);
+static struct Symbol** find_slot(const struct SymbolTable* table,
+                                 const char* name, int length, uint32_t hash);
+static void grow_table(struct SymbolTable* table);
+
+struct SymbolTable make_symbol_table(void) {
+    return (struct SymbolTable){.slots = NULL, .count = 0, .capacity = 0};
+}
+
+const struct Symbol* intern_symbol(struct SymbolTable* table,
+                                   struct Arena* arena, const char* name,
+                                   int length) {
+    // kept at most half full, so probing stays short
+    if (2 * (table->count + 1) > table->capacity)
+        grow_table(table);
+
+    const uint32_t hash = hash_name(name, length);
+    struct Symbol** slot = find_slot(table, name, length, hash);
+    if (*slot != NULL)
+        return *slot;
+
+    struct Symbol* symbol = arena_alloc(arena, sizeof(struct Symbol));
+    *symbol = (struct Symbol){
+        .name = arena_strndup(arena, name, length),
+        .length = length,
+        .hash = hash,
+        .builtin = find_builtin(name, length),
+    };
+    *slot = symbol;
+    table->count++;
+    return symbol;
+}
+
+void clear_symbol_table(struct SymbolTable* table) {
+    if (table->count == 0)
+        return;
+    memset(table->slots, 0, table->capacity * sizeof(struct Symbol*));
+    table->count = 0;
+}
+
+void free_symbol_table(const struct SymbolTable* table) {
+    free(table->slots);
+}
+
+// FNV-1a
+static uint32_t hash_name(const char* name, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; ++i)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+// the slot of `name`, or the empty slot it would go to
+static struct Symbol** find_slot(const struct SymbolTable* table,
+                                 const char* name, int length, uint32_t hash) {
+    const uint32_t mask = (uint32_t)table->capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        struct Symbol** slot = &table->slots[i];
+        if (*slot == NULL ||
+            ((*slot)->hash == hash && (*slot)->length == length &&
+             memcmp((*slot)->name, name, length) == 0))
+            return slot;
+    }
+}
+
+static void grow_table(struct SymbolTable* table) {
+    const struct SymbolTable old = *table;
+    table->capacity = old.capacity == 0 ? 64 : old.capacity * 2;
+    table->slots = calloc(table->capacity, sizeof(struct Symbol*));
+    CHECK_ALLOC(table->slots);
+
+    for (int i = 0; i < old.capacity; ++i) {
+        struct Symbol* symbol = old.slots[i];
+        if (symbol != NULL)
+            *find_slot(table, symbol->name, symbol->length, symbol->hash) =
+                symbol;
+    }
+    free(old.slots);
+}
@@ -0,0 +1,302 @@
+#include <cash/error.h>
+#include <cash/job_control.h>
+#include <cash/memory.h>
+#include <cash/path_cache.h>
+#include <cash/vm.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INITIAL_BUCKET_COUNT 32
+
+extern bool repl_mode;
+
+static uint32_t hash_name(const char *name);
+static bool same_path_env(const char *a, const char *b);
+static void sync_with_path_env(struct PathCache *cache);
+static char *search_path(const char *path_env, const char *cmd);
+
+static struct PathCacheEntry *find_entry(const struct PathCache *cache,
+                                         const char *name, uint32_t hash);
+static struct PathCacheEntry *insert_entry(struct PathCache *cache,
+                                           const char *name, uint32_t hash,
+                                           char *path);
+static void grow_buckets(struct PathCache *cache);
+static void free_entry(struct PathCacheEntry *entry);
+
+static void list_command_paths(const struct PathCache *cache);
+
+struct PathCache make_path_cache(void) {
+    return (struct PathCache){
+        .buckets = NULL, .bucket_count = 0, .entry_count = 0, .path_env = NULL};
+}
+
+void clear_path_cache(struct PathCache *cache) {
+    for (int i = 0; i < cache->bucket_count; ++i) {
+        struct PathCacheEntry *next;
+        for (struct PathCacheEntry *entry = cache->buckets[i]; entry != NULL;
+             entry = next) {
+            next = entry->next;
+            free_entry(entry);
+        }
+        cache->buckets[i] = NULL;
+    }
+    cache->entry_count = 0;
+}
+
+void free_path_cache(const struct PathCache *cache) {
+    for (int i = 0; i < cache->bucket_count; ++i) {
+        struct PathCacheEntry *next;
+        for (struct PathCacheEntry *entry = cache->buckets[i]; entry != NULL;
+             entry = next) {
+            next = entry->next;
+            free_entry(entry);
+        }
+    }
+    free(cache->buckets);
+    free(cache->path_env);
+}
+
+// returns the full path `name` resolves to in $PATH, or NULL if it is not in
+// any of the directories. Both outcomes are cached until $PATH changes, so only
+// the first lookup of a name pays for the access() calls
+const char *lookup_command_path(struct PathCache *cache, const char *name) {
+    sync_with_path_env(cache);
+
+    const uint32_t hash = hash_name(name);
+    struct PathCacheEntry *entry = find_entry(cache, name, hash);
+    if (entry == NULL) {
+        char *path =
+            cache->path_env ? search_path(cache->path_env, name) : NULL;
+        entry = insert_entry(cache, name, hash, path);
+    }
+
+    if (entry->path != NULL)
+        entry->hits++;
+    return entry->path;
+}
+
+void remember_command_path(struct PathCache *cache, const char *name,
+                           const char *path) {
+    sync_with_path_env(cache);
+
+    char *path_copy = strdup(path);
+    CHECK_ALLOC(path_copy);
+
+    const uint32_t hash = hash_name(name);
+    struct PathCacheEntry *entry = find_entry(cache, name, hash);
+    if (entry == NULL) {
+        insert_entry(cache, name, hash, path_copy);
+    } else {
+        free(entry->path);
+        entry->path = path_copy;
+        entry->hits = 0;
+    }
+}
+
+void forget_command_path(struct PathCache *cache, const char *name) {
+    if (cache->bucket_count == 0)
+        return;
+
+    const uint32_t hash = hash_name(name);
+    struct PathCacheEntry **link =
+        &cache->buckets[hash & (cache->bucket_count - 1)];
+    for (; *link != NULL; link = &(*link)->next) {
+        struct PathCacheEntry *entry = *link;
+        if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+            *link = entry->next;
+            free_entry(entry);
+            cache->entry_count--;
+            return;
+        }
+    }
+}
+
+// hash [-r] [-d name...] [-p path name] [name...]
+int hash_commands(struct Vm *vm, const struct RawCommand *raw_command) {
+    struct PathCache *cache = &vm->path_cache;
+    int status = 0;
+
+    if (raw_command->args_count == 1) {
+        list_command_paths(cache);
+        return 0;
+    }
+
+    bool forget = false;
+    for (int i = 1; i < raw_command->args_count; ++i) {
+        const char *arg = raw_command->args[i];
+
+        if (strcmp(arg, "-r") == 0) {
+            clear_path_cache(cache);
+        } else if (strcmp(arg, "-d") == 0) {
+            forget = true;
+        } else if (strcmp(arg, "-p") == 0) {
+            if (i + 2 >= raw_command->args_count) {
+                CASH_NONFATAL_ERROR("hash: -p: expected path and name%s\n", "");
+                return 1;
+            }
+            remember_command_path(cache, raw_command->args[i + 2],
+                                  raw_command->args[i + 1]);
+            i += 2;
+        } else if (forget) {
+            forget_command_path(cache, arg);
+        } else if (strchr(arg, '/') == NULL &&
+                   lookup_command_path(cache, arg) == NULL) {
+            // don't keep a negative entry for something the user asked for
+            // explicitly
+            forget_command_path(cache, arg);
+            CASH_NONFATAL_ERROR("hash: %s: not found\n", arg);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+static void list_command_paths(const struct PathCache *cache) {
+    bool empty = true;
+    for (int i = 0; i < cache->bucket_count; ++i) {
+        for (const struct PathCacheEntry *entry = cache->buckets[i];
+             entry != NULL; entry = entry->next) {
+            if (entry->path == NULL)
+                continue;
+            if (empty)
+                printf("hits\tcommand\n");
+            empty = false;
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+
+    if (empty)
+        printf("hash: hash table empty\n");
+}
+
+// FNV-1a
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; ++name) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool same_path_env(const char *a, const char *b) {
+    if (a == NULL || b == NULL)
+        return a == b;
+    return strcmp(a, b) == 0;
+}
+
+static void sync_with_path_env(struct PathCache *cache) {
+    const char *path_env = getenv("PATH");
+    if (same_path_env(path_env, cache->path_env))
+        return;
+
+    clear_path_cache(cache);
+    free(cache->path_env);
+    cache->path_env = NULL;
+    if (path_env != NULL) {
+        cache->path_env = strdup(path_env);
+        CHECK_ALLOC(cache->path_env);
+    }
+}
+
+static char *search_path(const char *path_env, const char *cmd) {
+    char full_path[PATH_MAX];
+    const size_t cmd_length = strlen(cmd);
+
+    const char *dir = path_env;
+    while (*dir != '\0') {
+        const char *separator = strchr(dir, ':');
+        const size_t dir_length =
+            separator ? (size_t)(separator - dir) : strlen(dir);
+
+        if (dir_length != 0 && dir_length + cmd_length + 2 <= PATH_MAX) {
+            memcpy(full_path, dir, dir_length);
+            full_path[dir_length] = '/';
+            memcpy(&full_path[dir_length + 1], cmd, cmd_length + 1);
+
+            if (access(full_path, X_OK) == 0) {
+                char *result = strdup(full_path);
+                CHECK_ALLOC(result);
+                return result;
+            }
+        }
+
+        if (separator == NULL)
+            break;
+        dir = separator + 1;
+    }
+    return NULL;
+}
+
+static struct PathCacheEntry *find_entry(const struct PathCache *cache,
+                                         const char *name, uint32_t hash) {
+    if (cache->bucket_count == 0)
+        return NULL;
+
+    struct PathCacheEntry *entry =
+        cache->buckets[hash & (cache->bucket_count - 1)];
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->name, name) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static struct PathCacheEntry *insert_entry(struct PathCache *cache,
+                                           const char *name, uint32_t hash,
+                                           char *path) {
+    if (cache->entry_count + 1 > cache->bucket_count / 4 * 3)
+        grow_buckets(cache);
+
+    struct PathCacheEntry *entry = malloc(sizeof(struct PathCacheEntry));
+    CHECK_ALLOC(entry);
+    *entry = (struct PathCacheEntry){
+        .name = strdup(name),
+        .path = path,
+        .hash = hash,
+        .hits = 0,
+    };
+    CHECK_ALLOC(entry->name);
+
+    struct PathCacheEntry **bucket =
+        &cache->buckets[hash & (cache->bucket_count - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    cache->entry_count++;
+    return entry;
+}
+
+static void grow_buckets(struct PathCache *cache) {
+    const int new_count = cache->bucket_count == 0 ? INITIAL_BUCKET_COUNT
+                                                   : cache->bucket_count * 2;
+    struct PathCacheEntry **buckets =
+        calloc(new_count, sizeof(struct PathCacheEntry *));
+    CHECK_ALLOC(buckets);
+
+    for (int i = 0; i < cache->bucket_count; ++i) {
+        struct PathCacheEntry *next;
+        for (struct PathCacheEntry *entry = cache->buckets[i]; entry != NULL;
+             entry = next) {
+            next = entry->next;
+            struct PathCacheEntry **bucket =
+                &buckets[entry->hash & (new_count - 1)];
+            entry->next = *bucket;
+            *bucket = entry;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = new_count;
+}
+
+static void free_entry(struct PathCacheEntry *entry) {
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
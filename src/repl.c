@@ -43,8 +43,8 @@ void run_repl(struct Repl* repl) {
             printf("\n");
 #endif
 
+            // the program goes with the arena on the next reset_parser
             run_program(&repl->vm, &program);
-            free_program(&program);
 
             if (repl->vm.exit) {
                 break;
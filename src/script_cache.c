@@ -0,0 +1,593 @@
+#include <cash/ast.h>
+#include <cash/builtin_table.h>
+#include <cash/colors.h>
+#include <cash/error.h>
+#include <cash/memory.h>
+#include <cash/parser/parser.h>
+#include <cash/script_cache.h>
+#include <cash/string.h>
+#include <cash/util.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "CASHPRG"
+#define CACHE_VERSION 3
+// every object in an image starts at a multiple of this, text is unaligned
+#define IMAGE_ALIGN 8
+
+extern bool repl_mode;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    // hash of the sizes of the AST structs, so that images written by a build
+    // with another layout are ignored
+    uint32_t layout;
+
+    // the script the image was compiled from
+    uint64_t script_dev;
+    uint64_t script_ino;
+    int64_t script_mtime_sec;
+    int64_t script_mtime_nsec;
+    uint64_t script_size;
+    uint64_t script_hash;
+
+    // the size of the whole file and the checksum of everything after the
+    // header
+    uint64_t image_size;
+    uint64_t checksum;
+    // offsets of the root Program and of the relocation table, an array of
+    // the 32-bit offsets of all the pointers in the image
+    uint64_t program;
+    uint64_t relocations;
+    uint64_t relocation_count;
+};
+
+// an image being written. Everything is addressed by offset, as `data` moves
+// when it grows
+struct Image {
+    char *data;
+    size_t size;
+    size_t capacity;
+
+    uint32_t *relocations;
+    int relocation_count;
+    int relocation_capacity;
+
+    // the script is copied in whole, and text that points into it is stored
+    // as an offset into the copy
+    const char *source;
+    size_t source_length;
+    size_t source_offset;
+};
+
+static uint64_t hash_bytes(const void *bytes, size_t length);
+static uint32_t layout_hash(void);
+static bool cache_file_path(const char *script, char *path, size_t size);
+static bool make_dirs(char *path);
+static char *read_script(const char *path, struct stat *st);
+static bool write_image(const char *path, const struct Image *image);
+
+static size_t image_alloc(struct Image *image, size_t size);
+static size_t image_alloc_aligned(struct Image *image, size_t size,
+                                  size_t align);
+static void put(struct Image *image, size_t at, const void *object,
+                size_t size);
+static void set_pointer(struct Image *image, size_t at, size_t target);
+static void set_text(struct Image *image, size_t at, const char *text,
+                     int length);
+static size_t add_program(struct Image *image, const struct Program *program);
+static void write_program(struct Image *image, size_t at,
+                          const struct Program *program);
+static void write_expr(struct Image *image, size_t at,
+                       const struct Expr *expr);
+static void write_command(struct Image *image, size_t at,
+                          const struct Command *command);
+static void write_string(struct Image *image, size_t at,
+                         const struct ShellString *string);
+
+int compile_script(const char *path) {
+    struct stat st;
+    char *source = read_script(path, &st);
+    if (source == NULL)
+        return EXIT_FAILURE;
+
+    struct Parser parser = parser_new(source, false);
+    if (!parse_program(&parser)) {
+        free_parser(&parser);
+        free(source);
+        return EXIT_FAILURE;
+    }
+
+    struct Image image = {
+        .data = NULL,
+        .size = 0,
+        .capacity = 0,
+        .relocations = NULL,
+        .relocation_count = 0,
+        .relocation_capacity = 0,
+        .source = source,
+        .source_length = (size_t)st.st_size,
+        .source_offset = 0,
+    };
+    image_alloc(&image, sizeof(struct CacheHeader));
+    image.source_offset =
+        image_alloc_aligned(&image, image.source_length + 1, 1);
+    memcpy(&image.data[image.source_offset], source, image.source_length);
+
+    const size_t program = add_program(&image, &parser.program);
+    const size_t relocations = image_alloc(
+        &image, image.relocation_count * sizeof(*image.relocations));
+    memcpy(&image.data[relocations], image.relocations,
+           image.relocation_count * sizeof(*image.relocations));
+
+    const size_t header_size = sizeof(struct CacheHeader);
+    const struct CacheHeader header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .layout = layout_hash(),
+        .script_dev = st.st_dev,
+        .script_ino = st.st_ino,
+        .script_mtime_sec = st.st_mtim.tv_sec,
+        .script_mtime_nsec = st.st_mtim.tv_nsec,
+        .script_size = image.source_length,
+        .script_hash = hash_bytes(source, image.source_length),
+        .image_size = image.size,
+        .checksum =
+            hash_bytes(&image.data[header_size], image.size - header_size),
+        .program = program,
+        .relocations = relocations,
+        .relocation_count = image.relocation_count,
+    };
+    memcpy(image.data, &header, sizeof(header));
+
+    char cache_path[PATH_MAX];
+    bool written = false;
+    if (image.size > UINT32_MAX) {
+        CASH_ERROR(EXIT_FAILURE, "%s is too large to compile\n", path);
+    } else if (!cache_file_path(path, cache_path, sizeof(cache_path))) {
+        CASH_ERROR(EXIT_FAILURE,
+                   "no cache directory for %s, set CASH_CACHE_DIR or HOME\n",
+                   path);
+    } else {
+        written = write_image(cache_path, &image);
+    }
+
+    free(image.data);
+    free(image.relocations);
+    free_parser(&parser);
+    free(source);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool load_cached_program(const char *path, const struct stat *st,
+                         const char *contents, size_t size,
+                         struct CachedProgram *cached) {
+    char cache_path[PATH_MAX];
+    if (!cache_file_path(path, cache_path, sizeof(cache_path)))
+        return false;
+
+    const int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    struct stat image_st;
+    if (fstat(fd, &image_st) == -1 ||
+        (size_t)image_st.st_size < sizeof(struct CacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    // a private writable mapping, the relocations only change our copy
+    const size_t image_size = (size_t)image_st.st_size;
+    char *image = mmap(NULL, image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return false;
+
+    // the cheap checks first, the hashes read all of both files
+    const size_t header_size = sizeof(struct CacheHeader);
+    const struct CacheHeader *header = (const struct CacheHeader *)image;
+    const bool valid =
+        memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == CACHE_VERSION && header->layout == layout_hash() &&
+        header->script_dev == st->st_dev && header->script_ino == st->st_ino &&
+        header->script_mtime_sec == st->st_mtim.tv_sec &&
+        header->script_mtime_nsec == st->st_mtim.tv_nsec &&
+        header->script_size == size && header->image_size == image_size &&
+        header->program >= header_size &&
+        header->program + sizeof(struct Program) <= image_size &&
+        header->relocations >= header_size &&
+        header->relocations <= image_size &&
+        header->relocation_count <=
+            (image_size - header->relocations) / sizeof(uint32_t) &&
+        header->checksum ==
+            hash_bytes(&image[header_size], image_size - header_size) &&
+        header->script_hash == hash_bytes(contents, size);
+    if (!valid) {
+        munmap(image, image_size);
+        return false;
+    }
+
+    const uint32_t *relocations = (uint32_t *)&image[header->relocations];
+    for (uint64_t i = 0; i < header->relocation_count; ++i) {
+        if (relocations[i] < header_size ||
+            relocations[i] > image_size - sizeof(uintptr_t)) {
+            munmap(image, image_size);
+            return false;
+        }
+        uintptr_t *pointer = (uintptr_t *)&image[relocations[i]];
+        *pointer += (uintptr_t)image;
+    }
+
+    *cached = (struct CachedProgram){
+        .image = image,
+        .size = image_size,
+        .program = (const struct Program *)&image[header->program],
+    };
+    return true;
+}
+
+void unload_cached_program(const struct CachedProgram *cached) {
+    munmap(cached->image, cached->size);
+}
+
+// FNV-1a over 8-byte words instead of bytes, with a shift that carries the
+// high bits of every step down. Images are tens of megabytes and are hashed on
+// every run, so this has to be much faster than FNV proper; it only has to
+// tell versions of a file apart
+static uint64_t hash_bytes(const void *bytes, size_t length) {
+    const unsigned char *p = bytes;
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &p[i], sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < length; ++i)
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    return hash;
+}
+
+static uint32_t layout_hash(void) {
+    const size_t sizes[] = {
+        sizeof(void *),
+        sizeof(struct Program),
+        sizeof(struct Stmt),
+        sizeof(struct Expr),
+        sizeof(struct ListItem),
+        sizeof(struct Command),
+        sizeof(struct Redirection),
+        sizeof(struct ShellString),
+        sizeof(struct StringComponent),
+        // commands store the index of their builtin
+        BUILTIN_TABLE_HASH,
+    };
+    return (uint32_t)hash_bytes(sizes, sizeof(sizes));
+}
+
+// the image of a script is named after the hash of its real path
+static bool cache_file_path(const char *script, char *path, size_t size) {
+    char real_path[PATH_MAX];
+    if (realpath(script, real_path) == NULL)
+        return false;
+
+    const char *dir = getenv("CASH_CACHE_DIR");
+    const char *suffix = "";
+    if (dir == NULL || *dir == '\0') {
+        dir = getenv("XDG_CACHE_HOME");
+        suffix = "/cash";
+    }
+    if (dir == NULL || *dir == '\0') {
+        dir = getenv("HOME");
+        suffix = "/.cache/cash";
+    }
+    if (dir == NULL || *dir == '\0')
+        return false;
+
+    const int n = snprintf(path, size, "%s%s/%016llx.cashc", dir, suffix,
+                           (unsigned long long)hash_bytes(
+                               real_path, strlen(real_path)));
+    return n > 0 && (size_t)n < size;
+}
+
+// creates the directories leading to the file `path`
+static bool make_dirs(char *path) {
+    for (char *slash = strchr(path + 1, '/'); slash != NULL;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        const bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!made) {
+            CASH_PERROR(EXIT_FAILURE, "mkdir",
+                        "could not create cache directory for " BOLD WHITE
+                        "%s",
+                        path);
+            return false;
+        }
+    }
+    return true;
+}
+
+static char *read_script(const char *path, struct stat *st) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, st) == -1) {
+        CASH_PERROR(EXIT_FAILURE, "open",
+                    "could not read file " BOLD WHITE "%s", path);
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(st->st_mode)) {
+        CASH_ERROR(EXIT_FAILURE, "only regular files can be compiled: %s\n",
+                   path);
+        close(fd);
+        return NULL;
+    }
+
+    char *source = read_whole_file(fd, (size_t)st->st_size);
+    if (source == NULL) {
+        CASH_PERROR(EXIT_FAILURE, "read",
+                    "could not read file " BOLD WHITE "%s", path);
+    }
+    close(fd);
+    return source;
+}
+
+// writes to a temporary file that is renamed over `path`, so that a script
+// being run never sees a half-written image
+static bool write_image(const char *path, const struct Image *image) {
+    char temp_path[PATH_MAX + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    if (!make_dirs(temp_path))
+        return false;
+
+    const int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        CASH_PERROR(EXIT_FAILURE, "mkstemp",
+                    "could not write " BOLD WHITE "%s", path);
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < image->size) {
+        const ssize_t n = write(fd, &image->data[done], image->size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            CASH_PERROR(EXIT_FAILURE, "write",
+                        "could not write " BOLD WHITE "%s", path);
+            close(fd);
+            unlink(temp_path);
+            return false;
+        }
+        done += (size_t)n;
+    }
+
+    if (close(fd) == -1 || rename(temp_path, path) == -1) {
+        CASH_PERROR(EXIT_FAILURE, "rename",
+                    "could not write " BOLD WHITE "%s", path);
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+// returns the offset of `size` new zeroed bytes
+static size_t image_alloc(struct Image *image, size_t size) {
+    return image_alloc_aligned(image, size, IMAGE_ALIGN);
+}
+
+static size_t image_alloc_aligned(struct Image *image, size_t size,
+                                  size_t align) {
+    const size_t at = (image->size + align - 1) & ~(align - 1);
+    if (at + size > image->capacity) {
+        size_t capacity = image->capacity == 0 ? 4096 : image->capacity * 2;
+        while (capacity < at + size)
+            capacity *= 2;
+        image->data = realloc(image->data, capacity);
+        CHECK_ALLOC(image->data);
+        image->capacity = capacity;
+    }
+    memset(&image->data[image->size], 0, at + size - image->size);
+    image->size = at + size;
+    return at;
+}
+
+static void put(struct Image *image, size_t at, const void *object,
+                size_t size) {
+    memcpy(&image->data[at], object, size);
+}
+
+// stores `target` in the pointer at `at`, where 0 is NULL
+static void set_pointer(struct Image *image, size_t at, size_t target) {
+    const uintptr_t value = target;
+    memcpy(&image->data[at], &value, sizeof(value));
+    if (target != 0) {
+        ADD_LIST(image, relocation_count, relocation_capacity, relocations,
+                 (uint32_t)at, uint32_t);
+    }
+}
+
+// text that isn't a view of the script, such as the values of static words,
+// gets its own NUL-terminated copy
+static void set_text(struct Image *image, size_t at, const char *text,
+                     int length) {
+    if (text == NULL) {
+        set_pointer(image, at, 0);
+    } else if (text >= image->source &&
+               text + length <= image->source + image->source_length) {
+        set_pointer(image, at, image->source_offset + (text - image->source));
+    } else {
+        const size_t copy = image_alloc_aligned(image, (size_t)length + 1, 1);
+        memcpy(&image->data[copy], text, length);
+        set_pointer(image, at, copy);
+    }
+}
+
+static size_t add_program(struct Image *image, const struct Program *program) {
+    if (program == NULL)
+        return 0;
+    const size_t at = image_alloc(image, sizeof(struct Program));
+    write_program(image, at, program);
+    return at;
+}
+
+// each write_* copies an object to `at`, then writes what it points to and
+// replaces its pointers with offsets
+static void write_program(struct Image *image, size_t at,
+                          const struct Program *program) {
+    put(image, at, program, sizeof(*program));
+
+    size_t statements = 0;
+    if (program->statement_count != 0) {
+        statements = image_alloc(
+            image, program->statement_count * sizeof(struct Stmt));
+    }
+    for (int i = 0; i < program->statement_count; ++i) {
+        write_expr(image,
+                   statements + i * sizeof(struct Stmt) +
+                       offsetof(struct Stmt, expr),
+                   &program->statements[i].expr);
+    }
+    set_pointer(image, at + offsetof(struct Program, statements), statements);
+}
+
+static void write_expr(struct Image *image, size_t at,
+                       const struct Expr *expr) {
+    put(image, at, expr, sizeof(*expr));
+    set_text(image, at + offsetof(struct Expr, expr_text.string),
+             expr->expr_text.string, expr->expr_text.length);
+
+    switch (expr->type) {
+        case EXPR_SUBSHELL:
+            set_pointer(image, at + offsetof(struct Expr, subshell),
+                        add_program(image, expr->subshell));
+            break;
+
+        case EXPR_COMMAND:
+            write_command(image, at + offsetof(struct Expr, command),
+                          &expr->command);
+            break;
+
+        case EXPR_PIPELINE: {
+            const struct Pipeline *pipeline = &expr->pipeline;
+            const size_t stages = image_alloc(
+                image, pipeline->stage_count * sizeof(struct Expr));
+            for (int i = 0; i < pipeline->stage_count; ++i) {
+                write_expr(image, stages + i * sizeof(struct Expr),
+                           &pipeline->stages[i]);
+            }
+            set_pointer(image, at + offsetof(struct Expr, pipeline.stages),
+                        stages);
+            break;
+        }
+
+        case EXPR_NOT: {
+            const size_t negated = image_alloc(image, sizeof(struct Expr));
+            write_expr(image, negated, expr->negated);
+            set_pointer(image, at + offsetof(struct Expr, negated), negated);
+            break;
+        }
+
+        case EXPR_TIME: {
+            const size_t timed = image_alloc(image, sizeof(struct Expr));
+            write_expr(image, timed, expr->timed.expr);
+            set_pointer(image, at + offsetof(struct Expr, timed.expr), timed);
+            break;
+        }
+
+        case EXPR_AND_OR: {
+            const struct AndOrList *list = &expr->and_or;
+            const size_t items =
+                image_alloc(image, list->item_count * sizeof(struct ListItem));
+            for (int i = 0; i < list->item_count; ++i) {
+                const size_t item = items + i * sizeof(struct ListItem);
+                put(image, item, &list->items[i], sizeof(struct ListItem));
+                write_expr(image, item + offsetof(struct ListItem, expr),
+                           &list->items[i].expr);
+            }
+            set_pointer(image, at + offsetof(struct Expr, and_or.items),
+                        items);
+            break;
+        }
+    }
+}
+
+static void write_command(struct Image *image, size_t at,
+                          const struct Command *command) {
+    put(image, at, command, sizeof(*command));
+    write_string(image, at + offsetof(struct Command, command_name),
+                 &command->command_name);
+
+    const struct ArgumentList *arguments = &command->arguments;
+    size_t words = 0;
+    if (arguments->argument_count != 0) {
+        words = image_alloc(
+            image, arguments->argument_count * sizeof(struct ShellString));
+    }
+    for (int i = 0; i < arguments->argument_count; ++i) {
+        write_string(image, words + i * sizeof(struct ShellString),
+                     &arguments->arguments[i]);
+    }
+    set_pointer(image, at + offsetof(struct Command, arguments.arguments),
+                words);
+
+    size_t redirections = 0;
+    if (command->redirection_count != 0) {
+        redirections = image_alloc(
+            image, command->redirection_count * sizeof(struct Redirection));
+    }
+    for (int i = 0; i < command->redirection_count; ++i) {
+        const size_t redirection =
+            redirections + i * sizeof(struct Redirection);
+        put(image, redirection, &command->redirections[i],
+            sizeof(struct Redirection));
+        write_string(image,
+                     redirection + offsetof(struct Redirection, file_name),
+                     &command->redirections[i].file_name);
+    }
+    set_pointer(image, at + offsetof(struct Command, redirections),
+                redirections);
+}
+
+static void write_string(struct Image *image, size_t at,
+                         const struct ShellString *string) {
+    put(image, at, string, sizeof(*string));
+    set_text(image, at + offsetof(struct ShellString, static_value),
+             string->static_value, string->static_length);
+
+    size_t components = 0;
+    if (string->component_count != 0) {
+        components = image_alloc(
+            image, string->component_count * sizeof(struct StringComponent));
+    }
+    for (int i = 0; i < string->component_count; ++i) {
+        const struct StringComponent *component = &string->components[i];
+        const size_t copy = components + i * sizeof(struct StringComponent);
+        put(image, copy, component, sizeof(*component));
+        if (component->type == STRING_COMPONENT_COMMAND_SUBSTITUTION) {
+            set_pointer(
+                image,
+                copy + offsetof(struct StringComponent, command_substitution),
+                add_program(image, component->command_substitution));
+        } else {
+            set_text(image, copy + offsetof(struct StringComponent, literal),
+                     component->literal, component->length);
+        }
+    }
+    set_pointer(image, at + offsetof(struct ShellString, components),
+                components);
+}
@@ -0,0 +1,506 @@
+#include <cash/error.h>
+#include <cash/job_control.h>
+#include <cash/memory.h>
+#include <cash/parser/parser.h>
+#include <cash/source_cache.h>
+#include <cash/util.h>
+#include <cash/vm.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INITIAL_PROBE_BUCKET_COUNT 32
+
+extern bool repl_mode;
+
+static struct SourceCacheEntry *load_file(struct SourceCache *cache,
+                                          const char *path, bool *hit);
+static struct SourceCacheEntry *parse_file(struct SourceCache *cache,
+                                           const char *path, int fd,
+                                           const struct stat *st,
+                                           const char *caller);
+static struct SourceCacheEntry *parse_script(struct SourceCache *cache,
+                                             const char *path, int fd,
+                                             const struct stat *st);
+static bool probe_file(struct SourceCache *cache, const char *path,
+                       uint32_t hash, struct SourceCacheEntry **script);
+static bool names_cash(const char *shebang);
+static uint32_t hash_path(const char *path);
+static struct ScriptProbe *find_probe(const struct SourceCache *cache,
+                                      const char *path, uint32_t hash);
+static void record_probe(struct SourceCache *cache, const char *path,
+                         uint32_t hash, enum ScriptKind kind,
+                         const struct stat *st);
+static bool probe_is_current(const struct ScriptProbe *probe,
+                             const struct stat *st);
+static void grow_probe_buckets(struct SourceCache *cache);
+static struct SourceCacheEntry *find_entry(const struct SourceCache *cache,
+                                           const struct stat *st);
+static bool is_current(const struct SourceCacheEntry *entry,
+                       const struct stat *st);
+static void retire_entry(struct SourceCache *cache,
+                         struct SourceCacheEntry *entry);
+static void remove_entry(struct SourceCache *cache,
+                         struct SourceCacheEntry *entry);
+static void free_entry(struct SourceCacheEntry *entry);
+static void list_sourced_files(const struct SourceCache *cache);
+
+struct SourceCache make_source_cache(void) {
+    return (struct SourceCache){.entries = NULL,
+                                .hits = 0,
+                                .misses = 0,
+                                .probes = NULL,
+                                .probe_bucket_count = 0,
+                                .probe_count = 0};
+}
+
+void free_source_cache(const struct SourceCache *cache) {
+    struct SourceCacheEntry *next;
+    for (struct SourceCacheEntry *entry = cache->entries; entry != NULL;
+         entry = next) {
+        next = entry->next;
+        free_entry(entry);
+    }
+
+    for (int i = 0; i < cache->probe_bucket_count; ++i) {
+        struct ScriptProbe *next;
+        for (struct ScriptProbe *probe = cache->probes[i]; probe != NULL;
+             probe = next) {
+            next = probe->next;
+            free(probe->path);
+            free(probe);
+        }
+    }
+    free(cache->probes);
+}
+
+// runs the file in the shell itself, so that what it does to the shell stays.
+// Arguments after the file name replace $1, $2, ... while it runs
+int source_file(struct Vm *vm, const struct RawCommand *raw_command) {
+    const char *name = raw_command->args[0];
+    int first = 1;
+    bool verbose = false;
+    if (first < raw_command->args_count &&
+        strcmp(raw_command->args[first], "-v") == 0) {
+        verbose = true;
+        first++;
+    }
+
+    if (first == raw_command->args_count) {
+        if (verbose) {
+            list_sourced_files(&vm->source_cache);
+            return 0;
+        }
+        CASH_NONFATAL_ERROR("%s: filename argument required\n", name);
+        return 2;
+    }
+
+    const char *path = raw_command->args[first];
+    bool hit;
+    struct SourceCacheEntry *entry = load_file(&vm->source_cache, path, &hit);
+    if (entry == NULL)
+        return EXIT_FAILURE;
+    if (verbose)
+        fprintf(stderr, "%s: %s: %s\n", name, path, hit ? "hit" : "miss");
+
+    const int argc = vm->argc;
+    char **argv = vm->argv;
+    char **arguments = NULL;
+    if (first + 1 < raw_command->args_count) {
+        // $0 stays the one of the shell
+        const int count = raw_command->args_count - first - 1;
+        arguments = malloc((count + 2) * sizeof(char *));
+        CHECK_ALLOC(arguments);
+        arguments[0] = argv[0];
+        memcpy(&arguments[1], &raw_command->args[first + 1],
+               count * sizeof(char *));
+        arguments[count + 1] = NULL;
+        vm->argc = count;
+        vm->argv = arguments;
+    }
+
+    // the shell goes on after the file, so nothing in it can replace the shell
+    const bool exec_tail = vm->exec_tail;
+    vm->exec_tail = false;
+    entry->running++;
+    const int status = run_program(vm, &entry->parser.program);
+    entry->running--;
+    vm->exec_tail = exec_tail;
+    vm->argc = argc;
+    vm->argv = argv;
+    free(arguments);
+
+    if (entry->stale && entry->running == 0)
+        remove_entry(&vm->source_cache, entry);
+    return status;
+}
+
+// the entry for the file at `path`, parsed again only if the file changed
+// since it was last sourced. A hit costs a stat
+static struct SourceCacheEntry *load_file(struct SourceCache *cache,
+                                          const char *path, bool *hit) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        struct SourceCacheEntry *entry = find_entry(cache, &st);
+        if (entry != NULL && is_current(entry, &st)) {
+            entry->hits++;
+            cache->hits++;
+            *hit = true;
+            return entry;
+        }
+    }
+    *hit = false;
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        CASH_NONFATAL_ERROR("source: %s: %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        CASH_NONFATAL_ERROR("source: %s: not a regular file\n", path);
+        close(fd);
+        return NULL;
+    }
+    struct SourceCacheEntry *entry = parse_file(cache, path, fd, &st, "source");
+    close(fd);
+    return entry;
+}
+
+// whether the file at `path` is a script cash can run itself in a fork of the
+// shell, instead of exec'ing a new cash for it: its `#!` line names cash, or it
+// has none and is known to the cache, which means it ran as a script before
+// (see load_cash_script). `script` is set to its entry, or to NULL if it has a
+// syntax error, which was reported.
+// The file is read the first time only. After that, one that is no script for
+// cash costs nothing: should it become one, the kernel still runs it with cash.
+// A script costs a stat, to find out whether its parse is still current
+bool find_cash_script(struct SourceCache *cache, const char *path,
+                      struct SourceCacheEntry **script) {
+    *script = NULL;
+    const uint32_t hash = hash_path(path);
+    const struct ScriptProbe *probe = find_probe(cache, path, hash);
+    if (probe != NULL && probe->kind == SCRIPT_NONE)
+        return false;
+
+    struct stat st;
+    if (probe != NULL && stat(path, &st) == 0 && probe_is_current(probe, &st)) {
+        struct SourceCacheEntry *entry = find_entry(cache, &st);
+        if (entry != NULL && is_current(entry, &st)) {
+            *script = entry;
+            return true;
+        }
+        if (probe->kind == SCRIPT_PLAIN)
+            return false;
+    }
+    return probe_file(cache, path, hash, script);
+}
+
+// reads the first line of the file at `path` for find_cash_script, parses it
+// if it is a cash script, and records the verdict
+static bool probe_file(struct SourceCache *cache, const char *path,
+                       uint32_t hash, struct SourceCacheEntry **script) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    char head[256];
+    ssize_t length = -1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return false;
+    }
+    if (S_ISREG(st.st_mode))
+        length = read(fd, head, sizeof(head) - 1);
+
+    enum ScriptKind kind = SCRIPT_NONE;
+    if (length >= 2 && head[0] == '#' && head[1] == '!') {
+        head[length] = '\0';
+        if (names_cash(head + 2))
+            kind = SCRIPT_CASH;
+    } else if (length >= 0 &&
+               !(length >= 4 && memcmp(head, "\177ELF", 4) == 0)) {
+        kind = SCRIPT_PLAIN;
+    }
+    record_probe(cache, path, hash, kind, &st);
+
+    bool found = false;
+    if (kind == SCRIPT_CASH) {
+        found = true;
+        *script = find_entry(cache, &st);
+        if (*script == NULL || !is_current(*script, &st))
+            *script = lseek(fd, 0, SEEK_SET) == 0
+                          ? parse_script(cache, path, fd, &st)
+                          : NULL;
+    } else if (kind == SCRIPT_PLAIN) {
+        struct SourceCacheEntry *entry = find_entry(cache, &st);
+        if (entry != NULL && is_current(entry, &st)) {
+            found = true;
+            *script = entry;
+        }
+    }
+    close(fd);
+    return found;
+}
+
+// the entry of the file at `path`, which the kernel refused to exec with
+// ENOEXEC: a file without `#!` is a script for the shell that runs it
+struct SourceCacheEntry *load_cash_script(struct SourceCache *cache,
+                                          const char *path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        CASH_NONFATAL_ERROR("%s: %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    struct SourceCacheEntry *entry = find_entry(cache, &st);
+    if (entry == NULL || !is_current(entry, &st))
+        entry = parse_script(cache, path, fd, &st);
+    close(fd);
+    return entry;
+}
+
+// a script run as a command is a program of its own, so a syntax error in it
+// fails that command, where one in a sourced file is an error of the shell.
+// It is reported as in the REPL, without exiting
+static struct SourceCacheEntry *parse_script(struct SourceCache *cache,
+                                             const char *path, int fd,
+                                             const struct stat *st) {
+    const bool saved_repl_mode = repl_mode;
+    repl_mode = true;
+    struct SourceCacheEntry *entry = parse_file(cache, path, fd, st, path);
+    repl_mode = saved_repl_mode;
+    return entry;
+}
+
+// reads and parses the open file `fd` into a new entry, which replaces the one
+// of an older version of the file. Errors are reported as `caller`'s
+static struct SourceCacheEntry *parse_file(struct SourceCache *cache,
+                                           const char *path, int fd,
+                                           const struct stat *st,
+                                           const char *caller) {
+    char *text = read_whole_file(fd, (size_t)st->st_size);
+    if (text == NULL) {
+        CASH_NONFATAL_ERROR("%s: %s: %s\n", caller, path, strerror(errno));
+        return NULL;
+    }
+
+    struct Parser parser = parser_new(text, false);
+    if (!parse_program(&parser)) {
+        free_parser(&parser);
+        free(text);
+        return NULL;
+    }
+
+    struct SourceCacheEntry *entry = malloc(sizeof(struct SourceCacheEntry));
+    CHECK_ALLOC(entry);
+    *entry = (struct SourceCacheEntry){
+        .next = NULL,
+        .path = strdup(path),
+        .dev = st->st_dev,
+        .ino = st->st_ino,
+        .mtime = st->st_mtim,
+        .size = st->st_size,
+        .parser = parser,
+        .text = text,
+        .hits = 0,
+        .misses = 1,
+        .running = 0,
+        .stale = false,
+    };
+    CHECK_ALLOC(entry->path);
+    cache->misses++;
+
+    // the counts of a file carry over to its new version
+    struct SourceCacheEntry *old = find_entry(cache, st);
+    if (old != NULL) {
+        entry->hits = old->hits;
+        entry->misses += old->misses;
+        retire_entry(cache, old);
+    }
+    entry->next = cache->entries;
+    cache->entries = entry;
+    return entry;
+}
+
+// whether the interpreter of a `#!` line is cash, directly or through env.
+// A line that passes options to it is left to the kernel
+static bool names_cash(const char *shebang) {
+    char *words[3];
+    int count = 0;
+    const char *word = shebang;
+    while (count < 3) {
+        word += strspn(word, " \t");
+        const size_t length = strcspn(word, " \t\r\n");
+        if (length == 0)
+            break;
+        words[count++] = strndup(word, length);
+        CHECK_ALLOC(words[count - 1]);
+        word += length;
+    }
+
+    bool cash = false;
+    if (count > 0) {
+        const char *base = strrchr(words[0], '/');
+        base = base == NULL ? words[0] : base + 1;
+        if (count == 1)
+            cash = strcmp(base, "cash") == 0;
+        else if (count == 2 && strcmp(base, "env") == 0)
+            cash = strcmp(words[1], "cash") == 0;
+    }
+    for (int i = 0; i < count; ++i)
+        free(words[i]);
+    return cash;
+}
+
+// FNV-1a
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (; *path != '\0'; ++path) {
+        hash ^= (unsigned char)*path;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct ScriptProbe *find_probe(const struct SourceCache *cache,
+                                      const char *path, uint32_t hash) {
+    if (cache->probe_bucket_count == 0)
+        return NULL;
+
+    struct ScriptProbe *probe =
+        cache->probes[hash & (cache->probe_bucket_count - 1)];
+    for (; probe != NULL; probe = probe->next) {
+        if (probe->hash == hash && strcmp(probe->path, path) == 0)
+            return probe;
+    }
+    return NULL;
+}
+
+static void record_probe(struct SourceCache *cache, const char *path,
+                         uint32_t hash, enum ScriptKind kind,
+                         const struct stat *st) {
+    struct ScriptProbe *probe = find_probe(cache, path, hash);
+    if (probe == NULL) {
+        if (cache->probe_count + 1 > cache->probe_bucket_count / 4 * 3)
+            grow_probe_buckets(cache);
+
+        probe = malloc(sizeof(struct ScriptProbe));
+        CHECK_ALLOC(probe);
+        probe->path = strdup(path);
+        CHECK_ALLOC(probe->path);
+        probe->hash = hash;
+
+        struct ScriptProbe **bucket =
+            &cache->probes[hash & (cache->probe_bucket_count - 1)];
+        probe->next = *bucket;
+        *bucket = probe;
+        cache->probe_count++;
+    }
+    probe->kind = kind;
+    probe->dev = st->st_dev;
+    probe->ino = st->st_ino;
+    probe->mtime = st->st_mtim;
+    probe->size = st->st_size;
+}
+
+static bool probe_is_current(const struct ScriptProbe *probe,
+                             const struct stat *st) {
+    return probe->dev == st->st_dev && probe->ino == st->st_ino &&
+           probe->mtime.tv_sec == st->st_mtim.tv_sec &&
+           probe->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           probe->size == st->st_size;
+}
+
+static void grow_probe_buckets(struct SourceCache *cache) {
+    const int new_count = cache->probe_bucket_count == 0
+                              ? INITIAL_PROBE_BUCKET_COUNT
+                              : cache->probe_bucket_count * 2;
+    struct ScriptProbe **buckets =
+        calloc(new_count, sizeof(struct ScriptProbe *));
+    CHECK_ALLOC(buckets);
+
+    for (int i = 0; i < cache->probe_bucket_count; ++i) {
+        struct ScriptProbe *next;
+        for (struct ScriptProbe *probe = cache->probes[i]; probe != NULL;
+             probe = next) {
+            next = probe->next;
+            struct ScriptProbe **bucket =
+                &buckets[probe->hash & (new_count - 1)];
+            probe->next = *bucket;
+            *bucket = probe;
+        }
+    }
+
+    free(cache->probes);
+    cache->probes = buckets;
+    cache->probe_bucket_count = new_count;
+}
+
+static struct SourceCacheEntry *find_entry(const struct SourceCache *cache,
+                                           const struct stat *st) {
+    for (struct SourceCacheEntry *entry = cache->entries; entry != NULL;
+         entry = entry->next) {
+        if (!entry->stale && entry->dev == st->st_dev &&
+            entry->ino == st->st_ino)
+            return entry;
+    }
+    return NULL;
+}
+
+static bool is_current(const struct SourceCacheEntry *entry,
+                       const struct stat *st) {
+    return entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           entry->size == st->st_size;
+}
+
+// drops the entry of a file that changed. A file that is still running (it
+// sourced its new version) keeps its entry until it is done
+static void retire_entry(struct SourceCache *cache,
+                         struct SourceCacheEntry *entry) {
+    if (entry->running > 0)
+        entry->stale = true;
+    else
+        remove_entry(cache, entry);
+}
+
+static void remove_entry(struct SourceCache *cache,
+                         struct SourceCacheEntry *entry) {
+    for (struct SourceCacheEntry **link = &cache->entries; *link != NULL;
+         link = &(*link)->next) {
+        if (*link == entry) {
+            *link = entry->next;
+            free_entry(entry);
+            return;
+        }
+    }
+}
+
+static void free_entry(struct SourceCacheEntry *entry) {
+    free_parser(&entry->parser);
+    free(entry->text);
+    free(entry->path);
+    free(entry);
+}
+
+static void list_sourced_files(const struct SourceCache *cache) {
+    if (cache->entries != NULL)
+        printf("hits\tmisses\tfile\n");
+    for (const struct SourceCacheEntry *entry = cache->entries; entry != NULL;
+         entry = entry->next) {
+        if (!entry->stale)
+            printf("%4d\t%6d\t%s\n", entry->hits, entry->misses, entry->path);
+    }
+    printf("source: %d hits, %d misses\n", cache->hits, cache->misses);
+}
@@ -0,0 +1,321 @@
+#include <cash/colors.h>
+#include <cash/error.h>
+#include <cash/memory.h>
+#include <cash/parser/parser.h>
+#include <cash/parser/scan.h>
+#include <cash/script_cache.h>
+#include <cash/stream.h>
+#include <cash/string.h>
+#include <cash/vm.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_SIZE 4096
+
+extern bool repl_mode;
+
+// tells whether the lines seen so far end between two statements. It only
+// tracks what can make a statement span lines, the parser does the rest
+struct StatementScanner {
+    char quote;  // the open quote, 0 outside of strings
+    int depth;   // open parentheses
+    bool continued;
+};
+
+// a Vm and a parser that runs statements as they come in
+struct Stream {
+    struct Vm vm;
+    struct Parser parser;
+    struct StatementScanner scanner;
+
+    // the text of the statements being read, NUL-terminated when run
+    char *text;
+    int length;
+    int capacity;
+};
+
+static struct Stream make_stream(int argc, char **argv);
+static int free_stream(struct Stream *stream);
+static bool scan_line(struct StatementScanner *scanner, const char *line,
+                      int length);
+static void run_statements(struct Stream *stream, const char *text,
+                           bool last);
+static void reserve(struct Stream *stream, int extra);
+static bool at_eof(int fd);
+static bool is_blank(const char *text, size_t length);
+static int run_mapped(const char *contents, size_t size, int argc,
+                      char **argv);
+static int run_cached(const struct Program *program, int argc, char **argv);
+
+int run_fd(int fd, int argc, char **argv) {
+    struct Stream stream = make_stream(argc, argv);
+    // start of the first line not scanned yet
+    int scanned = 0;
+    bool eof = false;
+
+    while (!eof) {
+        reserve(&stream, READ_SIZE + 1);
+        const ssize_t n = read(fd, &stream.text[stream.length], READ_SIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            CASH_PERROR(EXIT_FAILURE, "read", "could not read script%s\n", "");
+            break;
+        }
+        eof = n == 0;
+        stream.length += (int)n;
+
+        // end of the last line that finishes a statement
+        int complete = 0;
+        const char *newline;
+        while ((newline = memchr(&stream.text[scanned], '\n',
+                                 stream.length - scanned)) != NULL) {
+            const int end = (int)(newline - stream.text);
+            if (scan_line(&stream.scanner, &stream.text[scanned],
+                          end - scanned))
+                complete = end + 1;
+            scanned = end + 1;
+        }
+        // whatever is left at the end is all there is, the parser reports it
+        // if it is incomplete
+        if (eof)
+            complete = stream.length;
+        if (complete == 0)
+            continue;
+
+        const char next = stream.text[complete];
+        stream.text[complete] = '\0';
+        run_statements(&stream, stream.text,
+                       eof || (complete == stream.length && at_eof(fd)));
+        stream.text[complete] = next;
+
+        memmove(stream.text, &stream.text[complete], stream.length - complete);
+        stream.length -= complete;
+        scanned -= complete;
+    }
+
+    return free_stream(&stream);
+}
+
+int run_file(const char *path, int argc, char **argv) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        CASH_PERROR(EXIT_FAILURE, "open",
+                    "could not read file " BOLD WHITE "%s", path);
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        const int status = run_fd(fd, argc, argv);
+        close(fd);
+        return status;
+    }
+
+    char *contents =
+        mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (contents == MAP_FAILED) {
+        CASH_PERROR(EXIT_FAILURE, "mmap",
+                    "could not read file " BOLD WHITE "%s", path);
+        return EXIT_FAILURE;
+    }
+
+    int status;
+    struct CachedProgram cached;
+    if (load_cached_program(path, &st, contents, (size_t)st.st_size,
+                            &cached)) {
+        status = run_cached(cached.program, argc, argv);
+        unload_cached_program(&cached);
+    } else {
+        status = run_mapped(contents, (size_t)st.st_size, argc, argv);
+    }
+    munmap(contents, (size_t)st.st_size);
+    return status;
+}
+
+// the mapping can't be NUL-terminated in place, so every statement is copied
+// out of it before it is parsed. That keeps only one statement in memory at a
+// time while the kernel pages the file in
+static int run_mapped(const char *contents, size_t size, int argc,
+                      char **argv) {
+    struct Stream stream = make_stream(argc, argv);
+    size_t start = 0;
+    size_t scanned = 0;
+
+    while (scanned < size) {
+        const char *newline = memchr(&contents[scanned], '\n', size - scanned);
+        const size_t end = newline ? (size_t)(newline - contents) : size;
+        const bool complete = scan_line(&stream.scanner, &contents[scanned],
+                                        (int)(end - scanned));
+        scanned = newline ? end + 1 : size;
+        const bool last = is_blank(&contents[scanned], size - scanned);
+        if (!complete && !last)
+            continue;
+
+        stream.length = 0;
+        reserve(&stream, (int)(scanned - start) + 1);
+        memcpy(stream.text, &contents[start], scanned - start);
+        stream.text[scanned - start] = '\0';
+        run_statements(&stream, stream.text, last);
+        if (last)
+            break;
+        start = scanned;
+    }
+
+    return free_stream(&stream);
+}
+
+// a compiled script was parsed in full by `cash --compile`, so it runs as one
+// program
+static int run_cached(const struct Program *program, int argc, char **argv) {
+    struct Vm vm = make_vm(argc, argv);
+    vm.exec_tail = true;
+
+#ifndef NDEBUG
+    print_program(program, 0);
+#endif
+
+    const int status = run_program(&vm, program);
+    free_vm(&vm);
+    return status;
+}
+
+static struct Stream make_stream(int argc, char **argv) {
+    return (struct Stream){
+        .vm = make_vm(argc, argv),
+        .parser = parser_new("", false),
+        .scanner = {.quote = 0, .depth = 0, .continued = false},
+        .text = NULL,
+        .length = 0,
+        .capacity = 0,
+    };
+}
+
+static int free_stream(struct Stream *stream) {
+    const int status = stream->vm.previous_exit_code;
+    free_vm(&stream->vm);
+    free_parser(&stream->parser);
+    free(stream->text);
+    return status;
+}
+
+// feeds one line, without its newline, to the scanner and returns whether the
+// statements end with it
+static bool scan_line(struct StatementScanner *scanner, const char *line,
+                      int length) {
+    // the last two characters outside of strings that weren't blanks
+    char last = 0;
+    char before_last = 0;
+    bool escaped = false;
+
+    for (int i = 0; i < length; ++i) {
+        // quoted text can be long, skip to the next character that matters
+        if (scanner->quote == '\'')
+            i += scan_run(SCAN_SQ, &line[i], &line[length]);
+        else if (scanner->quote == '"' && !escaped)
+            i += scan_run(SCAN_DQ, &line[i], &line[length]);
+        if (i == length)
+            break;
+
+        const char c = line[i];
+        if (scanner->quote == '\'') {
+            if (c == '\'')
+                scanner->quote = 0;
+            continue;
+        }
+        if (escaped) {
+            escaped = false;
+            last = c;
+            continue;
+        }
+        if (c == '\\') {
+            escaped = true;
+            continue;
+        }
+        if (scanner->quote == '"') {
+            if (c == '"')
+                scanner->quote = 0;
+            continue;
+        }
+
+        switch (c) {
+            case '\'':
+            case '"':
+                scanner->quote = c;
+                break;
+            case '(':
+                scanner->depth++;
+                break;
+            case ')':
+                if (scanner->depth > 0)
+                    scanner->depth--;
+                break;
+            default:
+                break;
+        }
+        if (!isspace((unsigned char)c)) {
+            before_last = last;
+            last = c;
+        }
+    }
+
+    // a trailing backslash, `|`, `||` or `&&` carries on to the next line
+    scanner->continued =
+        escaped || last == '|' || (last == '&' && before_last == '&');
+    return scanner->quote == 0 && scanner->depth == 0 && !scanner->continued;
+}
+
+// `last` is set for the final statements of the script, whose last command may
+// replace the shell
+static void run_statements(struct Stream *stream, const char *text,
+                           bool last) {
+    reset_parser(text, &stream->parser);
+    if (!parse_program(&stream->parser)) {
+        stream->vm.previous_exit_code = EXIT_FAILURE;
+        return;
+    }
+
+#ifndef NDEBUG
+    print_program(&stream->parser.program, 0);
+#endif
+
+    stream->vm.exec_tail = last;
+    run_program(&stream->vm, &stream->parser.program);
+}
+
+static void reserve(struct Stream *stream, int extra) {
+    if (stream->length + extra <= stream->capacity)
+        return;
+
+    int capacity = stream->capacity == 0 ? READ_SIZE : stream->capacity * 2;
+    while (capacity < stream->length + extra)
+        capacity *= 2;
+    stream->text = grow_string(stream->text, capacity);
+    stream->capacity = capacity;
+}
+
+// whether the writer of the pipe `fd` is gone and nothing is left to read, so
+// the statements read so far are the last ones
+static bool at_eof(int fd) {
+    struct pollfd pollfd = {.fd = fd, .events = POLLIN, .revents = 0};
+    return poll(&pollfd, 1, 0) == 1 && (pollfd.revents & POLLHUP) &&
+           !(pollfd.revents & POLLIN);
+}
+
+static bool is_blank(const char *text, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (!isspace((unsigned char)text[i]))
+            return false;
+    }
+    return true;
+}
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <cash/arena.h>
 #include <cash/error.h>
 #include <cash/memory.h>
 #include <cash/string.h>
@@ -9,43 +10,53 @@
 
 extern bool repl_mode;
 
-static void add_component(struct ShellString *str,
+static const bool kIsEscapableInDQ[256] = {
+    ['"'] = true,
+    ['\\'] = true,
+    ['$'] = true,
+    ['`'] = true,
+};
+
+static void add_component(struct Arena *arena, struct ShellString *str,
                           struct StringComponent comp) {
-    ADD_LIST(str, component_count, component_capacity, components, comp,
-             struct StringComponent);
+    ARENA_ADD_LIST(arena, str, component_count, component_capacity, components,
+                   comp);
 }
 
 struct ShellString make_string(void) {
-    return (struct ShellString){
-        .component_capacity = 0, .component_count = 0, .components = NULL};
+    return (struct ShellString){.component_capacity = 0,
+                                .component_count = 0,
+                                .components = NULL,
+                                .static_value = NULL,
+                                .static_length = 0};
 }
 
-void add_string_literal(struct ShellString *str, enum StringComponentType type,
-                        const char *literal, int length, int escapes) {
+void add_string_literal(struct Arena *arena, struct ShellString *str,
+                        enum StringComponentType type, const char *literal,
+                        int length, int escapes) {
     assert(type == STRING_COMPONENT_LITERAL || type == STRING_COMPONENT_DQ ||
            type == STRING_COMPONENT_SQ);
-    add_component(str,
-                  (struct StringComponent){.literal = strndup(literal, length),
-                                           .type = type,
-                                           .length = length,
-                                           .escapes = escapes});
+    add_component(arena, str,
+                  (struct StringComponent){
+                      .literal = literal,
+                      .type = type,
+                      .length = length,
+                      .escapes = escapes});
 }
 
-void add_string_component(struct ShellString *str,
+void add_string_component(struct Arena *arena, struct ShellString *str,
                           enum StringComponentType type, const char *value,
                           int length) {
     assert(type == STRING_COMPONENT_BRACED_SUB ||
            type == STRING_COMPONENT_VAR_SUB ||
            type == STRING_COMPONENT_COMMAND_SUBSTITUTION);
-    char *val = strndup(value, length);
-
     struct StringComponent component;
     switch (type) {
         case STRING_COMPONENT_BRACED_SUB: {
             component = (struct StringComponent){
                 .type = type,
                 .length = length,
-                .braced_substitution = val,
+                .braced_substitution = value,
             };
             break;
         }
@@ -53,7 +64,7 @@ void add_string_component(struct ShellString *str,
             component = (struct StringComponent){
                 .type = type,
                 .length = length,
-                .var_substitution = val,
+                .var_substitution = value,
             };
             break;
         }
@@ -66,31 +77,77 @@ void add_string_component(struct ShellString *str,
         }
     }
 
-    add_component(str, component);
+    add_component(arena, str, component);
 }
 
-void free_string_component(const struct StringComponent *component) {
-    switch (component->type) {
-        case STRING_COMPONENT_BRACED_SUB:
-            free(component->braced_substitution);
-            break;
-        case STRING_COMPONENT_VAR_SUB:
-            free(component->var_substitution);
-            break;
-        case STRING_COMPONENT_LITERAL:
-        case STRING_COMPONENT_DQ:
-        case STRING_COMPONENT_SQ:
-            free(component->literal);
-            break;
-        case STRING_COMPONENT_COMMAND_SUBSTITUTION:
-            assert(false);
+// expands `str` once, at parse time, if nothing in it depends on the state of
+// the shell: no substitutions and no `~` (which expand_component expands at the
+// start of any unquoted component)
+void resolve_static_string(struct Arena *arena, struct ShellString *str) {
+    for (int i = 0; i < str->component_count; ++i) {
+        const struct StringComponent *component = &str->components[i];
+        switch (component->type) {
+            case STRING_COMPONENT_LITERAL:
+                if (component->literal[0] == '~')
+                    return;
+                break;
+            case STRING_COMPONENT_DQ:
+            case STRING_COMPONENT_SQ:
+                break;
+            default:
+                return;
+        }
     }
-}
 
-void free_shell_string(const struct ShellString *str) {
+    // unescaping never makes a component longer
+    int length = 0;
     for (int i = 0; i < str->component_count; ++i)
-        free_string_component(&str->components[i]);
-    free(str->components);
+        length += str->components[i].length;
+
+    char *value = arena_alloc(arena, length + 1);
+    length = 0;
+    for (int i = 0; i < str->component_count; ++i) {
+        const struct StringComponent *component = &str->components[i];
+        if (component->type == STRING_COMPONENT_SQ) {
+            memcpy(&value[length], component->literal, component->length);
+            length += component->length;
+        } else {
+            length += copy_unescaped(&value[length], component, 0);
+        }
+    }
+
+    value[length] = '\0';
+    str->static_value = value;
+    str->static_length = length;
+}
+
+// copies the text of an unquoted or double quoted component from `start` on to
+// `dest`, without the backslashes that quote the character after them. `dest`
+// needs room for `component->length - start` chars, the number of chars
+// written is returned
+int copy_unescaped(char *dest, const struct StringComponent *component,
+                   int start) {
+    const char *literal = component->literal;
+    int written = 0;
+    int i;
+    for (i = start; i < component->length; ++i) {
+        if (literal[i] != '\\')
+            continue;
+        // a trailing backslash is dropped
+        if (i + 1 == component->length)
+            break;
+        if (component->type == STRING_COMPONENT_DQ &&
+            !kIsEscapableInDQ[(unsigned char)literal[i + 1]])
+            continue;
+
+        memcpy(&dest[written], &literal[start], i - start);
+        written += i - start;
+        dest[written++] = literal[i + 1];
+        start = i + 2;
+        i++;
+    }
+    memcpy(&dest[written], &literal[start], i - start);
+    return written + i - start;
 }
 
 void free_string(const struct String *string) {
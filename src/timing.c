@@ -0,0 +1,313 @@
+#define _GNU_SOURCE  // open_memstream, timeradd
+
+#include <cash/error.h>
+#include <cash/job_control.h>
+#include <cash/memory.h>
+#include <cash/timing.h>
+#include <cash/vm.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+// bash's, with what /usr/bin/time calls %M, %w, %c, %I and %O added
+#define DEFAULT_TIMEFORMAT                                             \
+    "\nreal\t%3lR\nuser\t%3lU\nsys\t%3lS\nrss\t%M KB\ncsw\t%w voluntary, " \
+    "%c involuntary\nio\t%I blocks in, %O out"
+#define POSIX_TIMEFORMAT "real %2R\nuser %2U\nsys %2S"
+// past this many, the processes of a `time` only count towards its total
+#define MAX_TIMED_STAGES 64
+
+extern bool repl_mode;
+
+static void add_rusage(struct rusage *sum, const struct rusage *usage);
+static double timeval_seconds(struct timeval time);
+static struct timeval timeval_between(struct timeval from, struct timeval to);
+static void print_time_format(const char *format, double real,
+                              const struct rusage *usage, FILE *stream);
+static void print_seconds(double seconds, int precision, bool long_form,
+                          FILE *stream);
+static int compare_stages(const void *a, const void *b);
+static char *process_command(const struct Process *process, int *length);
+
+void start_timer(struct Vm *vm) {
+    struct Timer *timer = malloc(sizeof(struct Timer));
+    CHECK_ALLOC(timer);
+    *timer = (struct Timer){
+        .outer = vm->timer,
+        .stages = NULL,
+        .stage_count = 0,
+        .stage_capacity = 0,
+        .dropped_stages = 0,
+    };
+    clock_gettime(CLOCK_MONOTONIC, &timer->started);
+    getrusage(RUSAGE_SELF, &timer->self);
+    vm->timer = timer;
+}
+
+void stop_timer(struct Vm *vm, bool posix) {
+    struct Timer *timer = vm->timer;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+
+    vm->timer = timer->outer;
+    // a stopped job goes on under the `time` around this one, if any
+    for (struct Job *job = vm->jobs.list; job != NULL; job = job->next_job) {
+        if (job->timer == timer)
+            job->timer = timer->outer;
+    }
+
+    // what the shell itself used meanwhile, for its builtins, and then what
+    // its children did
+    struct rusage total = {0};
+    total.ru_utime = timeval_between(timer->self.ru_utime, self.ru_utime);
+    total.ru_stime = timeval_between(timer->self.ru_stime, self.ru_stime);
+    total.ru_nvcsw = self.ru_nvcsw - timer->self.ru_nvcsw;
+    total.ru_nivcsw = self.ru_nivcsw - timer->self.ru_nivcsw;
+    total.ru_inblock = self.ru_inblock - timer->self.ru_inblock;
+    total.ru_oublock = self.ru_oublock - timer->self.ru_oublock;
+    add_rusage(&total, &timer->children);
+
+    const char *format = posix ? POSIX_TIMEFORMAT : getenv("TIMEFORMAT");
+    // the stages only come with the default format, one that was asked for
+    // is probably read by something else
+    const bool show_stages = format == NULL && timer->stage_count > 1;
+    if (format == NULL)
+        format = DEFAULT_TIMEFORMAT;
+
+    char *text = NULL;
+    size_t length = 0;
+    FILE *stream = open_memstream(&text, &length);
+    CHECK_ALLOC(stream);
+    // an empty $TIMEFORMAT reports nothing, as in bash
+    if (*format != '\0') {
+        print_time_format(format, seconds_between(&timer->started, &now),
+                          &total, stream);
+        fputc('\n', stream);
+    }
+    if (show_stages) {
+        // in the order they were started, which for a pipeline is the order
+        // of its stages
+        qsort(timer->stages, timer->stage_count, sizeof(struct TimedStage),
+              compare_stages);
+        for (int i = 0; i < timer->stage_count; ++i) {
+            const struct TimedStage *stage = &timer->stages[i];
+            fputs("  ", stream);
+            print_usage(stage->real, &stage->usage, stream);
+            fprintf(stream, "  %s\n", stage->command);
+        }
+        if (timer->dropped_stages != 0)
+            fprintf(stream, "  and %d more\n", timer->dropped_stages);
+    }
+    fclose(stream);
+
+    // stderr is unbuffered, so this is a single write that doesn't interleave
+    // with the output of other jobs
+    fwrite(text, 1, length, stderr);
+    free(text);
+
+    timer->outer = NULL;
+    free_timers(timer);
+}
+
+void free_timers(struct Timer *timer) {
+    while (timer != NULL) {
+        struct Timer *outer = timer->outer;
+        for (int i = 0; i < timer->stage_count; ++i)
+            free(timer->stages[i].command);
+        free(timer->stages);
+        free(timer);
+        timer = outer;
+    }
+}
+
+void add_timed_process(struct Timer *timer, const struct Process *process) {
+    int length;
+    char *command = process_command(process, &length);
+    add_timed_usage(timer, command, length, &process->started,
+                    &process->ended, &process->usage);
+    free(command);
+}
+
+void add_timed_usage(struct Timer *timer, const char *command, int length,
+                     const struct timespec *started,
+                     const struct timespec *ended,
+                     const struct rusage *usage) {
+    for (; timer != NULL; timer = timer->outer) {
+        add_rusage(&timer->children, usage);
+        if (timer->stage_count == MAX_TIMED_STAGES) {
+            timer->dropped_stages++;
+            continue;
+        }
+
+        char *copy = malloc(length + 1);
+        CHECK_ALLOC(copy);
+        memcpy(copy, command, length);
+        copy[length] = '\0';
+        const struct TimedStage stage = {
+            .command = copy,
+            .started = *started,
+            .real = seconds_between(started, ended),
+            .usage = *usage,
+        };
+        ADD_LIST(timer, stage_count, stage_capacity, stages, stage,
+                 struct TimedStage);
+    }
+}
+
+// real, user and sys seconds, max RSS, voluntary/involuntary context switches
+// and blocks read/written
+void print_usage(double real, const struct rusage *usage, FILE *stream) {
+    fprintf(stream, "real %.3fs  user %.3fs  sys %.3fs  rss %ld KB  ", real,
+            timeval_seconds(usage->ru_utime), timeval_seconds(usage->ru_stime),
+            usage->ru_maxrss);
+    fprintf(stream, "csw %ld/%ld  io %ld/%ld", usage->ru_nvcsw,
+            usage->ru_nivcsw, usage->ru_inblock, usage->ru_oublock);
+}
+
+double seconds_between(const struct timespec *from,
+                       const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) +
+           (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void add_rusage(struct rusage *sum, const struct rusage *usage) {
+    timeradd(&sum->ru_utime, &usage->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &usage->ru_stime, &sum->ru_stime);
+    if (usage->ru_maxrss > sum->ru_maxrss)
+        sum->ru_maxrss = usage->ru_maxrss;
+    sum->ru_nvcsw += usage->ru_nvcsw;
+    sum->ru_nivcsw += usage->ru_nivcsw;
+    sum->ru_inblock += usage->ru_inblock;
+    sum->ru_oublock += usage->ru_oublock;
+}
+
+static double timeval_seconds(struct timeval time) {
+    return (double)time.tv_sec + (double)time.tv_usec / 1e6;
+}
+
+static struct timeval timeval_between(struct timeval from, struct timeval to) {
+    struct timeval difference;
+    timersub(&to, &from, &difference);
+    return difference;
+}
+
+// what bash does with $TIMEFORMAT: %[p][l]R, %[p][l]U and %[p][l]S are the
+// real, user and sys seconds, with p decimals (3 at most and by default) and
+// as minutes and seconds with l, %P is the CPU percentage and %% a `%`. %M,
+// %w, %c, %I and %O are as in /usr/bin/time
+static void print_time_format(const char *format, double real,
+                              const struct rusage *usage, FILE *stream) {
+    const double user = timeval_seconds(usage->ru_utime);
+    const double sys = timeval_seconds(usage->ru_stime);
+    for (const char *p = format; *p != '\0'; ++p) {
+        if (*p != '%') {
+            fputc(*p, stream);
+            continue;
+        }
+
+        p++;
+        int precision = 3;
+        if (*p >= '0' && *p <= '9') {
+            precision = *p - '0' < 3 ? *p - '0' : 3;
+            p++;
+        }
+        const bool long_form = *p == 'l';
+        if (long_form)
+            p++;
+
+        switch (*p) {
+            case 'R':
+                print_seconds(real, precision, long_form, stream);
+                break;
+            case 'U':
+                print_seconds(user, precision, long_form, stream);
+                break;
+            case 'S':
+                print_seconds(sys, precision, long_form, stream);
+                break;
+            case 'P':
+                fprintf(stream, "%.2f",
+                        real > 0 ? 100 * (user + sys) / real : 0.0);
+                break;
+            case 'M':
+                fprintf(stream, "%ld", usage->ru_maxrss);
+                break;
+            case 'w':
+                fprintf(stream, "%ld", usage->ru_nvcsw);
+                break;
+            case 'c':
+                fprintf(stream, "%ld", usage->ru_nivcsw);
+                break;
+            case 'I':
+                fprintf(stream, "%ld", usage->ru_inblock);
+                break;
+            case 'O':
+                fprintf(stream, "%ld", usage->ru_oublock);
+                break;
+            case '%':
+                fputc('%', stream);
+                break;
+            case '\0':
+                fputc('%', stream);
+                return;
+            default:
+                fputc('%', stream);
+                fputc(*p, stream);
+                break;
+        }
+    }
+}
+
+static void print_seconds(double seconds, int precision, bool long_form,
+                          FILE *stream) {
+    if (!long_form) {
+        fprintf(stream, "%.*f", precision, seconds);
+        return;
+    }
+    const long minutes = (long)(seconds / 60);
+    fprintf(stream, "%ldm%.*fs", minutes, precision, seconds - 60 * minutes);
+}
+
+static int compare_stages(const void *a, const void *b) {
+    const struct timespec *left = &((const struct TimedStage *)a)->started;
+    const struct timespec *right = &((const struct TimedStage *)b)->started;
+    if (left->tv_sec != right->tv_sec)
+        return left->tv_sec < right->tv_sec ? -1 : 1;
+    if (left->tv_nsec != right->tv_nsec)
+        return left->tv_nsec < right->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// the words of its command, or `(...)` for a subshell stage
+static char *process_command(const struct Process *process, int *length) {
+    const struct RawCommand *raw_command = &process->raw_command;
+    if (raw_command->args == NULL) {
+        *length = (int)strlen("(...)");
+        char *text = malloc(*length + 1);
+        CHECK_ALLOC(text);
+        memcpy(text, "(...)", *length + 1);
+        return text;
+    }
+
+    *length = 0;
+    for (int i = 0; i < raw_command->args_count; ++i)
+        *length += (int)strlen(raw_command->args[i]) + (i > 0);
+    char *text = malloc(*length + 1);
+    CHECK_ALLOC(text);
+    char *end = text;
+    for (int i = 0; i < raw_command->args_count; ++i) {
+        if (i > 0)
+            *end++ = ' ';
+        const size_t word_length = strlen(raw_command->args[i]);
+        memcpy(end, raw_command->args[i], word_length);
+        end += word_length;
+    }
+    *end = '\0';
+    return text;
+}
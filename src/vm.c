@@ -1,78 +1,157 @@
+#define _GNU_SOURCE  // pipe2
+
 #include <assert.h>
+#include <cash/arena.h>
 #include <cash/ast.h>
+#include <cash/builtin_table.h>
+#include <cash/builtins.h>
+#include <cash/compiler.h>
 #include <cash/error.h>
 #include <cash/job_control.h>
 #include <cash/memory.h>
+#include <cash/parallel.h>
+#include <cash/path_cache.h>
 #include <cash/string.h>
+#include <cash/timing.h>
 #include <cash/util.h>
 #include <cash/vm.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <linux/limits.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-#define CHECK_ALLOC(ptr)                                                  \
-    do {                                                                  \
-        if (!(ptr)) {                                                     \
-            CASH_ERROR(EXIT_FAILURE, "Memory allocation failed%s\n", ""); \
-            exit(EXIT_FAILURE);                                           \
-        }                                                                 \
-    } while (0)
+// "-2147483648"
+#define MAX_INT_DIGITS 11
 
 extern bool repl_mode;
+extern bool dump_bytecode;
 extern char **environ;
 
-static void make_process(struct Vm *vm, const struct Command *command,
-                         struct Process *process);
-static int make_process_list(struct Vm *vm, const struct Expr *expr,
-                             struct Process ***process_list);
-static int make_job(struct Vm *vm, const struct Expr *expr, struct Job *job);
+// an expanded word, borrowed from the AST if it is static and in the arena of
+// the command otherwise. Neither is freed on its own
+struct Word {
+    char *string;
+    int length;
+};
 
-static struct RawRedirection get_redirection(const struct Vm *vm,
-                                             const struct Redirection *redir);
-static int get_final_command(const struct Vm *vm, const struct Command *command,
-                             struct RawCommand *raw_command);
+// a word being expanded, see expand_word
+struct ExpansionBuffer {
+    struct Arena *arena;
+    char *string;
+    int length;
+    int capacity;
+};
 
-static int exec_expression(struct Vm *vm, struct Expr *expr);
-static int run_command(struct Vm *vm, struct Expr *expr);
-static int run_subshell(struct Vm *vm, struct Program *program);
+// registers of the dispatch loop in run_chunk
+struct Frame {
+    // expanded words waiting for OP_BUILD_ARGV
+    struct Word *words;
+    int word_count;
+    int word_capacity;
+
+    // built by OP_BUILD_ARGV, or its exit status if that failed
+    struct RawCommand command;
+    int command_status;
+
+    // where expanded words and the command built from them go: the arena of
+    // the job while a pipeline is started, `scratch` otherwise. `scratch` is
+    // reset after every simple command, or handed over to its job
+    struct Arena *arena;
+    struct Arena scratch;
+
+    // pipeline being started by OP_SPAWN
+    struct Job *job;
+    struct Process **next_process;
+    bool foreground;
+    int in;        // stdin of the next stage
+    int pipe_out;  // write end of the pipe opened by OP_PIPE, or -1
+    int pipe_in;   // read end of that pipe, stdin of the stage after it
+};
 
-static struct String expand_component(const struct Vm *vm,
-                                      const struct StringComponent *component);
-static struct String to_string(const struct Vm *vm,
+static void run_chunk(struct Vm *vm, const struct Chunk *chunk);
+static void run_command(struct Vm *vm, struct Frame *frame,
+                        const struct Instruction *instruction);
+static void begin_job(struct Vm *vm, struct Frame *frame,
+                      const struct Expr *expr);
+static void spawn_stage(struct Vm *vm, struct Frame *frame,
+                        const struct Chunk *subshell);
+static void wait_for_stages(struct Vm *vm, struct Frame *frame);
+static void run_subshell(struct Vm *vm, const struct Chunk *body, bool tail);
+static bool can_elide_subshell(struct Vm *vm, const struct Program *program);
+static bool runs_in_child(struct Vm *vm, const struct Expr *expr);
+static int run_builtin(struct Vm *vm, int builtin,
+                       const struct RawCommand *raw_command);
+
+static struct Job *make_expr_job(const struct Vm *vm,
+                                 const struct Expr *expr,
+                                 struct Arena *arena);
+
+static struct RawRedirection get_redirection(const struct Redirection *redir,
+                                             char *file_name);
+static int get_final_command(struct Vm *vm, struct Arena *arena,
+                             const struct Command *command,
+                             const struct Word *words,
+                             struct RawCommand *raw_command);
+static struct Word expand_word(const struct Vm *vm, struct Arena *arena,
                                const struct ShellString *string);
+static void add_color_flag(struct Arena *arena,
+                           struct RawCommand *raw_command);
+
+static int expansion_length(const struct Vm *vm,
+                            const struct ShellString *string);
+static void expand_component(const struct Vm *vm,
+                             const struct StringComponent *component,
+                             struct ExpansionBuffer *buffer);
+static bool special_variable(const struct Vm *vm,
+                             const struct StringComponent *component,
+                             int *number);
+static const char *variable_value(const struct Vm *vm,
+                                  const struct StringComponent *component);
+static void reserve(struct ExpansionBuffer *buffer, int extra);
+static void append_bytes(struct ExpansionBuffer *buffer, const char *bytes,
+                         int length);
 
 static void update_prompt(struct Vm *vm);
 
+static bool can_exec_tail(struct Vm *vm);
 static bool is_path(const char *cmd);
 static bool is_executable(const char *path);
+static void forget_missing_commands(struct Vm *vm, const struct Job *job);
 
-static char *find_in_path(const char *cmd);
-
-static int tilde_expansion(const struct Vm *vm, const char *source, int len,
-                           char **dest, int *total_size);
+static int tilde_prefix_length(const char *source, int len);
+static const char *tilde_value(const struct Vm *vm, const char *source,
+                               int end, bool lookup_users);
+static int expand_tilde(const struct Vm *vm,
+                        const struct StringComponent *component,
+                        struct ExpansionBuffer *buffer);
 
 static int change_dir(struct Vm *vm, const struct RawCommand *command);
 static int exit_shell(struct Vm *vm, const struct RawCommand *raw_command);
+static uint32_t builtin_slot(const char *name, int length);
 
-static const bool kIsEscapableInDQ[] = {
-    ['"'] = true,
-    ['\\'] = true,
-    ['$'] = true,
-    ['`'] = true,
-};
+// the tables come from src/builtins.list
+const char *BUILTIN_NAMES[] = {BUILTIN_TABLE_NAMES};
+const BuiltinFunc BUILTIN_FUNCS[] = {BUILTIN_TABLE_FUNCTIONS};
+const int BUILTIN_COUNT = BUILTIN_TABLE_COUNT;
+
+// builtins whose effect outlives the call (or that exit the shell), so running
+// them inside a `( ... )` has to be isolated in a fork
+static const bool kBuiltinChangesState[] = {BUILTIN_TABLE_CHANGES_STATE};
 
-const char *BUILTIN_NAMES[] = {"cd", "exit", "jobs", "fg"};
-const BuiltinFunc BUILTIN_FUNCS[] = {change_dir, exit_shell, list_jobs, fg};
-const int BUILTIN_COUNT = sizeof(BUILTIN_NAMES) / sizeof(BUILTIN_NAMES[0]);
+// the perfect hash of the names, see find_builtin
+static const signed char kBuiltinSlots[1 << BUILTIN_HASH_BITS] = {
+    BUILTIN_TABLE_SLOTS};
 
 struct Vm make_vm(int argc, char **argv) {
     struct passwd *userpw = getpwuid(getuid());
@@ -106,6 +185,11 @@ struct Vm make_vm(int argc, char **argv) {
     setenv("PWD", cwd, 1);
     setenv("OLDPWD", cwd, 1);
 
+    const char *spawn_env = getenv("CASH_SPAWN");
+    const bool use_spawn = spawn_env == NULL || strcmp(spawn_env, "0") != 0;
+    const char *pidfd_env = getenv("CASH_PIDFD");
+    const bool use_pidfd = pidfd_env == NULL || strcmp(pidfd_env, "0") != 0;
+
     return (struct Vm){
         .current_prompt = make_new_prompt(userpw->pw_name),
         .pwd = cwd,
@@ -118,29 +202,43 @@ struct Vm make_vm(int argc, char **argv) {
         .repl_mode = repl_mode,
         .shell_pgid = shell_pgid,
         .shell_term_state = term_state,
+        .use_spawn = use_spawn,
+        .exec_tail = false,
+
+        .jobs = make_job_table(),
+        .events = make_event_loop(use_pidfd),
+        .path_cache = make_path_cache(),
+        .source_cache = make_source_cache(),
 
         .argc = argc,
         .argv = argv,
+        .last_background_pid = 0,
+        .timer = NULL,
     };
 }
 
 void free_vm(const struct Vm *vm) {
     struct Job *next_job;
-    for (struct Job *job = vm->job_list; job != NULL; job = next_job) {
+    for (struct Job *job = vm->jobs.list; job != NULL; job = next_job) {
         next_job = job->next_job;
         free_job(job);
-        free(job);
     }
+    free_job_table(&vm->jobs);
+    free_path_cache(&vm->path_cache);
+    free_source_cache(&vm->source_cache);
+    free_timers(vm->timer);
     free(vm->current_prompt);
     free(vm->old_pwd);
     free(vm->pwd);
 }
 
 int run_program(struct Vm *vm, const struct Program *program) {
-    for (int i = 0; i < program->statement_count; ++i) {
-        exec_expression(vm, &program->statements[i].expr);
-        // run_command(vm, &program->statements[i].command);
-    }
+    const struct Chunk chunk = compile_program(program);
+    if (dump_bytecode)
+        disassemble_chunk(&chunk, stderr, 0);
+
+    run_chunk(vm, &chunk);
+    free_chunk(&chunk);
 
     if (!vm->notified_this_time)
         do_job_notification(vm);
@@ -148,85 +246,201 @@ int run_program(struct Vm *vm, const struct Program *program) {
     return vm->previous_exit_code;
 }
 
-static int get_final_command(const struct Vm *vm, const struct Command *command,
+// the dispatch loop. $? lives in vm->previous_exit_code, everything else the
+// instructions pass to each other is kept in `frame`
+static void run_chunk(struct Vm *vm, const struct Chunk *chunk) {
+    struct Frame frame = {
+        .words = NULL,
+        .word_count = 0,
+        .word_capacity = 0,
+        .command = {0},
+        .command_status = 0,
+        .arena = NULL,
+        .scratch = make_arena(),
+        .job = NULL,
+        .next_process = NULL,
+        .foreground = true,
+        .in = STDIN_FILENO,
+        .pipe_out = -1,
+        .pipe_in = -1,
+    };
+    frame.arena = &frame.scratch;
+
+    int ip = 0;
+    while (ip < chunk->count) {
+        const struct Instruction *instruction = &chunk->code[ip++];
+
+        switch (instruction->op) {
+            case OP_EXPAND_WORD: {
+                const struct Word word =
+                    expand_word(vm, frame.arena, instruction->word);
+                ADD_LIST(&frame, word_count, word_capacity, words, word,
+                         struct Word);
+                break;
+            }
+
+            case OP_BUILD_ARGV: {
+                const int count = command_word_count(instruction->command);
+                frame.word_count -= count;
+                frame.command_status = get_final_command(
+                    vm, frame.arena, instruction->command,
+                    &frame.words[frame.word_count], &frame.command);
+                break;
+            }
+
+            case OP_RUN_COMMAND:
+                run_command(vm, &frame, instruction);
+                reset_arena(&frame.scratch);
+                break;
+
+            case OP_BEGIN_JOB:
+                begin_job(vm, &frame, instruction->expr);
+                break;
+
+            case OP_PIPE: {
+                int pipefd[2];
+                if (pipe2(pipefd, O_CLOEXEC) == -1) {
+                    CASH_PERROR(EXIT_FAILURE, "pipe",
+                                "could not create pipe for job%s", "");
+                    exit(EXIT_FAILURE);
+                }
+                frame.pipe_in = pipefd[0];
+                frame.pipe_out = pipefd[1];
+                break;
+            }
+
+            case OP_SPAWN:
+            case OP_SPAWN_SUBSHELL:
+                spawn_stage(vm, &frame,
+                            instruction->op == OP_SPAWN_SUBSHELL
+                                ? &chunk->subchunks[instruction->chunk]
+                                : NULL);
+                break;
+
+            case OP_WAIT:
+                wait_for_stages(vm, &frame);
+                break;
+
+            case OP_SUBSHELL:
+                run_subshell(vm, &chunk->subchunks[instruction->chunk],
+                             instruction->flags & OP_FLAG_TAIL);
+                break;
+
+            case OP_NOT:
+                vm->previous_exit_code = vm->previous_exit_code == 0;
+                break;
+
+            case OP_JUMP_IF_ZERO:
+                if (vm->previous_exit_code == 0)
+                    ip = instruction->target;
+                break;
+
+            case OP_JUMP_IF_NONZERO:
+                if (vm->previous_exit_code != 0)
+                    ip = instruction->target;
+                break;
+
+            case OP_BEGIN_TIME:
+                start_timer(vm);
+                break;
+
+            case OP_END_TIME:
+                stop_timer(vm, instruction->expr->timed.posix);
+                break;
+        }
+    }
+
+    free(frame.words);
+    free_arena(&frame.scratch);
+}
+
+// builds the command from its expanded `words` (see command_word_count). The
+// command and everything it points to that isn't in the AST go into `arena`
+static int get_final_command(struct Vm *vm, struct Arena *arena,
+                             const struct Command *command,
+                             const struct Word *words,
                              struct RawCommand *raw_command) {
     char *executable = NULL;
+    // a command made only of redirections just performs them, like `:`
+    int builtin = find_builtin(":", 1);
     char **args = NULL;
-    if (command->command_name.component_count != 0) {
-        const struct String command_name =
-            to_string(vm, &command->command_name);
+    *raw_command = (struct RawCommand){.builtin = -1};
+    int next_word = 0;
 
+    if (command->command_name.component_count != 0) {
+        const struct Word command_name = words[next_word++];
         CASH_DEBUG("Name: %s\n", command_name.string);
-        args = malloc((command->arguments.argument_count + 2) * sizeof(*args));
-        if (!args) {
-            CASH_ERROR(EXIT_FAILURE,
-                       "could not allocate memory for arguments%s\n", "");
-            exit(EXIT_FAILURE);
+
+        // a static name was looked up when it was parsed
+        builtin = command->command_name.static_value != NULL
+                      ? command->builtin
+                      : find_builtin(command_name.string, command_name.length);
+        if (builtin != -1) {
+            executable = command_name.string;
+        } else if (is_path(command_name.string)) {
+            if (!is_executable(command_name.string)) {
+                CASH_ERROR(EXIT_FAILURE, "the path `%s` is not an executable\n",
+                           command_name.string);
+                return EXIT_FAILURE;
+            }
+            executable = command_name.string;
+        } else {
+            const char *path =
+                lookup_command_path(&vm->path_cache, command_name.string);
+            if (path == NULL) {
+                CASH_NONFATAL_ERROR("%s: command not found\n",
+                                    command_name.string);
+                return 127;
+            }
+            // the path cache may drop its copy while the job still runs
+            executable = arena_strndup(arena, path, (int)strlen(path));
         }
 
-        args[0] = strndup(command_name.string, command_name.length);
+        args = arena_alloc(arena, (command->arguments.argument_count + 2) *
+                                      sizeof(char *));
+        args[0] = command_name.string;
         CASH_DEBUG("arg 0: (len %d) %s\n", command_name.length, args[0]);
 
         for (int i = 0; i < command->arguments.argument_count; ++i) {
-            const struct String arg =
-                to_string(vm, &command->arguments.arguments[i]);
+            const struct Word arg = words[next_word++];
             CASH_DEBUG("arg %d: (len %d) %s\n", i + 1, arg.length, arg.string);
 
             args[i + 1] = arg.string;
         }
         args[command->arguments.argument_count + 1] = NULL;
         CASH_DEBUG("-----------------\n");
-
-        if (is_path(command_name.string)) {
-            if (!is_executable(command_name.string)) {
-                CASH_ERROR(EXIT_FAILURE, "the path `%s` is not an executable\n",
-                           command_name.string);
-                free_string(&command_name);
-                return EXIT_FAILURE;
-            }
-            executable = strndup(command_name.string, command_name.length);
-        } else {
-            char *res = find_in_path(command_name.string);
-            if (res == NULL) {
-                executable = strndup(command_name.string, command_name.length);
-            } else {
-                executable = res;
-            }
-        }
-
-        free_string(&command_name);
     }
 
-    struct RawRedirection *redirs =
-        malloc((command->redirection_count) * sizeof(struct RawRedirection));
-    CHECK_ALLOC(redirs);
+    struct RawRedirection *redirs = arena_alloc(
+        arena, command->redirection_count * sizeof(struct RawRedirection));
     for (int i = 0; i < command->redirection_count; ++i) {
         struct Redirection *redir = &command->redirections[i];
-        redirs[i] = get_redirection(vm, redir);
+        char *file_name = NULL;
+        if (redir->file_name.component_count != 0)
+            file_name = words[next_word++].string;
+        redirs[i] = get_redirection(redir, file_name);
     }
 
-    *raw_command =
-        (struct RawCommand){.name = executable,
-                            .args = args,
-                            .args_count = command->arguments.argument_count + 1,
-                            .redirs_count = command->redirection_count,
-                            .redirs = redirs};
+    *raw_command = (struct RawCommand){
+        .name = executable,
+        .builtin = builtin,
+        .args = args,
+        .args_count = args ? command->arguments.argument_count + 1 : 0,
+        .redirs_count = command->redirection_count,
+        .redirs = redirs};
 
     return 0;
 }
 
-static struct RawRedirection get_redirection(const struct Vm *vm,
-                                             const struct Redirection *redir) {
+static struct RawRedirection get_redirection(const struct Redirection *redir,
+                                             char *file_name) {
     struct RawRedirection raw_redir = {
         .left = redir->left,
         .right = redir->right,
         .err_to_out = false,
-        .file_name = NULL,
+        .file_name = file_name,
         .flags = -1,
     };
-    if (redir->file_name.component_count != 0) {
-        raw_redir.file_name = to_string(vm, &redir->file_name).string;
-    }
 
     switch (redir->type) {
         case REDIRECT_OUT:
@@ -273,329 +487,495 @@ static struct RawRedirection get_redirection(const struct Vm *vm,
     return raw_redir;
 }
 
-int run_command(struct Vm *vm, struct Expr *expr) {
+// OP_RUN_COMMAND: a simple command that is not part of a pipeline
+static void run_command(struct Vm *vm, struct Frame *frame,
+                        const struct Instruction *instruction) {
     if (!repl_mode)
         remove_completed_jobs(vm);
-    struct Command *command = &expr->command;
 
-    struct RawCommand raw_command;
-    const int command_expansion = get_final_command(vm, command, &raw_command);
-    if (command_expansion != 0) {
-        free_raw_command(&raw_command);
-        return command_expansion;
+    if (frame->command_status != 0) {
+        vm->previous_exit_code = frame->command_status;
+        return;
     }
-
-    if (raw_command.name == NULL) {
-        if (raw_command.redirs_count == 0) {
-            free_raw_command(&raw_command);
-            return vm->previous_exit_code;
-        } else {
-            raw_command.name = strdup("/bin/true");
-            raw_command.args = malloc(2 * sizeof(char *));
-            CHECK_ALLOC(raw_command.args);
-            raw_command.args[0] = strdup("true");
-            raw_command.args[1] = NULL;
-            raw_command.args_count = 1;
-        }
+    struct RawCommand raw_command = frame->command;
+    frame->command = (struct RawCommand){0};
+
+    if (raw_command.name == NULL && raw_command.redirs_count == 0)
+        return;
+
+    // a builtin in the background has to be a job of its own, with a pid for
+    // $! and `wait`: it runs in a fork of the shell like any pipeline stage
+    const bool background = instruction->flags & OP_FLAG_BACKGROUND;
+    if (raw_command.builtin != -1 && !background) {
+        vm->previous_exit_code =
+            run_builtin(vm, raw_command.builtin, &raw_command);
+        return;
     }
 
-    int builtin = is_builtin(raw_command.name);
-    if (builtin != -1) {
-        int res = BUILTIN_FUNCS[builtin](vm, &raw_command);
-        free_raw_command(&raw_command);
-        return res;
+    add_color_flag(&frame->scratch, &raw_command);
+
+    // nothing runs after this command, so there is no need to keep the shell
+    // around just to wait for it and pass its status on
+    if ((instruction->flags & OP_FLAG_TAIL) && can_exec_tail(vm))
+        exec_in_place(vm, &raw_command);
+
+    // the command is in `scratch`, which becomes the arena of the job
+    struct Job *job =
+        make_expr_job(vm, instruction->expr, &frame->scratch);
+    struct Process *process = make_process(job, &raw_command, NULL);
+    job->first_process = process;
+
+    launch_job(vm, job, !background);
+    if (background) {
+        vm->previous_exit_code = 0;
+        return;
     }
+    forget_missing_commands(vm, job);
+    vm->previous_exit_code = decode_status(process->status);
+}
+
+static void add_color_flag(struct Arena *arena,
+                           struct RawCommand *raw_command) {
+    if (strcmp(raw_command->args[0], "ls") != 0)
+        return;
 
-    if (strcmp(raw_command.args[0], "ls") == 0) {
-        char *color_arg = malloc((strlen("--color=auto") + 1) * sizeof(char));
-        CHECK_ALLOC(color_arg);
-        strcpy(color_arg, "--color=auto");
-
-        char **new_args = realloc(
-            raw_command.args, (raw_command.args_count + 2) * sizeof(char *));
-        CHECK_ALLOC(new_args);
-        new_args[raw_command.args_count] = color_arg;
-        new_args[raw_command.args_count + 1] = NULL;
-        raw_command.args_count++;
-        raw_command.args = new_args;
+    static char color_arg[] = "--color=auto";
+
+    // argv is the last thing allocated for the command, so this usually
+    // extends it in place
+    const size_t size = (raw_command->args_count + 1) * sizeof(char *);
+    char **new_args =
+        arena_grow(arena, raw_command->args, size, size + sizeof(char *));
+    new_args[raw_command->args_count] = color_arg;
+    new_args[raw_command->args_count + 1] = NULL;
+
+    raw_command->args_count++;
+    raw_command->args = new_args;
+}
+
+// runs a builtin in the shell process, with its redirections applied to the
+// shell's own fds for the duration of the call
+static int run_builtin(struct Vm *vm, int builtin,
+                       const struct RawCommand *raw_command) {
+    // anything still buffered belongs to the fds from before the redirections
+    fflush(stdout);
+    fflush(stderr);
+
+    struct SavedFd *saved = NULL;
+    int saved_count = 0;
+    if (raw_command->redirs_count != 0) {
+        saved = malloc(2 * raw_command->redirs_count * sizeof(struct SavedFd));
+        CHECK_ALLOC(saved);
+        saved_count = redirect_in_shell(raw_command, saved);
+        if (saved_count == -1) {
+            free(saved);
+            return EXIT_FAILURE;
+        }
     }
 
-    struct Process *process = malloc(sizeof(struct Process));
-    CHECK_ALLOC(process);
-    *process = (struct Process){
-        .next_process = NULL,
-        .raw_command = raw_command,
-        .completed = false,
-        .stopped = false,
-        .status = 0,
-        .pid = 0,
-    };
-    struct Job *job = malloc(sizeof(struct Job));
-    CHECK_ALLOC(job);
-    *job = (struct Job){
-        .next_job = NULL,
-        .first_process = process,
-        .command = strndup(expr->expr_text.string, expr->expr_text.length),
-        .notified = false,
-        .term_state = vm->shell_term_state,
-        .stderr = STDERR_FILENO,
-        .stdout = STDOUT_FILENO,
-        .stdin = STDIN_FILENO,
-        .pgid = 0};
-
-    launch_job(vm, job, !expr->background);
-
-    vm->previous_exit_code = process->status % 0xFF;
-    return vm->previous_exit_code;
+    const int res = BUILTIN_FUNCS[builtin](vm, raw_command);
+
+    // keep builtin output ordered with the output of later children
+    fflush(stdout);
+    fflush(stderr);
+    restore_fds(saved, saved_count);
+    free(saved);
+    return res;
 }
 
-static int exec_expression(struct Vm *vm, struct Expr *expr) {
-    switch (expr->type) {
-        case EXPR_COMMAND:
-            return run_command(vm, expr);
+// OP_BEGIN_JOB: the stages of the pipeline are added to the job (and started)
+// one OP_SPAWN at a time
+static void begin_job(struct Vm *vm, struct Frame *frame,
+                      const struct Expr *expr) {
+    if (!repl_mode)
+        remove_completed_jobs(vm);
 
-        case EXPR_SUBSHELL:
-            return run_subshell(vm, expr->subshell);
+    struct Arena arena = make_arena();
+    struct Job *job = make_expr_job(vm, expr, &arena);
+    add_job(vm, job);
 
-        case EXPR_NOT: {
-            if (exec_expression(vm, expr->binary.left) == 0) {
-                vm->previous_exit_code = 1;
-                return 1;
-            }
-            vm->previous_exit_code = 0;
-            return 0;
-        }
+    frame->job = job;
+    frame->arena = &job->arena;
+    frame->next_process = &job->first_process;
+    frame->foreground = !expr->background;
+    frame->in = job->stdin;
+}
 
-        case EXPR_AND:
-        case EXPR_OR: {
-            const int left = exec_expression(vm, expr->binary.left);
-            if ((left == 0 && expr->type == EXPR_AND) ||
-                (left != 0 && expr->type == EXPR_OR)) {
-                vm->previous_exit_code =
-                    exec_expression(vm, expr->binary.right);
-                return vm->previous_exit_code;
-            } else {
-                vm->previous_exit_code = left;
-                return left;
-            }
-        }
+// OP_SPAWN, OP_SPAWN_SUBSHELL: starts the next stage of the job with the pipe
+// opened for it, if any. A stage whose command could not be built is only
+// recorded with its status, the others still run
+static void spawn_stage(struct Vm *vm, struct Frame *frame,
+                        const struct Chunk *subshell) {
+    struct Job *job = frame->job;
+    const int out = frame->pipe_out != -1 ? frame->pipe_out : job->stdout;
+
+    struct Process *process;
+    if (subshell != NULL) {
+        process = make_process(job, NULL, subshell);
+    } else {
+        process = make_process(job, &frame->command, NULL);
+        frame->command = (struct RawCommand){0};
+    }
+    *frame->next_process = process;
+    frame->next_process = &process->next_process;
 
-        case EXPR_PIPELINE: {
-            struct Job *job = malloc(sizeof(struct Job));
-            CHECK_ALLOC(job);
-            int res = make_job(vm, expr, job);
-            int i = 0;
-            for (struct Process *process = job->first_process; process != NULL;
-                 (process = process->next_process), ++i) {
-                struct RawCommand *raw_command = &process->raw_command;
-                CASH_DEBUG("Command %d:\n\tName: %s\n", i, raw_command->name);
-                for (int j = 0; j < raw_command->args_count; ++j) {
-                    CASH_DEBUG("\tArg %d: %s\n", j, raw_command->args[j]);
-                }
-            }
-            CASH_DEBUG("res: %d\n", res);
-            if (res == 0) {
-                launch_job(vm, job, !expr->background);
-                if (!expr->background) {
-                    assert(job_is_completed(job));
-                    for (struct Process *process = job->first_process;
-                         process != NULL; process = process->next_process) {
-                        vm->previous_exit_code = process->status % 0xFF;
-                        res = vm->previous_exit_code;
-                    }
-                }
-            } else
-                CASH_ERROR(EXIT_FAILURE, "could not make job%s", "");
-            return res;
-        }
+    if (subshell == NULL && frame->command_status != 0) {
+        process->status = frame->command_status << 8;
+        process->completed = true;
+    } else {
+        if (process->raw_command.args != NULL)
+            add_color_flag(&job->arena, &process->raw_command);
+        start_process(vm, job, process, frame->in, out, frame->foreground);
+    }
 
-        default:
-            CASH_ERROR(EXIT_FAILURE, "unimplemented%s", "");
-            exit(EXIT_FAILURE);
+    if (frame->in != job->stdin)
+        close(frame->in);
+    if (out != job->stdout)
+        close(out);
+
+    frame->in = frame->pipe_in;
+    frame->pipe_in = -1;
+    frame->pipe_out = -1;
+}
+
+// OP_WAIT: the status of a pipeline is the status of its last stage
+static void wait_for_stages(struct Vm *vm, struct Frame *frame) {
+    struct Job *job = frame->job;
+    frame->job = NULL;
+    frame->next_process = NULL;
+    frame->in = STDIN_FILENO;
+    frame->arena = &frame->scratch;
+
+    finish_job(vm, job, frame->foreground);
+    if (!frame->foreground) {
+        vm->previous_exit_code = 0;
+        return;
+    }
+
+    assert(job_is_completed(job));
+    forget_missing_commands(vm, job);
+    for (const struct Process *process = job->first_process; process != NULL;
+         process = process->next_process) {
+        vm->previous_exit_code = decode_status(process->status);
     }
 }
 
-static int run_subshell(struct Vm *vm, struct Program *program) {
+static void run_subshell(struct Vm *vm, const struct Chunk *body, bool tail) {
+    // the shell exits after a subshell in tail position, so nothing the body
+    // does has to be kept away from it
+    if (tail && vm->exec_tail) {
+        run_chunk(vm, body);
+        return;
+    }
+
+    if (can_elide_subshell(vm, body->program)) {
+        CASH_DEBUG(GREEN "Running subshell without a fork\n" RESET);
+        // the body ends in tail position, but the shell goes on after it
+        const bool exec_tail = vm->exec_tail;
+        vm->exec_tail = false;
+        run_chunk(vm, body);
+        vm->exec_tail = exec_tail;
+        return;
+    }
+
     CASH_DEBUG(GREEN "Entering subshell\n" RESET);
+    struct timespec started, ended;
+    clock_gettime(CLOCK_MONOTONIC, &started);
     const pid_t pid = fork();
 
-    if (pid == 0) {
-        int status = run_program(vm, program);
-        exit(status);
-    }
+    if (pid == 0)
+        run_forked_subshell(vm, body);
 
     int status;
-    waitpid(pid, &status, 0);
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    clock_gettime(CLOCK_MONOTONIC, &ended);
     CASH_DEBUG(GREEN "Exiting subshell\n" RESET);
-    return status;
+    // what the subshell's children used is in there too, once it waited for
+    // them
+    if (vm->timer != NULL)
+        add_timed_usage(vm->timer, "(...)", (int)strlen("(...)"), &started,
+                        &ended, &usage);
+    vm->previous_exit_code = decode_status(status);
 }
 
-static void make_process(struct Vm *vm, const struct Command *command,
-                         struct Process *process) {
-    struct RawCommand raw_command;
-    get_final_command(vm, command, &raw_command);
+// runs the body of a subshell in a process forked for it and exits with its
+// status. The body ends the process, so its last command can be exec'd in place
+void run_forked_subshell(struct Vm *vm, const struct Chunk *body) {
+    // the jobs in the table belong to the parent shell, the subshell can't
+    // wait for them and doesn't have to. Their pids could come back as pids of
+    // its own children
+    leave_parent_jobs(vm);
+    vm->exec_tail = true;
+    run_chunk(vm, body);
+    exit(vm->previous_exit_code);
+}
 
-    *process = (struct Process){
-        .next_process = NULL,
-        .raw_command = raw_command,
-        .pid = 0,
-        .status = 0,
-        .completed = false,
-        .stopped = false,
-    };
+// runs the cash script `raw_command` resolved to in this process, which is a
+// fork of the shell or a shell that would exit after exec'ing it, and exits
+// with its status. The script gets what a new cash would have: $0 is its path
+// as exec'd, the arguments are $1, $2, ... and there are no jobs. This process
+// ends with the script, so nothing here is freed
+void run_script_in_place(struct Vm *vm, struct SourceCacheEntry *script,
+                         const struct RawCommand *raw_command) {
+    repl_mode = false;
+    vm->repl_mode = false;
+    leave_parent_jobs(vm);
+    vm->exec_tail = true;
+
+    char **argv = malloc((raw_command->args_count + 1) * sizeof(char *));
+    CHECK_ALLOC(argv);
+    argv[0] = raw_command->name;
+    memcpy(&argv[1], &raw_command->args[1],
+           raw_command->args_count * sizeof(char *));
+    vm->argc = raw_command->args_count - 1;
+    vm->argv = argv;
+    // nothing may drop the parse while it runs, this process never frees it
+    script->running++;
+    exit(run_program(vm, &script->parser.program));
 }
 
-static int make_process_list(struct Vm *vm, const struct Expr *expr,
-                             struct Process ***process_list) {
-    if (expr->binary.left->type == EXPR_PIPELINE) {
-        int res = make_process_list(vm, expr->binary.left, process_list);
-        if (res != 0)
-            return res;
-    } else {
-        assert(expr->binary.left->type == EXPR_COMMAND);
-        struct Process *new_process = malloc(sizeof(struct Process));
-        CHECK_ALLOC(new_process);
-        make_process(vm, &expr->binary.left->command, new_process);
-        **process_list = new_process;
-        *process_list = &new_process->next_process;
+// a subshell needs its own process only to keep what its body does to the
+// shell from leaking out. A body that is a single command, pipeline or AND/OR
+// list of commands that run in children anyway (or of builtins that don't
+// touch the shell) can run directly, saving a fork and a wait
+static bool can_elide_subshell(struct Vm *vm, const struct Program *program) {
+    return program->statement_count == 1 &&
+           !program->statements[0].expr.background &&
+           runs_in_child(vm, &program->statements[0].expr);
+}
+
+static bool runs_in_child(struct Vm *vm, const struct Expr *expr) {
+    switch (expr->type) {
+        case EXPR_SUBSHELL:
+        case EXPR_PIPELINE:
+            // every stage is a child process, and so is a nested subshell
+            // that could not be elided itself
+            return true;
+
+        case EXPR_NOT:
+            return runs_in_child(vm, expr->negated);
+
+        case EXPR_TIME:
+            return runs_in_child(vm, expr->timed.expr);
+
+        case EXPR_AND_OR:
+            for (int i = 0; i < expr->and_or.item_count; ++i) {
+                if (!runs_in_child(vm, &expr->and_or.items[i].expr))
+                    return false;
+            }
+            return true;
+
+        case EXPR_COMMAND: {
+            const struct ShellString *name = &expr->command.command_name;
+            if (name->component_count == 0)
+                return true;
+            // `$cmd` could name any builtin
+            if (name->static_value == NULL)
+                return false;
+
+            return expr->command.builtin == -1 ||
+                   !kBuiltinChangesState[expr->command.builtin];
+        }
+
+        default:
+            return false;
     }
+}
 
-    assert(expr->binary.right->type == EXPR_COMMAND);
-    struct Process *new_process = malloc(sizeof(struct Process));
-    CHECK_ALLOC(new_process);
-    make_process(vm, &expr->binary.right->command, new_process);
-    **process_list = new_process;
-    *process_list = &new_process->next_process;
-    return 0;
+// the job of `expr`, see make_job
+static struct Job *make_expr_job(const struct Vm *vm,
+                                 const struct Expr *expr,
+                                 struct Arena *arena) {
+    struct Job *job = make_job(vm, expr->expr_text.string,
+                               expr->expr_text.length, arena);
+    // without job control, a background job must not compete with the shell
+    // for its input: POSIX gives it /dev/null. finish_job closes it
+    if (expr->background && !repl_mode) {
+        const int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (null_fd != -1)
+            job->stdin = null_fd;
+    }
+    return job;
 }
 
-static int make_job(struct Vm *vm, const struct Expr *expr, struct Job *jobp) {
-    struct Job job = {
-        .first_process = NULL,
-        .command = strndup(expr->expr_text.string, expr->expr_text.length),
-        .pgid = 0,
-        .notified = false,
-        .term_state = vm->shell_term_state,
-        .stdout = STDOUT_FILENO,
-        .stdin = STDIN_FILENO,
-        .stderr = STDERR_FILENO,
-    };
-    struct Process **proc_list = &job.first_process;
-    make_process_list(vm, expr, &proc_list);
-    *jobp = job;
-    return 0;
+int decode_status(int status) {
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return WEXITSTATUS(status);
 }
 
-struct String expand_component(const struct Vm *vm,
-                               const struct StringComponent *component) {
-    char *string = NULL;
+// a word is expanded into one allocation: expansion_length sizes it up front
+// and every component is written straight into it
+static struct Word expand_word(const struct Vm *vm, struct Arena *arena,
+                               const struct ShellString *string) {
+    if (string->static_value != NULL) {
+        return (struct Word){.string = string->static_value,
+                             .length = string->static_length};
+    }
 
-    switch (component->type) {
-        case STRING_COMPONENT_VAR_SUB: {
-            if (component->length == 1 &&
-                component->var_substitution[0] == '?') {
-                return number_to_string(vm->previous_exit_code);
-            }
+    struct ExpansionBuffer buffer = {
+        .arena = arena, .string = NULL, .length = 0, .capacity = 0};
+    reserve(&buffer, expansion_length(vm, string) + 1);
+    for (int i = 0; i < string->component_count; ++i)
+        expand_component(vm, &string->components[i], &buffer);
 
-            if (component->length == 1 &&
-                component->var_substitution[0] == '#') {
-                return number_to_string(vm->argc);
-            }
+    reserve(&buffer, 1);
+    buffer.string[buffer.length] = '\0';
+    return (struct Word){.string = buffer.string, .length = buffer.length};
+}
 
-            int n;
-            if ((n = is_number(component->var_substitution)) != -1) {
-                if (n > vm->argc)
-                    return (struct String){NULL, 0};
-                return (struct String){.string = strdup(vm->argv[n]),
-                                       .length = (int)strlen(vm->argv[n])};
+// length of the expansion of `string`. Exact, except that a `~user` prefix
+// isn't looked up twice and the buffer grows for it instead
+static int expansion_length(const struct Vm *vm,
+                            const struct ShellString *string) {
+    int length = 0;
+    for (int i = 0; i < string->component_count; ++i) {
+        const struct StringComponent *component = &string->components[i];
+        switch (component->type) {
+            case STRING_COMPONENT_VAR_SUB: {
+                int number;
+                if (special_variable(vm, component, &number)) {
+                    length += MAX_INT_DIGITS;
+                } else {
+                    const char *value = variable_value(vm, component);
+                    length += value ? (int)strlen(value) : 0;
+                }
+                break;
             }
 
-            const char *value = getenv(component->var_substitution);
-            if (value == NULL) {
-                return (struct String){NULL, 0};
+            case STRING_COMPONENT_LITERAL:
+                if (component->literal[0] == '~') {
+                    const char *home = tilde_value(vm, component->literal,
+                                                   tilde_prefix_length(
+                                                       component->literal,
+                                                       component->length),
+                                                   false);
+                    length += home ? (int)strlen(home) : 0;
+                }
+                length += component->length;
+                break;
+
+            case STRING_COMPONENT_DQ:
+            case STRING_COMPONENT_SQ:
+                length += component->length;
+                break;
+
+            default:
+                break;
+        }
+    }
+    return length;
+}
+
+static void expand_component(const struct Vm *vm,
+                             const struct StringComponent *component,
+                             struct ExpansionBuffer *buffer) {
+    switch (component->type) {
+        case STRING_COMPONENT_VAR_SUB: {
+            int number;
+            if (special_variable(vm, component, &number)) {
+                reserve(buffer, MAX_INT_DIGITS + 1);
+                buffer->length +=
+                    snprintf(&buffer->string[buffer->length],
+                             MAX_INT_DIGITS + 1, "%d", number);
+                break;
             }
-            return (struct String){.string = strdup(value),
-                                   .length = (int)strlen(value)};
+
+            const char *value = variable_value(vm, component);
+            if (value != NULL)
+                append_bytes(buffer, value, (int)strlen(value));
+            break;
         }
+
         case STRING_COMPONENT_LITERAL:
         case STRING_COMPONENT_DQ: {
-            int i, start = 0, total_size = 0;
-
+            int start = 0;
             if (component->type == STRING_COMPONENT_LITERAL &&
                 component->literal[0] == '~') {
-                start =
-                    tilde_expansion(vm, component->literal, component->length,
-                                    &string, &total_size);
-            }
-
-            for (i = start; i < component->length; ++i) {
-                if (component->literal[i] == '\\') {
-                    if (i + 1 == component->length)
-                        break;
-                    if (component->type == STRING_COMPONENT_LITERAL ||
-                        component->literal[i + 1] == '\\' ||
-                        (component->type == STRING_COMPONENT_DQ &&
-                         kIsEscapableInDQ[(unsigned char)
-                                              component->literal[i + 1]])) {
-                    } else
-                        continue;
-
-                    const int length = i - start + 1;
-                    string = grow_string(string, total_size + length);
-                    strncpy(&string[total_size], &component->literal[start],
-                            length - 1);
-                    string[total_size + length - 1] = component->literal[i + 1];
-                    total_size += length;
-                    start = i + 2;
-                    i++;
-                }
-            }
-            if (start != i) {
-                const int length = i - start;
-                string = grow_string(string, total_size + length);
-                strncpy(&string[total_size], &component->literal[start],
-                        length);
-                total_size += length;
+                start = expand_tilde(vm, component, buffer);
             }
 
-            return (struct String){string, total_size};
+            reserve(buffer, component->length - start);
+            buffer->length += copy_unescaped(&buffer->string[buffer->length],
+                                             component, start);
+            break;
         }
 
         case STRING_COMPONENT_SQ:
-            return (struct String){
-                strndup(component->literal, component->length),
-                component->length};
+            append_bytes(buffer, component->literal, component->length);
+            break;
 
         default:
-            return (struct String){.string = "", .length = 0};
+            break;
     }
 }
 
-// TODO: can make expand_component write directly to a single
-// allocated string, instead of allocating a new one for each
-// compoenent and then freeing it
-struct String to_string(const struct Vm *vm, const struct ShellString *string) {
-    char *str = NULL;
-    int total_size = 0;
-
-    for (int i = 0; i < string->component_count; ++i) {
-        const struct String expanded =
-            expand_component(vm, &string->components[i]);
-        const int is_last_comp = i + 1 == string->component_count;
-        const int new_alloc_size = total_size + expanded.length + is_last_comp;
+// `$?`, `$#` and `$!`, which are numbers formatted on expansion. `$!` is empty
+// until a job was put in the background
+static bool special_variable(const struct Vm *vm,
+                             const struct StringComponent *component,
+                             int *number) {
+    if (component->length != 1)
+        return false;
+
+    switch (component->var_substitution[0]) {
+        case '?':
+            *number = vm->previous_exit_code;
+            return true;
+        case '#':
+            *number = vm->argc;
+            return true;
+        case '!':
+            *number = (int)vm->last_background_pid;
+            return vm->last_background_pid != 0;
+        default:
+            return false;
+    }
+}
 
-        str = grow_string(str, new_alloc_size);
-        strncpy(&str[total_size], expanded.string, expanded.length);
-        total_size += expanded.length;
+// value of a positional parameter or environment variable, NULL if unset. The
+// name isn't NUL-terminated, so environ is searched by hand instead of getenv
+static const char *variable_value(const struct Vm *vm,
+                                  const struct StringComponent *component) {
+    const char *name = component->var_substitution;
+    const int length = component->length;
+
+    int n = 0;
+    int digits = 0;
+    // more digits than fit an int can't be a set positional parameter
+    while (digits < length && digits < 9 &&
+           isdigit((unsigned char)name[digits]))
+        n = n * 10 + (name[digits++] - '0');
+    if (digits == length)
+        return n > vm->argc ? NULL : vm->argv[n];
+
+    for (char **variable = environ; *variable != NULL; ++variable) {
+        if (strncmp(*variable, name, length) == 0 && (*variable)[length] == '=')
+            return &(*variable)[length + 1];
+    }
+    return NULL;
+}
 
-        if (is_last_comp) {
-            str[new_alloc_size - 1] = '\0';
-        }
+static void reserve(struct ExpansionBuffer *buffer, int extra) {
+    if (buffer->length + extra <= buffer->capacity)
+        return;
 
-        free(expanded.string);
-    }
+    int capacity = buffer->capacity == 0 ? 16 : buffer->capacity * 2;
+    while (capacity < buffer->length + extra)
+        capacity *= 2;
+    buffer->string =
+        arena_grow(buffer->arena, buffer->string, buffer->length, capacity);
+    buffer->capacity = capacity;
+}
 
-    return (struct String){.string = str, .length = total_size};
+static void append_bytes(struct ExpansionBuffer *buffer, const char *bytes,
+                         int length) {
+    reserve(buffer, length);
+    memcpy(&buffer->string[buffer->length], bytes, length);
+    buffer->length += length;
 }
 
 static void update_prompt(struct Vm *vm) {
@@ -676,13 +1056,41 @@ static int exit_shell(struct Vm *vm, const struct RawCommand *raw_command) {
     return vm->previous_exit_code;
 }
 
-int is_builtin(const char *name) {
-    for (int i = 0; i < BUILTIN_COUNT; ++i) {
-        if (strcmp(name, BUILTIN_NAMES[i]) == 0) {
-            return i;
-        }
+// one hash and one compare: every builtin has a slot of its own in
+// kBuiltinSlots (tools/builtin_gen.c picks the seed that makes it so), and any
+// other name lands on an empty slot or on a builtin it isn't equal to
+int find_builtin(const char *name, int length) {
+    if (length > BUILTIN_TABLE_MAX_LENGTH)
+        return -1;
+    const int builtin = kBuiltinSlots[builtin_slot(name, length)];
+    if (builtin == -1 || strncmp(BUILTIN_NAMES[builtin], name, length) != 0 ||
+        BUILTIN_NAMES[builtin][length] != '\0')
+        return -1;
+    return builtin;
+}
+
+// FNV-1a started from the seed, the top bits pick the slot. Has to match
+// builtin_slot in tools/builtin_gen.c
+static uint32_t builtin_slot(const char *name, int length) {
+    uint32_t hash = 2166136261u ^ BUILTIN_HASH_SEED;
+    for (int i = 0; i < length; ++i)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash >> (32 - BUILTIN_HASH_BITS);
+}
+
+// the last command can only replace the shell when the shell has nothing left
+// to do after it, which includes waiting for background jobs
+static bool can_exec_tail(struct Vm *vm) {
+    if (!vm->exec_tail)
+        return false;
+
+    update_status(vm);
+    for (const struct Job *job = vm->jobs.list; job != NULL;
+         job = job->next_job) {
+        if (!job_is_completed(job))
+            return false;
     }
-    return -1;
+    return true;
 }
 
 static bool is_path(const char *cmd) {
@@ -693,67 +1101,53 @@ static bool is_executable(const char *path) {
     return access(path, X_OK) == 0;
 }
 
-static char *find_in_path(const char *cmd) {
-    const char *path_env = getenv("PATH");
-    if (!path_env)
-        return NULL;
-
-    char *paths = strdup(path_env);
-    if (!paths)
-        return NULL;
-
-    char *dir = strtok(paths, ":");
-    while (dir) {
-        const size_t len = strlen(dir) + strlen(cmd) + 2;
-        char *full_path = malloc(len);
-        if (!full_path)
-            break;
-        snprintf(full_path, len, "%s/%s", dir, cmd);
-        // printf("checking path (cmd: %s) %s\n", cmd, full_path);
-
-        if (is_executable(full_path)) {
-            free(paths);
-            return full_path;
-        }
-
-        free(full_path);
-        dir = strtok(NULL, ":");
+// an exec that failed with ENOENT (exit status 127) means the cached path went
+// stale, so the next lookup has to search $PATH again
+static void forget_missing_commands(struct Vm *vm, const struct Job *job) {
+    for (const struct Process *process = job->first_process; process != NULL;
+         process = process->next_process) {
+        if (WIFEXITED(process->status) && WEXITSTATUS(process->status) == 127 &&
+            process->raw_command.args != NULL &&
+            !is_path(process->raw_command.args[0]))
+            forget_command_path(&vm->path_cache, process->raw_command.args[0]);
     }
-
-    free(paths);
-    return NULL;
 }
-static int tilde_expansion(const struct Vm *vm, const char *source, int len,
-                           char **dest, int *total_size) {
+
+// `~` up to the first `/`
+static int tilde_prefix_length(const char *source, int len) {
     int end = 1;
     while (end < len && source[end] != '/')
         ++end;
+    return end;
+}
 
-    char *expansion;
+// what the tilde prefix of length `end` expands to, NULL if it stays as it is.
+// `~user` is only looked up if `lookup_users` is set
+static const char *tilde_value(const struct Vm *vm, const char *source,
+                               int end, bool lookup_users) {
+    if (end == 1)
+        return vm->userpw->pw_dir;
+    if (end == 2 && (source[1] == '+' || source[1] == '-'))
+        return source[1] == '+' ? vm->pwd : vm->old_pwd;
+    if (!lookup_users)
+        return NULL;
 
-    if (end == 1) {
-        expansion = vm->userpw->pw_dir;
-    } else if (end == 2 && (source[1] == '+' || source[1] == '-')) {
-        expansion = source[1] == '+' ? vm->pwd : vm->old_pwd;
-    } else {
-        char *name_copy = strndup_null_terminated(source + 1, end - 1);
-        struct passwd *user = getpwnam(name_copy);
-        if (!user)
-            expansion = NULL;
-        else
-            expansion = user->pw_dir;
-        free(name_copy);
-    }
+    char *name_copy = strndup_null_terminated(source + 1, end - 1);
+    const struct passwd *user = getpwnam(name_copy);
+    free(name_copy);
+    return user ? user->pw_dir : NULL;
+}
 
-    if (!expansion) {
-        *total_size += end;
-        *dest = grow_string(*dest, *total_size);
-        strncpy(&(*dest)[*total_size - end], source, end);
-    } else {
-        const int expansion_size = (int)strlen(expansion);
-        *dest = grow_string(*dest, *total_size + expansion_size);
-        memcpy(&(*dest)[*total_size], expansion, expansion_size);
-        *total_size += expansion_size;
-    }
+// returns the length of the prefix it expanded
+static int expand_tilde(const struct Vm *vm,
+                        const struct StringComponent *component,
+                        struct ExpansionBuffer *buffer) {
+    const int end = tilde_prefix_length(component->literal, component->length);
+    const char *expansion = tilde_value(vm, component->literal, end, true);
+
+    if (expansion == NULL)
+        append_bytes(buffer, component->literal, end);
+    else
+        append_bytes(buffer, expansion, (int)strlen(expansion));
     return end;
 }
@@ -26,3 +26,14 @@ echo ""
 false && echo SHOULD_NOT_PRINT || echo "Exit status: $?"
 echo ""
 
+echo ""
+
+true & [ -n "$!" ] && echo "Background builtin has a pid"
+false & wait $! || echo "Background builtin status: $?"
+true & wait $! && echo "Background builtin waited for"
+sleep 0.01 & sleep 0.1; wait %1 && echo "Finished job waited for by id"
+echo ""
+
+!false && echo "Negation without a space"
+[ a != b ] && echo "!= is a word for test"
+echo 12"a" 12\ b 3x
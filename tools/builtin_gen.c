@@ -0,0 +1,228 @@
+// generates the builtin tables from src/builtins.list, see the comment at the
+// top of that file for its format. The names get a perfect hash: a seed for
+// which builtin_slot() sends every name to its own slot of a small table
+//
+// usage: builtin_gen SPEC OUTPUT
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BUILTINS 64
+#define MAX_NAME_LENGTH 32
+#define MAX_LINE_LENGTH 1024
+// slots per name at least, more only if no seed is found
+#define MIN_LOAD_BITS 1
+#define MAX_TABLE_BITS 10
+#define MAX_SEEDS 1000000
+
+struct Builtin {
+    char name[MAX_NAME_LENGTH];
+    char function[MAX_NAME_LENGTH];
+    bool changes_state;
+};
+
+struct Table {
+    struct Builtin builtins[MAX_BUILTINS];
+    int count;
+
+    uint32_t seed;
+    int bits;
+    int slots[1 << MAX_TABLE_BITS];
+};
+
+static const char *spec_path;
+static int line_number;
+
+static void parse_spec(struct Table *table, FILE *spec);
+static void copy_field(char *to, const char *field, const char *what);
+static void find_seed(struct Table *table);
+static bool try_seed(struct Table *table, uint32_t seed, int bits);
+static uint32_t builtin_slot(const char *name, size_t length, uint32_t seed,
+                             int bits);
+static uint32_t list_hash(const struct Table *table);
+static void write_header(const struct Table *table, FILE *out);
+static _Noreturn void fail(const char *message, const char *detail);
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s SPEC OUTPUT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    spec_path = argv[1];
+    FILE *spec = fopen(spec_path, "r");
+    if (spec == NULL) {
+        perror(spec_path);
+        return EXIT_FAILURE;
+    }
+
+    static struct Table table;
+    parse_spec(&table, spec);
+    fclose(spec);
+    find_seed(&table);
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    write_header(&table, out);
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void parse_spec(struct Table *table, FILE *spec) {
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, sizeof(line), spec) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char *rest = line;
+        const char *name = strtok_r(rest, " \t\r\n", &rest);
+        if (name == NULL)
+            continue;
+        const char *function = strtok_r(rest, " \t\r\n", &rest);
+        if (function == NULL)
+            fail("missing function for", name);
+        const char *flag = strtok_r(rest, " \t\r\n", &rest);
+        if (flag != NULL && strcmp(flag, "state") != 0)
+            fail("unknown flag", flag);
+
+        for (int i = 0; i < table->count; ++i) {
+            if (strcmp(table->builtins[i].name, name) == 0)
+                fail("duplicate builtin", name);
+        }
+        if (table->count == MAX_BUILTINS)
+            fail("too many builtins at", name);
+
+        struct Builtin *builtin = &table->builtins[table->count++];
+        copy_field(builtin->name, name, "name too long");
+        copy_field(builtin->function, function, "function name too long");
+        builtin->changes_state = flag != NULL;
+    }
+    line_number = 0;
+    if (table->count == 0)
+        fail("no builtins", "");
+}
+
+static void copy_field(char *to, const char *field, const char *what) {
+    if (strlen(field) >= MAX_NAME_LENGTH)
+        fail(what, field);
+    strcpy(to, field);
+}
+
+// the smallest table that some seed makes collision free, starting at twice
+// the number of builtins
+static void find_seed(struct Table *table) {
+    int bits = 0;
+    while ((1 << bits) < table->count)
+        bits++;
+    for (bits += MIN_LOAD_BITS; bits <= MAX_TABLE_BITS; ++bits) {
+        for (uint32_t seed = 0; seed < MAX_SEEDS; ++seed) {
+            if (try_seed(table, seed, bits))
+                return;
+        }
+    }
+    fail("no perfect hash found", "");
+}
+
+static bool try_seed(struct Table *table, uint32_t seed, int bits) {
+    memset(table->slots, -1, sizeof(table->slots));
+    for (int i = 0; i < table->count; ++i) {
+        const char *name = table->builtins[i].name;
+        const uint32_t slot = builtin_slot(name, strlen(name), seed, bits);
+        if (table->slots[slot] != -1)
+            return false;
+        table->slots[slot] = i;
+    }
+    table->seed = seed;
+    table->bits = bits;
+    return true;
+}
+
+// FNV-1a started from the seed, the top bits pick the slot. Has to match
+// builtin_slot in src/vm.c
+static uint32_t builtin_slot(const char *name, size_t length, uint32_t seed,
+                             int bits) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash >> (32 - bits);
+}
+
+// changes with any change to the list that moves an index
+static uint32_t list_hash(const struct Table *table) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < table->count; ++i) {
+        const char *name = table->builtins[i].name;
+        for (size_t j = 0; j <= strlen(name); ++j)
+            hash = (hash ^ (unsigned char)name[j]) * 16777619u;
+    }
+    return hash;
+}
+
+static void write_header(const struct Table *table, FILE *out) {
+    fprintf(out,
+            "// generated by tools/builtin_gen.c from src/builtins.list, do "
+            "not edit\n\n"
+            "#ifndef CASH_BUILTIN_TABLE_H\n"
+            "#define CASH_BUILTIN_TABLE_H\n\n");
+
+    size_t max_length = 0;
+    for (int i = 0; i < table->count; ++i) {
+        if (strlen(table->builtins[i].name) > max_length)
+            max_length = strlen(table->builtins[i].name);
+    }
+    fprintf(out,
+            "#define BUILTIN_TABLE_COUNT %d\n"
+            "#define BUILTIN_TABLE_MAX_LENGTH %zu\n"
+            "// changes whenever an index does\n"
+            "#define BUILTIN_TABLE_HASH 0x%08xu\n\n",
+            table->count, max_length, list_hash(table));
+
+    fprintf(out, "#define BUILTIN_TABLE_NAMES");
+    for (int i = 0; i < table->count; ++i) {
+        fprintf(out, " \\\n    \"%s\"%s", table->builtins[i].name,
+                i + 1 < table->count ? "," : "");
+    }
+    fprintf(out, "\n\n#define BUILTIN_TABLE_FUNCTIONS");
+    for (int i = 0; i < table->count; ++i) {
+        fprintf(out, " \\\n    %s%s", table->builtins[i].function,
+                i + 1 < table->count ? "," : "");
+    }
+    fprintf(out, "\n\n#define BUILTIN_TABLE_CHANGES_STATE");
+    for (int i = 0; i < table->count; ++i) {
+        fprintf(out, " \\\n    %s%s",
+                table->builtins[i].changes_state ? "true" : "false",
+                i + 1 < table->count ? "," : "");
+    }
+
+    fprintf(out,
+            "\n\n#define BUILTIN_HASH_SEED %uu\n"
+            "#define BUILTIN_HASH_BITS %d\n\n"
+            "// the builtin in each slot of the hash, -1 for none\n"
+            "#define BUILTIN_TABLE_SLOTS",
+            table->seed, table->bits);
+    for (int slot = 0; slot < 1 << table->bits; ++slot) {
+        fprintf(out, "%s%d%s", slot % 16 == 0 ? " \\\n    " : " ",
+                table->slots[slot], slot + 1 < 1 << table->bits ? "," : "");
+    }
+    fprintf(out, "\n\n#endif  // CASH_BUILTIN_TABLE_H\n");
+}
+
+static _Noreturn void fail(const char *message, const char *detail) {
+    if (line_number != 0)
+        fprintf(stderr, "%s:%d: %s %s\n", spec_path, line_number, message,
+                detail);
+    else
+        fprintf(stderr, "%s: %s %s\n", spec_path, message, detail);
+    exit(EXIT_FAILURE);
+}
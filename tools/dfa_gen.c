@@ -0,0 +1,320 @@
+// generates the transition table of the lexer from src/parser/lexer.dfa, see
+// the comment at the top of that file for its format
+//
+// usage: dfa_gen SPEC OUTPUT
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NAMES 64
+#define MAX_NAME_LENGTH 32
+#define MAX_LINE_LENGTH 1024
+
+struct Names {
+    char names[MAX_NAMES][MAX_NAME_LENGTH];
+    int count;
+};
+
+struct Dfa {
+    struct Names classes;  // OTHER is added after the ones in the spec
+    struct Names states;
+    struct Names actions;
+
+    int byte_classes[256];
+    int number_slots[MAX_NAMES];
+    // a state, or an action offset by the number of states. -1 if not given
+    int transitions[MAX_NAMES][MAX_NAMES];
+};
+
+static const char *spec_path;
+static int line_number;
+
+static void parse_spec(struct Dfa *dfa, FILE *spec);
+static void parse_class(struct Dfa *dfa, char *bytes);
+static void parse_transition(struct Dfa *dfa, const char *from, char *classes,
+                             const char *target);
+static void check_dfa(const struct Dfa *dfa);
+static void write_header(const struct Dfa *dfa, FILE *out);
+static void write_names(const char *type, const char *prefix,
+                        const struct Names *names, int first, FILE *out);
+
+static int add_name(struct Names *names, const char *name);
+static int find_name(const struct Names *names, const char *name);
+static int parse_byte(const char *text);
+static _Noreturn void fail(const char *message, const char *detail);
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s SPEC OUTPUT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    spec_path = argv[1];
+    FILE *spec = fopen(spec_path, "r");
+    if (spec == NULL) {
+        perror(spec_path);
+        return EXIT_FAILURE;
+    }
+
+    static struct Dfa dfa;
+    memset(dfa.transitions, -1, sizeof(dfa.transitions));
+    memset(dfa.number_slots, -1, sizeof(dfa.number_slots));
+    parse_spec(&dfa, spec);
+    fclose(spec);
+    check_dfa(&dfa);
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    write_header(&dfa, out);
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void parse_spec(struct Dfa *dfa, FILE *spec) {
+    char line[MAX_LINE_LENGTH];
+    // classes are numbered as they come, and OTHER is added once they're done
+    bool classes_done = false;
+
+    while (fgets(line, sizeof(line), spec) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char *rest = line;
+        const char *keyword = strtok_r(rest, " \t\r\n", &rest);
+        if (keyword == NULL)
+            continue;
+
+        if (strcmp(keyword, "class") == 0) {
+            if (classes_done)
+                fail("classes have to come before states", keyword);
+            parse_class(dfa, rest);
+            continue;
+        }
+
+        if (!classes_done) {
+            const int other = add_name(&dfa->classes, "OTHER");
+            for (int byte = 0; byte < 256; ++byte) {
+                if (dfa->byte_classes[byte] == 0)
+                    dfa->byte_classes[byte] = other;
+                else
+                    dfa->byte_classes[byte]--;
+            }
+            classes_done = true;
+        }
+
+        const char *name = strtok_r(rest, " \t\r\n", &rest);
+        if (name == NULL)
+            fail("missing name after", keyword);
+
+        if (strcmp(keyword, "state") == 0) {
+            const int state = add_name(&dfa->states, name);
+            const char *slot = strtok_r(rest, " \t\r\n", &rest);
+            if (slot != NULL)
+                dfa->number_slots[state] = atoi(slot);
+        } else if (strcmp(keyword, "action") == 0) {
+            add_name(&dfa->actions, name);
+        } else {
+            const char *target = strtok_r(rest, " \t\r\n", &rest);
+            if (target == NULL)
+                fail("missing target state or action for", keyword);
+            // `name` holds the classes here
+            parse_transition(dfa, keyword, (char *)name, target);
+        }
+    }
+}
+
+// bytes are stored as class + 1 until OTHER exists, so that 0 means no class
+static void parse_class(struct Dfa *dfa, char *bytes) {
+    const char *name = strtok_r(bytes, " \t\r\n", &bytes);
+    if (name == NULL)
+        fail("missing class name", "");
+    const int class = add_name(&dfa->classes, name);
+
+    const char *text;
+    while ((text = strtok_r(bytes, " \t\r\n", &bytes)) != NULL) {
+        int first = parse_byte(text);
+        int last = first;
+        if (strlen(text) == 3 && text[1] == '-') {
+            first = (unsigned char)text[0];
+            last = (unsigned char)text[2];
+        }
+
+        for (int byte = first; byte <= last; ++byte) {
+            if (dfa->byte_classes[byte] != 0)
+                fail("byte is in two classes", text);
+            dfa->byte_classes[byte] = class + 1;
+        }
+    }
+}
+
+static void parse_transition(struct Dfa *dfa, const char *from, char *classes,
+                             const char *target) {
+    const int state = find_name(&dfa->states, from);
+    if (state == -1)
+        fail("unknown state", from);
+
+    int next;
+    if (target[0] == '!') {
+        next = find_name(&dfa->actions, target + 1);
+        if (next == -1)
+            fail("unknown action", target);
+        next += dfa->states.count;
+    } else {
+        next = find_name(&dfa->states, target);
+        if (next == -1)
+            fail("unknown state", target);
+    }
+
+    if (strcmp(classes, "*") == 0) {
+        for (int class = 0; class < dfa->classes.count; ++class) {
+            if (dfa->transitions[state][class] == -1)
+                dfa->transitions[state][class] = next;
+        }
+        return;
+    }
+
+    const char *name;
+    while ((name = strtok_r(classes, ",", &classes)) != NULL) {
+        const int class = find_name(&dfa->classes, name);
+        if (class == -1)
+            fail("unknown class", name);
+        if (dfa->transitions[state][class] != -1)
+            fail("two transitions on the same class", name);
+        dfa->transitions[state][class] = next;
+    }
+}
+
+// every state needs a transition for every class, and numbers can only be
+// collected from digits
+static void check_dfa(const struct Dfa *dfa) {
+    line_number = 0;
+    if (dfa->states.count == 0)
+        fail("no states", "");
+
+    const int digit = find_name(&dfa->classes, "DIGIT");
+    for (int state = 0; state < dfa->states.count; ++state) {
+        for (int class = 0; class < dfa->classes.count; ++class) {
+            const int next = dfa->transitions[state][class];
+            if (next == -1)
+                fail("missing transition in state", dfa->states.names[state]);
+            if (next < dfa->states.count && dfa->number_slots[next] != -1 &&
+                class != digit) {
+                fail("numbered state entered on something else than DIGIT",
+                     dfa->states.names[next]);
+            }
+        }
+    }
+}
+
+static void write_header(const struct Dfa *dfa, FILE *out) {
+    fprintf(out,
+            "// generated by tools/dfa_gen.c from src/parser/lexer.dfa, do not "
+            "edit\n\n"
+            "#ifndef CASH_PARSER_LEXER_DFA_H\n"
+            "#define CASH_PARSER_LEXER_DFA_H\n\n");
+
+    write_names("LexClass", "LEX_CLASS_", &dfa->classes, 0, out);
+    write_names("LexState", "LEX_STATE_", &dfa->states, 0, out);
+    fprintf(out, "// a transition to an action ends the token\n");
+    write_names("LexAction", "LEX_ACTION_", &dfa->actions, dfa->states.count,
+                out);
+
+    fprintf(out, "static const unsigned char kLexClasses[256] = {");
+    for (int byte = 0; byte < 256; ++byte) {
+        fprintf(out, "%s%2d,", byte % 16 == 0 ? "\n    " : " ",
+                dfa->byte_classes[byte]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out,
+            "static const unsigned char "
+            "kLexTransitions[LEX_STATE_COUNT][LEX_CLASS_COUNT] = {\n");
+    for (int state = 0; state < dfa->states.count; ++state) {
+        fprintf(out, "    [LEX_STATE_%s] = {", dfa->states.names[state]);
+        for (int class = 0; class < dfa->classes.count; ++class) {
+            fprintf(out, "%s%d", class == 0 ? "" : ", ",
+                    dfa->transitions[state][class]);
+        }
+        fprintf(out, "},\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out,
+            "// the number digits leading into a state go to, -1 for none\n"
+            "static const signed char kLexNumberSlots[LEX_STATE_COUNT] = {");
+    for (int state = 0; state < dfa->states.count; ++state) {
+        fprintf(out, "%s%d", state == 0 ? "" : ", ",
+                dfa->number_slots[state]);
+    }
+    fprintf(out, "};\n\n#endif  // CASH_PARSER_LEXER_DFA_H\n");
+}
+
+static void write_names(const char *type, const char *prefix,
+                        const struct Names *names, int first, FILE *out) {
+    fprintf(out, "enum %s {\n", type);
+    for (int i = 0; i < names->count; ++i) {
+        if (i == 0 && first != 0)
+            fprintf(out, "    %s%s = %d,\n", prefix, names->names[i], first);
+        else
+            fprintf(out, "    %s%s,\n", prefix, names->names[i]);
+    }
+    fprintf(out, "    %sCOUNT\n};\n\n", prefix);
+}
+
+static int add_name(struct Names *names, const char *name) {
+    if (find_name(names, name) != -1)
+        fail("duplicate name", name);
+    if (names->count == MAX_NAMES || strlen(name) >= MAX_NAME_LENGTH)
+        fail("too many names, or name too long", name);
+    strcpy(names->names[names->count], name);
+    return names->count++;
+}
+
+static int find_name(const struct Names *names, const char *name) {
+    for (int i = 0; i < names->count; ++i) {
+        if (strcmp(names->names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int parse_byte(const char *text) {
+    if (text[0] == '\\' && strlen(text) == 2) {
+        switch (text[1]) {
+            case '0':
+                return '\0';
+            case 'n':
+                return '\n';
+            case 't':
+                return '\t';
+            case 'r':
+                return '\r';
+            case 's':
+                return ' ';
+            default:
+                break;
+        }
+    }
+    if (strlen(text) != 1 && !(strlen(text) == 3 && text[1] == '-'))
+        fail("bad byte", text);
+    return (unsigned char)text[0];
+}
+
+static _Noreturn void fail(const char *message, const char *detail) {
+    if (line_number != 0)
+        fprintf(stderr, "%s:%d: %s %s\n", spec_path, line_number, message,
+                detail);
+    else
+        fprintf(stderr, "%s: %s %s\n", spec_path, message, detail);
+    exit(EXIT_FAILURE);
+}